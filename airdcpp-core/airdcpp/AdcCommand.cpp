@@ -66,84 +66,58 @@ void AdcCommand::parse(const string& aLine, bool nmdc /* = false */) {
 
 	string::size_type len = aLine.length();
 	const char* buf = aLine.c_str();
-	string cur;
-	cur.reserve(128);
+
+	if(i < len) {
+		parameters.reserve(parameters.size() + count(buf + i, buf + len, ' ') + 1);
+	}
 
 	bool toSet = false;
 	bool featureSet = false;
 	bool fromSet = nmdc; // $ADCxxx never have a from CID...
 
 	while(i < len) {
-		switch(buf[i]) {
-		case '\\':
-			++i;
-			if(i == len)
-				throw ParseException("Escape at eol");
-			if(buf[i] == 's')
-				cur += ' ';
-			else if(buf[i] == 'n')
-				cur += '\n';
-			else if(buf[i] == '\\')
-				cur += '\\';
-			else if(buf[i] == ' ' && nmdc)	// $ADCGET escaping, leftover from old specs
-				cur += ' ';
-			else
-				throw ParseException("Unknown escape");
-			break;
-		case ' ': 
-			// New parameter...
-			{
-				if((type == TYPE_BROADCAST || type == TYPE_DIRECT || type == TYPE_ECHO || type == TYPE_FEATURE) && !fromSet) {
-					if(cur.length() != 4) {
-						throw ParseException("Invalid SID length");
-					}
-					from = toSID(cur);
-					fromSet = true;
-				} else if((type == TYPE_DIRECT || type == TYPE_ECHO) && !toSet) {
-					if(cur.length() != 4) {
-						throw ParseException("Invalid SID length");
-					}
-					to = toSID(cur);
-					toSet = true;
-				} else if(type == TYPE_FEATURE && !featureSet) {
-					if(cur.length() % 5 != 0) {
-						throw ParseException("Invalid feature length");
-					}
-					// Skip...
-					featureSet = true;
-				} else {
-					parameters.push_back(cur);
-				}
-				cur.clear();
+		// Find the end of the parameter
+		auto start = i;
+		bool escaped = false;
+		for(; i < len && buf[i] != ' '; ++i) {
+			if(buf[i] == '\\') {
+				escaped = true;
+				++i;
+				if(i == len)
+					throw ParseException("Escape at eol");
 			}
-			break;
-		default:
-			cur += buf[i];
 		}
-		++i;
-	}
-	if(!cur.empty()) {
+
+		// Most parameters don't contain escapes and they are copied directly from the line
+		auto getToken = [&] { return escaped ? unescape(buf + start, i - start, nmdc) : string(buf + start, i - start); };
+
 		if((type == TYPE_BROADCAST || type == TYPE_DIRECT || type == TYPE_ECHO || type == TYPE_FEATURE) && !fromSet) {
+			auto cur = getToken();
 			if(cur.length() != 4) {
 				throw ParseException("Invalid SID length");
 			}
 			from = toSID(cur);
 			fromSet = true;
 		} else if((type == TYPE_DIRECT || type == TYPE_ECHO) && !toSet) {
+			auto cur = getToken();
 			if(cur.length() != 4) {
 				throw ParseException("Invalid SID length");
 			}
 			to = toSID(cur);
 			toSet = true;
 		} else if(type == TYPE_FEATURE && !featureSet) {
-			if(cur.length() % 5 != 0) {
+			if(getToken().length() % 5 != 0) {
 				throw ParseException("Invalid feature length");
 			}
 			// Skip...
 			featureSet = true;
+		} else if(escaped) {
+			parameters.push_back(unescape(buf + start, i - start, nmdc));
 		} else {
-			parameters.push_back(cur);
+			parameters.emplace_back(buf + start, i - start);
 		}
+
+		++i; // separator
 	}
 
 	if((type == TYPE_BROADCAST || type == TYPE_DIRECT || type == TYPE_ECHO || type == TYPE_FEATURE) && !fromSet) {
@@ -159,6 +133,32 @@ void AdcCommand::parse(const string& aLine, bool nmdc /* = false */) {
 	}
 }
 
+string AdcCommand::unescape(const char* aStr, size_t aLen, bool nmdc) {
+	string ret;
+	ret.reserve(aLen);
+	for(size_t i = 0; i < aLen; ++i) {
+		if(aStr[i] != '\\') {
+			ret += aStr[i];
+			continue;
+		}
+
+		++i;
+		if(i == aLen)
+			throw ParseException("Escape at eol");
+		if(aStr[i] == 's')
+			ret += ' ';
+		else if(aStr[i] == 'n')
+			ret += '\n';
+		else if(aStr[i] == '\\')
+			ret += '\\';
+		else if(aStr[i] == ' ' && nmdc)	// $ADCGET escaping, leftover from old specs
+			ret += ' ';
+		else
+			throw ParseException("Unknown escape");
+	}
+	return ret;
+}
+
 string AdcCommand::toString(const CID& aCID) const {
 	return getHeaderString(aCID) + getParamString(false);
 }
@@ -173,6 +173,8 @@ public:
 	static uint32_t toSID(const string& aSID) { return *reinterpret_cast<const uint32_t*>(aSID.data()); }
 	static string fromSID(const uint32_t aSID) { return string(reinterpret_cast<const char*>(&aSID), sizeof(aSID)); }
 private:
+	static string unescape(const char* aStr, size_t aLen, bool nmdc);
+
 	string getHeaderString(const CID& cid) const;
 	string getHeaderString() const;
 	string getHeaderString(uint32_t sid, bool nmdc) const;
@@ -670,7 +670,7 @@ void AdcHub::handle(AdcCommand::SCH, AdcCommand& c) noexcept {
 		}
 	}
 
-	SearchManager::getInstance()->respond(c, *ou, isUdpActive, getIpPort(), getShareProfile());
+	SearchManager::getInstance()->respondAsync(c, ou, isUdpActive, getIpPort(), getShareProfile());
 }
 
 void AdcHub::handle(AdcCommand::RES, AdcCommand& c) noexcept {
@@ -0,0 +1,176 @@
+/*
+ * Copyright (C) 2011-2015 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "stdinc.h"
+#include "BinaryShareCache.h"
+
+#include "File.h"
+#include "ZUtils.h"
+
+namespace dcpp {
+
+static size_t align8(size_t aPos) noexcept {
+	return (aPos + 7) & ~static_cast<size_t>(7);
+}
+
+uint32_t BinaryShareCache::Writer::addString(const string& aStr) noexcept {
+	auto i = stringIndices.find(aStr);
+	if (i != stringIndices.end()) {
+		return i->second;
+	}
+
+	auto index = static_cast<uint32_t>(stringOffsets.size() - 1);
+	stringData += aStr;
+	stringOffsets.push_back(static_cast<uint32_t>(stringData.size()));
+	stringIndices.emplace(aStr, index);
+	return index;
+}
+
+uint32_t BinaryShareCache::Writer::addDirectory(const string& aName, uint32_t aParent, uint64_t aLastWrite) noexcept {
+	directories.push_back({ addString(aName), aParent, static_cast<uint32_t>(files.size()), 0, aLastWrite });
+	return static_cast<uint32_t>(directories.size() - 1);
+}
+
+void BinaryShareCache::Writer::addFile(const string& aName) noexcept {
+	dcassert(!directories.empty());
+	files.push_back({ addString(aName) });
+	directories.back().fileCount++;
+}
+
+void BinaryShareCache::Writer::save(const string& aPath) const throw(FileException) {
+	// Build the data following the header
+	ByteVector data;
+	auto append = [&data](const void* aBuf, size_t aLen) {
+		auto p = static_cast<const uint8_t*>(aBuf);
+		data.insert(data.end(), p, p + aLen);
+		data.resize(align8(data.size()));
+	};
+
+	append(&stringOffsets[0], stringOffsets.size() * sizeof(uint32_t));
+	append(stringData.data(), stringData.size());
+	if (!directories.empty())
+		append(&directories[0], directories.size() * sizeof(DirectoryRecord));
+	if (!files.empty())
+		append(&files[0], files.size() * sizeof(FileRecord));
+
+	CRC32Filter crc;
+	if (!data.empty())
+		crc(&data[0], data.size());
+
+	Header header;
+	memzero(&header, sizeof(header));
+	header.magic = MAGIC;
+	header.version = VERSION;
+	header.stringCount = static_cast<uint32_t>(stringOffsets.size() - 1);
+	header.directoryCount = static_cast<uint32_t>(directories.size());
+	header.fileCount = static_cast<uint32_t>(files.size());
+	header.checksum = crc.getValue();
+	header.stringDataSize = stringData.size();
+	header.dataSize = data.size();
+
+	{
+		//create a backup first in case we get interrupted on creation.
+		File f(aPath + ".tmp", File::WRITE, File::TRUNCATE | File::CREATE);
+		f.write(&header, sizeof(header));
+		if (!data.empty())
+			f.write(&data[0], data.size());
+	}
+
+	File::deleteFile(aPath);
+	File::renameFile(aPath + ".tmp", aPath);
+}
+
+BinaryShareCache::Reader::Reader(File& aFile) throw(FileException, ShareCacheException) {
+	{
+		auto size = aFile.getSize();
+		if (size < static_cast<int64_t>(sizeof(Header))) {
+			throw ShareCacheException("Invalid cache file");
+		}
+
+		data.resize(static_cast<size_t>(size));
+		size_t len = data.size();
+		aFile.setPos(0);
+		if (aFile.read(&data[0], len) != data.size()) {
+			throw ShareCacheException("Invalid cache file");
+		}
+	}
+
+	header = reinterpret_cast<const Header*>(&data[0]);
+	if (header->magic != MAGIC || header->version != VERSION) {
+		throw ShareCacheException("Unsupported cache version");
+	}
+
+	if (header->dataSize != data.size() - sizeof(Header)) {
+		throw ShareCacheException("Invalid cache file");
+	}
+
+	// Validate the table sizes before accessing anything
+	auto pos = sizeof(Header);
+	auto take = [&](uint64_t aLen) -> const uint8_t* {
+		if (aLen > data.size() - pos) {
+			throw ShareCacheException("Invalid cache file");
+		}
+
+		auto p = &data[0] + pos;
+		pos = align8(pos + static_cast<size_t>(aLen));
+		pos = min(pos, data.size());
+		return p;
+	};
+
+	stringOffsets = reinterpret_cast<const uint32_t*>(take((static_cast<uint64_t>(header->stringCount) + 1) * sizeof(uint32_t)));
+	stringData = reinterpret_cast<const char*>(take(header->stringDataSize));
+	directories = reinterpret_cast<const DirectoryRecord*>(take(static_cast<uint64_t>(header->directoryCount) * sizeof(DirectoryRecord)));
+	files = reinterpret_cast<const FileRecord*>(take(static_cast<uint64_t>(header->fileCount) * sizeof(FileRecord)));
+
+	CRC32Filter crc;
+	crc(&data[0] + sizeof(Header), data.size() - sizeof(Header));
+	if (crc.getValue() != header->checksum) {
+		throw ShareCacheException("Checksum mismatch");
+	}
+
+	// Check the references so that the tables can be used without further validation
+	for (uint32_t i = 0; i < header->stringCount; ++i) {
+		if (stringOffsets[i] > stringOffsets[i + 1] || stringOffsets[i + 1] > header->stringDataSize) {
+			throw ShareCacheException("Invalid string table");
+		}
+	}
+
+	if (header->directoryCount == 0) {
+		throw ShareCacheException("Invalid directory table");
+	}
+
+	for (uint32_t i = 0; i < header->directoryCount; ++i) {
+		const auto& d = directories[i];
+		if (d.name >= header->stringCount || (i == 0) != (d.parent == NO_PARENT) || (i > 0 && d.parent >= i) ||
+			d.firstFile > header->fileCount || d.fileCount > header->fileCount - d.firstFile) {
+			throw ShareCacheException("Invalid directory table");
+		}
+	}
+
+	for (uint32_t i = 0; i < header->fileCount; ++i) {
+		if (files[i].name >= header->stringCount) {
+			throw ShareCacheException("Invalid file table");
+		}
+	}
+}
+
+string BinaryShareCache::Reader::getString(uint32_t aIndex) const noexcept {
+	return string(stringData + stringOffsets[aIndex], stringOffsets[aIndex + 1] - stringOffsets[aIndex]);
+}
+
+} // namespace dcpp
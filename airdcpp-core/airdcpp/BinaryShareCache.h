@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2011-2015 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef DCPLUSPLUS_DCPP_BINARY_SHARE_CACHE_H
+#define DCPLUSPLUS_DCPP_BINARY_SHARE_CACHE_H
+
+#include "typedefs.h"
+
+#include "Exception.h"
+
+namespace dcpp {
+
+class File;
+
+STANDARD_EXCEPTION(ShareCacheException);
+
+/*
+Binary share cache of a single root directory
+
+The file consists of fixed-size tables so that it can be used directly after reading (or mapping) it to memory:
+
+Header
+String table: uint32 offsets (string count + 1), followed by the UTF-8 data
+Directory table: parents are always listed before their children, the first one is the root
+File table: files of a directory are stored consecutively
+
+Only the names are stored for the files, their size and TTH are taken from the hash database when loading
+(as with the XML cache).
+
+Integers are stored in the byte order of the host (caches with a different order will fail the magic check)
+and the tables are aligned to 8 bytes.
+The checksum is calculated from all data following the header.
+*/
+class BinaryShareCache {
+public:
+	static const uint32_t MAGIC = 0x43534441; // "ADSC"
+	static const uint32_t VERSION = 2;
+	static const uint32_t NO_PARENT = numeric_limits<uint32_t>::max();
+
+	struct Header {
+		uint32_t magic;
+		uint32_t version;
+		uint32_t stringCount;
+		uint32_t directoryCount;
+		uint32_t fileCount;
+		uint32_t checksum;
+		uint64_t stringDataSize;
+		uint64_t dataSize;
+	};
+
+	struct DirectoryRecord {
+		uint32_t name;
+		uint32_t parent;
+		uint32_t firstFile;
+		uint32_t fileCount;
+		uint64_t lastWrite;
+	};
+
+	struct FileRecord {
+		uint32_t name;
+	};
+
+	class Writer : boost::noncopyable {
+	public:
+		/** Returns the index of the directory */
+		uint32_t addDirectory(const string& aName, uint32_t aParent, uint64_t aLastWrite) noexcept;
+
+		/** Adds a file in the previously added directory */
+		void addFile(const string& aName) noexcept;
+
+		/** The file is replaced atomically */
+		void save(const string& aPath) const throw(FileException);
+	private:
+		uint32_t addString(const string& aStr) noexcept;
+
+		// Names are stored only once
+		unordered_map<string, uint32_t> stringIndices;
+		vector<uint32_t> stringOffsets = { 0 };
+		string stringData;
+
+		vector<DirectoryRecord> directories;
+		vector<FileRecord> files;
+	};
+
+	class Reader : boost::noncopyable {
+	public:
+		/** Reads and validates the whole file (from the beginning) */
+		Reader(File& aFile) throw(FileException, ShareCacheException);
+
+		uint32_t getDirectoryCount() const noexcept { return header->directoryCount; }
+		const DirectoryRecord& getDirectory(uint32_t aIndex) const noexcept { return directories[aIndex]; }
+		const FileRecord& getFile(uint32_t aIndex) const noexcept { return files[aIndex]; }
+		string getString(uint32_t aIndex) const noexcept;
+	private:
+		ByteVector data;
+
+		const Header* header;
+		const uint32_t* stringOffsets;
+		const char* stringData;
+		const DirectoryRecord* directories;
+		const FileRecord* files;
+	};
+};
+
+} // namespace dcpp
+
+#endif // !defined(DCPLUSPLUS_DCPP_BINARY_SHARE_CACHE_H)
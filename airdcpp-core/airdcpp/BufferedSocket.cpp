@@ -25,6 +25,7 @@
 
 #include "ConnectivityManager.h"
 #include "SettingsManager.h"
+#include "SocketReactor.h"
 #include "SSLSocket.h"
 #include "Streams.h"
 #include "ThrottleManager.h"
@@ -39,6 +40,15 @@ using std::max;
 // Polling is used for tasks...should be fixed...
 #define POLL_TIMEOUT 250
 
+// Maximum number of reads/writes for a single reactor run (so that other sockets won't be starved)
+#define REACTOR_IO_LIMIT 16
+
+// Maximum number of bytes to send from a file with a single call
+#define DIRECT_SEND_SIZE (1024*1024)
+
+// Maximum time to wait for the remaining data to be sent before a graceful disconnect
+#define DISCONNECT_SEND_TIMEOUT 10000
+
 BufferedSocket::BufferedSocket(char aSeparator, bool v4only) :
 separator(aSeparator), useLimiter(false), mode(MODE_LINE), dataBytes(0), rollback(0), state(STARTING),
 disconnecting(false), v4only(v4only)
@@ -188,14 +198,14 @@ void BufferedSocket::threadAccept() {
 	}
 }
 
-void BufferedSocket::threadRead() {
+bool BufferedSocket::threadRead() {
 	if(state != RUNNING)
-		return;
+		return false;
 
-	int left = (mode == MODE_DATA && useLimiter) ? ThrottleManager::getInstance()->read(sock.get(), &inbuf[0], inbuf.size()) : sock->read(&inbuf[0], inbuf.size());
+	int left = (mode == MODE_DATA && useLimiter) ? ThrottleManager::getInstance()->read(sock.get(), &inbuf[0], inbuf.size(), reactorId != -1 ? &readThrottled : nullptr, &limits) : sock->read(&inbuf[0], inbuf.size());
 	if(left == -1) {
 		// EWOULDBLOCK, no data received...
-		return;
+		return false;
 	} else if(left == 0) {
 		// This socket has been closed...
 		throw SocketException(STRING(CONNECTION_CLOSED));
@@ -238,7 +248,7 @@ void BufferedSocket::threadRead() {
 
 					break;
 				}
-			case MODE_LINE:
+			case MODE_LINE: {
 				// Special to autodetect nmdc connections...
 				if(separator == 0) {
 					if(inbuf[0] == '$') {
@@ -247,23 +257,39 @@ void BufferedSocket::threadRead() {
 						separator = '\n';
 					}
 				}
-				l = line + string ((char*)&inbuf[bufpos], left);
-				while ((pos = l.find(separator)) != string::npos) {
-	                if(pos > 0) // check empty (only pipe) command and don't waste cpu with it ;o)
-						fire(BufferedSocketListener::Line(), l.substr(0, pos));
-					l.erase (0, pos + 1 /* separator char */);
-					if (l.length() < (size_t)left) left = l.length();
+
+				// Split the lines directly from the read buffer, only an incomplete line is stored for the next read
+				const char* p = (const char*)&inbuf[bufpos];
+				const char* end = p + left;
+				const char* sep;
+				while ((sep = (const char*)memchr(p, separator, end - p)) != nullptr) {
+					if (line.empty()) {
+						lineBuf.assign(p, sep);
+					} else {
+						line.append(p, sep);
+						lineBuf.swap(line);
+						line.clear();
+					}
+
+					p = sep + 1 /* separator char */;
+					left = end - p;
+					bufpos = total - left;
+
+					if (!lineBuf.empty()) // check empty (only pipe) command and don't waste cpu with it ;o)
+						fire(BufferedSocketListener::Line(), lineBuf);
+
 					if (mode != MODE_LINE) {
-						// we changed mode; remainder of l is invalid.
-						l.clear();
-						bufpos = total - left;
+						// we changed mode; the rest of the buffer belongs to the new mode
 						break;
 					}
 				}
-				if (pos == string::npos) 
+
+				if (mode == MODE_LINE) {
+					line.append(p, end);
 					left = 0;
-				line = l;
+				}
 				break;
+			}
 			case MODE_DATA:
 				while(left > 0) {
 					if(dataBytes == -1) {
@@ -292,6 +318,8 @@ void BufferedSocket::threadRead() {
 	if(mode == MODE_LINE && line.size() > static_cast<size_t>(SETTING(MAX_COMMAND_LENGTH))) {
 		throw SocketException(STRING(COMMAND_TOO_LONG));
 	}
+
+	return true;
 }
 
 void BufferedSocket::threadSendFile(InputStream* file) {
@@ -301,6 +329,16 @@ void BufferedSocket::threadSendFile(InputStream* file) {
 	if(disconnecting)
 		return;
 	dcassert(file != NULL);
+
+	// Plain data from a file can be sent without reading it to user space
+	if(canSendDirect()) {
+		int64_t maxBytes = -1;
+		auto f = file->getDirectFile(maxBytes);
+		if(f && threadSendDirect(file, *f, maxBytes)) {
+			return;
+		}
+	}
+
 	size_t sockSize = (size_t)sock->getSocketOptInt(SO_SNDBUF);
 	size_t bufSize = max(sockSize, (size_t)64*1024);
 
@@ -350,7 +388,7 @@ void BufferedSocket::threadSendFile(InputStream* file) {
 				written = sock->write(&writeBufTmp[writePos], writeSize);
 			} else {
 				writeSize = min(sockSize / 2, writeBufTmp.size() - writePos);
-				written = useLimiter ? ThrottleManager::getInstance()->write(sock.get(), &writeBufTmp[writePos], writeSize) : sock->read(&inbuf[0], inbuf.size());
+				written = useLimiter ? ThrottleManager::getInstance()->write(sock.get(), &writeBufTmp[writePos], writeSize, nullptr, &limits) : sock->write(&writeBufTmp[writePos], writeSize);
 			}
 			
 			if(written > 0) {
@@ -389,6 +427,307 @@ void BufferedSocket::threadSendFile(InputStream* file) {
 	}
 }
 
+int BufferedSocket::sendDirect(InputStream* aStream, File& aFile, int64_t& maxBytes_) {
+	auto len = maxBytes_ == -1 ? DIRECT_SEND_SIZE : static_cast<int>(min(maxBytes_, (int64_t)DIRECT_SEND_SIZE));
+	if(len == 0) {
+		return 0;
+	}
+
+	auto sent = sock->sendFile(aFile, len);
+	if(sent > 0) {
+		aStream->skipDirect(sent);
+		if(maxBytes_ != -1) {
+			maxBytes_ -= sent;
+		}
+
+		fire(BufferedSocketListener::BytesSent(), sent, sent);
+	}
+
+	return sent;
+}
+
+bool BufferedSocket::threadSendDirect(InputStream* aStream, File& aFile, int64_t aMaxBytes) {
+	while(!disconnecting) {
+		if(!canSendDirect()) {
+			// A limit was added during the transfer
+			return false;
+		}
+
+		auto sent = sendDirect(aStream, aFile, aMaxBytes);
+		if(sent == 0) {
+			fire(BufferedSocketListener::TransmitDone());
+			return true;
+		}
+
+		if(sent == -1) {
+			auto w = sock->wait(POLL_TIMEOUT, true, true);
+			if(w.first) {
+				threadRead();
+			}
+		}
+	}
+
+	return true;
+}
+
+void BufferedSocket::reactorSend() {
+	writeBlocked = false;
+	writeThrottled = false;
+
+	for (int i = 0; i < REACTOR_IO_LIMIT; ++i) {
+		if (disconnecting) {
+			clearSendData();
+			return;
+		}
+
+		if (sendPos < sendBuf.size()) {
+			int n = sock->write(&sendBuf[sendPos], sendBuf.size() - sendPos);
+			if (n == -1) {
+				writeBlocked = true;
+				return;
+			}
+
+			sendPos += n;
+			if (sendPos == sendBuf.size()) {
+				sendBuf.clear();
+				sendPos = 0;
+			}
+		} else if (directFile) {
+			if (!canSendDirect()) {
+				// A limit was added during the transfer, send the rest through the limiter
+				directFile = nullptr;
+				sockSize = (size_t)sock->getSocketOptInt(SO_SNDBUF);
+				fileBuf.resize(max(sockSize, (size_t)64*1024));
+				continue;
+			}
+
+			auto sent = sendDirect(transmitStream, *directFile, directBytes);
+			if (sent == 0) {
+				clearSendData();
+				fire(BufferedSocketListener::TransmitDone());
+				return;
+			}
+
+			if (sent == -1) {
+				writeBlocked = true;
+				return;
+			}
+		} else if (transmitStream) {
+			if (filePos == fileLen) {
+				if (fileReadDone) {
+					clearSendData();
+					fire(BufferedSocketListener::TransmitDone());
+					return;
+				}
+
+				// Fill the buffer
+				size_t bytesRead = fileBuf.size();
+				fileLen = transmitStream->read(&fileBuf[0], bytesRead);
+				filePos = 0;
+
+				if (bytesRead > 0) {
+					fire(BufferedSocketListener::BytesSent(), bytesRead, 0);
+				}
+
+				if (fileLen == 0) {
+					fileReadDone = true;
+				}
+				continue;
+			}
+
+			int written = 0;
+			size_t writeSize = 0;
+			if (lastWriteSize > 0) {
+				// workaround for OpenSSL (crashes when previous write failed and now retrying with different writeSize)
+				writeSize = lastWriteSize;
+				written = sock->write(&fileBuf[filePos], writeSize);
+			} else {
+				writeSize = min(sockSize / 2, fileLen - filePos);
+				written = useLimiter ? ThrottleManager::getInstance()->write(sock.get(), &fileBuf[filePos], writeSize, &writeThrottled, &limits) : sock->write(&fileBuf[filePos], writeSize);
+			}
+
+			if (written > 0) {
+				lastWriteSize = 0;
+				filePos += written;
+				fire(BufferedSocketListener::BytesSent(), 0, written);
+			} else if (written == -1) {
+				lastWriteSize = writeSize;
+				writeBlocked = true;
+				return;
+			} else if (writeThrottled) {
+				return;
+			}
+		} else {
+			return;
+		}
+	}
+}
+
+bool BufferedSocket::canSendDirect() const noexcept {
+	// Checked again for each part so that limits added during the transfer will apply
+	return sock->canSendFile() && (!useLimiter || !ThrottleManager::getInstance()->isUploadLimited(&limits));
+}
+
+bool BufferedSocket::hasDisconnectTask() noexcept {
+	Lock l(cs);
+	return any_of(tasks.begin(), tasks.end(), [](const pair<Tasks, unique_ptr<TaskData> >& t) { return t.first == DISCONNECT || t.first == SHUTDOWN; });
+}
+
+void BufferedSocket::clearSendData() noexcept {
+	sendBuf.clear();
+	sendPos = 0;
+
+	transmitStream = nullptr;
+	directFile = nullptr;
+	directBytes = -1;
+	ByteVector().swap(fileBuf);
+	filePos = fileLen = 0;
+	fileReadDone = false;
+	lastWriteSize = 0;
+
+	writeBlocked = false;
+	writeThrottled = false;
+}
+
+int BufferedSocket::reactorProcess(bool aReadable, bool aWritable) {
+	if (state == RUNNING && (aReadable || readPending)) {
+		readPending = false;
+		for (int i = 0; threadRead();) {
+			if (++i == REACTOR_IO_LIMIT) {
+				readPending = true;
+				break;
+			}
+		}
+
+		if (readThrottled) {
+			readPending = true;
+		}
+	}
+
+	for (;;) {
+		if (state == RUNNING && hasSendData()) {
+			if (disconnecting) {
+				clearSendData();
+				continue;
+			}
+
+			if (writeBlocked && !aWritable) {
+				if (!hasDisconnectTask()) {
+					break;
+				}
+
+				// Try to send the remaining data (such as an error message) before disconnecting,
+				// but the socket may never become writable again so don't let it hold back the disconnect forever
+				auto tick = GET_TICK();
+				if (disconnectSendDeadline == 0) {
+					disconnectSendDeadline = tick + DISCONNECT_SEND_TIMEOUT;
+				}
+
+				if (tick < disconnectSendDeadline) {
+					break;
+				}
+
+				clearSendData();
+				continue;
+			}
+
+			aWritable = false;
+			reactorSend();
+			if (hasSendData()) {
+				// Keep the task order
+				break;
+			}
+		}
+
+		pair<Tasks, unique_ptr<TaskData> > p;
+		{
+			Lock l(cs);
+			if (tasks.empty())
+				break;
+
+			p = move(tasks.front());
+			tasks.pop_front();
+		}
+
+		if (p.first == SHUTDOWN) {
+			SocketReactor::getInstance()->remove(this);
+			if (p.second)
+				static_cast<CallData*>(p.second.get())->f();
+			delete this;
+			return REACTOR_DELETED;
+		} else if (p.first == ASYNC_CALL) {
+			static_cast<CallData*>(p.second.get())->f();
+		} else if (state != RUNNING) {
+			continue;
+		} else if (p.first == SEND_DATA) {
+			Lock l(cs);
+			writeBuf.swap(sendBuf);
+			writeBuf.clear();
+			sendPos = 0;
+		} else if (p.first == SEND_FILE) {
+			if (!disconnecting) {
+				transmitStream = static_cast<SendFileInfo*>(p.second.get())->stream;
+				dcassert(transmitStream);
+
+				if (canSendDirect()) {
+					directFile = transmitStream->getDirectFile(directBytes);
+				}
+
+				if (!directFile) {
+					sockSize = (size_t)sock->getSocketOptInt(SO_SNDBUF);
+					fileBuf.resize(max(sockSize, (size_t)64*1024));
+				}
+			}
+		} else if (p.first == DISCONNECT) {
+			fail(STRING(DISCONNECTED));
+		} else {
+			dcdebug("%d unexpected in RUNNING state\n", p.first);
+		}
+	}
+
+	if (state != RUNNING) {
+		return 0;
+	}
+
+	int flags = 0;
+	if (readThrottled) {
+		flags |= REACTOR_THROTTLED;
+	} else {
+		flags |= REACTOR_READ;
+		if (readPending)
+			flags |= REACTOR_PENDING;
+	}
+
+	if (hasSendData()) {
+		if (writeBlocked) {
+			flags |= REACTOR_WRITE;
+			if (disconnectSendDeadline > 0) {
+				// Check the timeout periodically
+				flags |= REACTOR_THROTTLED;
+			}
+		} else if (writeThrottled) {
+			flags |= REACTOR_THROTTLED;
+		} else {
+			flags |= REACTOR_PENDING;
+		}
+	}
+
+	return flags;
+}
+
+int BufferedSocket::reactorRun(bool aReadable, bool aWritable) noexcept {
+	for (;;) {
+		try {
+			return reactorProcess(aReadable, aWritable);
+		} catch (const Exception& e) {
+			fail(e.getError());
+
+			// Handle the remaining tasks
+			aReadable = aWritable = false;
+		}
+	}
+}
+
 void BufferedSocket::write(const char* aBuf, size_t aLen) noexcept {
 	if(!sock.get())
 		return;
@@ -498,6 +837,15 @@ int BufferedSocket::run() {
 				break;
 			}
 			if(state == RUNNING) {
+				if(!disconnecting) {
+					// Read possible data buffered by SSL when the reactor starts
+					readPending = true;
+					if(SocketReactor::getInstance()->add(this)) {
+						// The reactor will handle the socket from now on
+						return 0;
+					}
+				}
+
 				checkSocket();
 			}
 		} catch(const Exception& e) {
@@ -516,6 +864,11 @@ void BufferedSocket::fail(const string& aError) {
 	}
 	//fire listener before deleting socket to be able to retrieve information from it.. does it cause any problems?? 
 	if (sock.get()) {
+		if (reactorId != -1) {
+			SocketReactor::getInstance()->unregister(this);
+			clearSendData();
+		}
+
 		sock->disconnect();
 	}
 }
@@ -528,7 +881,12 @@ void BufferedSocket::shutdown(function<void ()> f) {
 
 void BufferedSocket::addTask(Tasks task, TaskData* data) {
 	dcassert(task == DISCONNECT || task == SHUTDOWN || sock.get());
-	tasks.emplace_back(task, unique_ptr<TaskData>(data)); taskSem.signal();
+	tasks.emplace_back(task, unique_ptr<TaskData>(data));
+	if (reactorId != -1) {
+		SocketReactor::getInstance()->schedule(this);
+	} else {
+		taskSem.signal();
+	}
 }
 
 } // namespace dcpp
@@ -29,6 +29,7 @@
 #include "Thread.h"
 #include "Speaker.h"
 #include "Socket.h"
+#include "TokenBucket.h"
 
 namespace dcpp {
 
@@ -109,6 +110,9 @@ public:
 	uint16_t getLocalPort() const { return sock->getLocalPort(); }
 	bool isV6Valid() const { return sock->isV6Valid(); }
 
+	/** Sets the user/bundle specific speed limits for the current transfer. Must be called from the socket's thread. */
+	void setLimits(TransferLimitList&& aLimits) noexcept { limits = move(aLimits); }
+
 	GETSET(char, separator, Separator);
 	GETSET(bool, useLimiter, UseLimiter);
 private:
@@ -162,9 +166,11 @@ private:
 	int64_t dataBytes;
 	size_t rollback;
 	string line;
+	string lineBuf; // reused for passing the lines to the listeners
 	ByteVector inbuf;
 	ByteVector writeBuf;
 	ByteVector sendBuf;
+	TransferLimitList limits;
 
 	std::unique_ptr<Socket> sock;
 	State state;
@@ -173,10 +179,58 @@ private:
 
 	virtual int run();
 
+	// Reactor mode (the socket is run by SocketReactor after it has been connected)
+	friend class SocketReactor;
+
+	enum ReactorFlags {
+		REACTOR_READ = 0x01,		// Wait until the socket is readable
+		REACTOR_WRITE = 0x02,		// Wait until the socket is writable
+		REACTOR_PENDING = 0x04,		// Run again without waiting
+		REACTOR_THROTTLED = 0x08,	// Out of bandwidth, retry after a while
+		REACTOR_DELETED = 0x10		// The socket has been deleted
+	};
+
+	int reactorId = -1;
+
+	size_t sendPos = 0;
+	InputStream* transmitStream = nullptr;
+	File* directFile = nullptr;
+	int64_t directBytes = -1;
+	ByteVector fileBuf;
+	size_t filePos = 0;
+	size_t fileLen = 0;
+	bool fileReadDone = false;
+	size_t sockSize = 0;
+
+	/** Size of the previous failed write that must be retried (OpenSSL) */
+	size_t lastWriteSize = 0;
+
+	bool readPending = false;
+	bool readThrottled = false;
+	bool writeBlocked = false;
+	bool writeThrottled = false;
+
+	/** Time when the remaining data is discarded if the socket is still blocked when disconnecting gracefully */
+	uint64_t disconnectSendDeadline = 0;
+
+	/** Runs the socket when it has events or tasks, returns the ReactorFlags */
+	int reactorRun(bool aReadable, bool aWritable) noexcept;
+	int reactorProcess(bool aReadable, bool aWritable);
+	void reactorSend();
+	bool hasSendData() const noexcept { return sendPos < sendBuf.size() || transmitStream; }
+	void clearSendData() noexcept;
+	bool hasDisconnectTask() noexcept;
+	bool canSendDirect() const noexcept;
+
 	void threadConnect(const Socket::AddressInfo& aAddr, const string& aPort, const string& localPort, NatRoles natRole, bool proxy);
 	void threadAccept();
-	void threadRead();
+	bool threadRead();
 	void threadSendFile(InputStream* is);
+	/** Returns false if the rest of the file must be sent through the limiter */
+	bool threadSendDirect(InputStream* aStream, File& aFile, int64_t aMaxBytes);
+
+	/** Sends the next part of an unfiltered file without copying, returns the number of bytes sent (0 = done, -1 = would block) */
+	int sendDirect(InputStream* aStream, File& aFile, int64_t& maxBytes_);
 	void threadSendData();
 
 	void fail(const string& aError);
@@ -27,8 +27,10 @@
 #include "HashManager.h"
 #include "LogManager.h"
 #include "QueueItem.h"
+#include "QueueManager.h"
 #include "SearchResult.h"
 #include "SimpleXML.h"
+#include "ThrottleManager.h"
 #include "TimerManager.h"
 #include "UserConnection.h"
 
@@ -136,7 +138,6 @@ void Bundle::addFinishedSegment(int64_t aSize) noexcept {
 	dcassert(currentDownloaded >= 0);
 	dcassert(currentDownloaded <= size);
 	dcassert(finishedSegments <= size);
-	setDirty();
 }
 
 void Bundle::removeFinishedSegment(int64_t aSize) noexcept{
@@ -165,8 +166,10 @@ string Bundle::getName() const noexcept  {
 }
 
 void Bundle::setDirty() noexcept {
-	if (status != STATUS_NEW)
+	if (status != STATUS_NEW) {
 		dirty = true;
+		QueueManager::getInstance()->onBundleDirty(this);
+	}
 }
 
 bool Bundle::getDirty() const noexcept {
@@ -922,13 +925,21 @@ void Bundle::sendSizeNameUpdate() noexcept {
 /* ONLY CALLED FROM DOWNLOADMANAGER END */
 
 
-void Bundle::save() throw(FileException) {
-	File ff(getXmlFilePath() + ".tmp", File::WRITE, File::CREATE | File::TRUNCATE);
-	BufferedOutputStream<false> f(&ff);
+string Bundle::serialize() noexcept {
+	string xml;
+	StringOutputStream f(xml);
 	f.write(SimpleXML::utf8Header);
 	string tmp;
 	string b32tmp;
 
+	auto downloadLimit = ThrottleManager::getInstance()->getBundleLimit(getToken());
+	auto saveLimit = [&] {
+		if (downloadLimit > 0) {
+			f.write(LIT("\" DownloadLimit=\""));
+			f.write(Util::toString(downloadLimit));
+		}
+	};
+
 	auto saveFiles = [&] {
 		for (const auto& q : finishedFiles) {
 			q->save(f, tmp, b32tmp);
@@ -947,6 +958,7 @@ void Bundle::save() throw(FileException) {
 		f.write(Util::toString(bundleDate));
 		f.write(LIT("\" AddedByAutoSearch=\""));
 		f.write(Util::toString(getAddedByAutoSearch()));
+		saveLimit();
 		f.write(LIT("\">\r\n"));
 		saveFiles();
 		f.write(LIT("</File>\r\n"));
@@ -970,6 +982,7 @@ void Bundle::save() throw(FileException) {
 			f.write(LIT("\" TimeFinished=\""));
 			f.write(Util::toString(timeFinished));
 		}
+		saveLimit();
 		f.write(LIT("\">\r\n"));
 
 		saveFiles();
@@ -977,13 +990,19 @@ void Bundle::save() throw(FileException) {
 		f.write(LIT("</Bundle>\r\n"));
 	}
 
+	dirty = false;
+	return xml;
+}
+
+void Bundle::writeTempXml(const string& aXml) const throw(FileException) {
+	File f(getXmlFilePath() + ".tmp", File::WRITE, File::CREATE | File::TRUNCATE);
+	f.write(aXml);
 	f.flush();
-	ff.close();
+}
 
+void Bundle::replaceXml() const throw(FileException) {
 	File::deleteFile(getXmlFilePath());
 	File::renameFile(getXmlFilePath() + ".tmp", getXmlFilePath());
-	
-	dirty = false;
 }
 
 }
@@ -200,7 +200,14 @@ public:
 
 	/* QueueManager */
 	bool isFailed() const noexcept;
-	void save() throw(FileException);
+	/** Returns the content of the bundle file, the bundle is no longer dirty after this */
+	string serialize() noexcept;
+
+	/** Writes the serialized bundle in a temporary file and syncs it to the disk */
+	void writeTempXml(const string& aXml) const throw(FileException);
+
+	/** Replaces the bundle file with the temporary file */
+	void replaceXml() const throw(FileException);
 	bool removeQueue(QueueItemPtr& qi, bool finished) noexcept;
 	bool addQueue(QueueItemPtr& qi) noexcept;
 
@@ -25,6 +25,7 @@
 #include "LogManager.h"
 #include "QueueItem.h"
 #include "SettingsManager.h"
+#include "SharedFileStream.h"
 #include "TimerManager.h"
 
 namespace dcpp {
@@ -54,6 +55,11 @@ void BundleQueue::addBundle(BundlePtr& aBundle) noexcept {
 	}
 
 	aBundle->setStatus(Bundle::STATUS_QUEUED);
+	if (aBundle->getDirty()) {
+		// Modified while it was being added
+		addDirty(aBundle);
+	}
+
 	aBundle->setDownloadedBytes(0); //sets to downloaded segments
 	aBundle->updateSearchMode();
 
@@ -156,10 +162,23 @@ void BundleQueue::addBundleItem(QueueItemPtr& qi, BundlePtr& aBundle) noexcept {
 	if (aBundle->addQueue(qi) && !aBundle->isFileBundle()) {
 		addDirectory(qi->getFilePath(), aBundle);
 	}
+
+	// New bundles are saved as a whole
+	if (aBundle->getStatus() != Bundle::STATUS_NEW) {
+		journal.itemAdded(qi);
+	}
 }
 
 void BundleQueue::removeBundleItem(QueueItemPtr& qi, bool finished) noexcept {
 	dcassert(qi->getBundle());
+	if (finished) {
+		// Finished files are listed separately in the bundle file
+		qi->getBundle()->setDirty();
+		journal.itemAdded(qi);
+	} else {
+		journal.itemRemoved(qi);
+	}
+
 	auto isFileBundle = qi->getBundle()->isFileBundle();
 	if (qi->getBundle()->removeQueue(qi, finished) && !finished && !isFileBundle) {
 		removeDirectory(qi->getFilePath());
@@ -236,15 +255,90 @@ void BundleQueue::getDiskInfo(TargetUtil::TargetInfoMap& dirMap, const TargetUti
 	}
 }
 
-void BundleQueue::saveQueue(bool force) noexcept {
-	for(auto& b: bundles | map_values) {
-		if (b->getDirty() || force) {
-			try {
-				b->save();
-			} catch(FileException& e) {
-				LogManager::getInstance()->message(STRING_F(SAVE_FAILED_X, b->getName() % e.getError()), LogMessage::SEV_ERROR);
+void BundleQueue::addDirty(const BundlePtr& aBundle) noexcept {
+	FastLock l(dirtyCs);
+	dirtyBundles.emplace(aBundle->getToken(), aBundle);
+}
+
+BundleQueue::SaveBatch BundleQueue::prepareSave(bool force) noexcept {
+	SaveBatch ret;
+	ret.compact = force || journal.getSize() >= QueueJournal::COMPACT_SIZE;
+	ret.journal = journal.takePending(ret.compact);
+	ret.files.swap(ret.journal.files);
+
+	Bundle::TokenBundleMap toSave;
+	{
+		FastLock l(dirtyCs);
+		toSave.swap(dirtyBundles);
+	}
+
+	if (force) {
+		toSave = bundles;
+	} else {
+		// Bundles with journaled changes
+		for (auto token: ret.journal.bundles) {
+			auto b = findBundle(token);
+			if (b) {
+				toSave.emplace(token, b);
+			}
+		}
+	}
+
+	for (auto& b: toSave | map_values) {
+		// Removed bundles aren't saved
+		// The dirty flag isn't checked as the bundle may have been modified again during the previous save
+		if (bundles.find(b->getToken()) == bundles.end() || b->getStatus() == Bundle::STATUS_NEW) {
+			continue;
+		}
+
+		for (const auto& qi: b->getQueueItems()) {
+			if (!qi->getDone().empty()) {
+				ret.files.insert(qi->getTempTarget());
 			}
 		}
+
+		ret.bundles.emplace_back(b, b->serialize());
+	}
+
+	return ret;
+}
+
+void BundleQueue::writeSave(SaveBatch& aBatch) noexcept {
+	// The downloaded segments may be saved only after their data is on the disk
+	for (const auto& f: aBatch.files) {
+		SharedFileStream::syncFile(f);
+	}
+
+	journal.write(aBatch.journal);
+
+	for (auto i = aBatch.bundles.begin(); i != aBatch.bundles.end();) {
+		try {
+			i->first->writeTempXml(i->second);
+			i++;
+		} catch (const FileException& e) {
+			LogManager::getInstance()->message(STRING_F(SAVE_FAILED_X, i->first->getName() % e.getError()), LogMessage::SEV_ERROR);
+			addDirty(i->first);
+			aBatch.saved = false;
+			i = aBatch.bundles.erase(i);
+		}
+	}
+}
+
+void BundleQueue::finishSave(SaveBatch& aBatch) noexcept {
+	for (const auto& b: aBatch.bundles | map_keys) {
+		if (bundles.find(b->getToken()) == bundles.end()) {
+			// Removed while it was being saved
+			File::deleteFile(b->getXmlFilePath() + ".tmp");
+			continue;
+		}
+
+		try {
+			b->replaceXml();
+		} catch (const FileException& e) {
+			LogManager::getInstance()->message(STRING_F(SAVE_FAILED_X, b->getName() % e.getError()), LogMessage::SEV_ERROR);
+			addDirty(b);
+			aBatch.saved = false;
+		}
 	}
 }
 
@@ -24,6 +24,7 @@
 #include "HintedUser.h"
 #include "Bundle.h"
 #include "PrioritySearchQueue.h"
+#include "QueueJournal.h"
 #include "TargetUtil.h"
 
 namespace dcpp {
@@ -59,7 +60,34 @@ public:
 
 	void getDiskInfo(TargetUtil::TargetInfoMap& dirMap, const TargetUtil::VolumeSet& volumes) const noexcept;
 
-	void saveQueue(bool force) noexcept;
+	// Bundles and journal records taken for saving
+	struct SaveBatch {
+		QueueJournal::Snapshot journal;
+		bool compact = false;
+
+		vector<pair<BundlePtr, string>> bundles;
+
+		// Downloaded files having segments in the bundles or journal records
+		StringSet files;
+		bool saved = true;
+	};
+
+	/*
+	Saving the queue is split so that the disk is accessed without holding the queue lock
+	The batches must be handled one at a time (in order) and the journal must be compacted after finishing the batch
+	*/
+
+	// Takes the dirty bundles and the journal records (force will save and compact everything), the queue lock must be held
+	SaveBatch prepareSave(bool force) noexcept;
+
+	// Syncs the downloaded files and writes the journal records and the bundles in temporary files
+	void writeSave(SaveBatch& aBatch) noexcept;
+
+	// Replaces the files of the bundles that are still in queue, the queue lock must be held
+	void finishSave(SaveBatch& aBatch) noexcept;
+
+	// Marks the bundle to be saved on the next save
+	void addDirty(const BundlePtr& aBundle) noexcept;
 
 
 	void addDirectory(const string& aPath, BundlePtr& aBundle) noexcept;
@@ -71,11 +99,20 @@ public:
 
 	Bundle::TokenBundleMap& getBundles() { return bundles; }
 	const Bundle::TokenBundleMap& getBundles() const { return bundles; }
+
+	QueueJournal& getJournal() noexcept { return journal; }
 private:
 	/** Bundles by release directory */	
 	Bundle::BundleDirMap bundleDirs;
 	/** Bundles by token */
 	Bundle::TokenBundleMap bundles;
+
+	/** Bundles that have been modified after they were saved (they may be modified without holding the queue lock) */
+	FastCriticalSection dirtyCs;
+	Bundle::TokenBundleMap dirtyBundles;
+
+	/** Item changes that haven't been saved in the bundle files */
+	QueueJournal journal;
 };
 
 } // namespace dcpp
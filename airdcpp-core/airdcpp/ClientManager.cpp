@@ -37,9 +37,6 @@
 #include "AdcHub.h"
 #include "NmdcHub.h"
 
-#include <openssl/aes.h>
-#include <openssl/rand.h>
-
 #include <boost/range/algorithm/copy.hpp>
 
 namespace dcpp {
@@ -851,35 +848,7 @@ bool ClientManager::sendUDP(AdcCommand& cmd, const CID& cid, bool noCID /*false*
 			try {
 				COMMAND_DEBUG(cmd.toString(), DebugManager::TYPE_CLIENT_UDP, DebugManager::OUTGOING, u->getIdentity().getIp());
 				auto cmdStr = noCID ? cmd.toString() : cmd.toString(getMe()->getCID());
-				if (!aKey.empty() && Encoder::isBase32(aKey.c_str())) {
-					uint8_t keyChar[16];
-					Encoder::fromBase32(aKey.c_str(), keyChar, 16);
-
-					uint8_t ivd[16] = { };
-
-					// prepend 16 random bytes to message
-					RAND_bytes(ivd, 16);
-					cmdStr.insert(0, (char*)ivd, 16);
-					
-					// use PKCS#5 padding to align the message length to the cypher block size (16)
-					uint8_t pad = 16 - (cmdStr.length() & 15);
-					cmdStr.append(pad, (char)pad);
-
-					// encrypt it
-					uint8_t* out = new uint8_t[cmdStr.length()];
-					memset(ivd, 0, 16);
-					int aLen = cmdStr.length();
-
-					AES_KEY key;
-					AES_set_encrypt_key(keyChar, 128, &key);
-					AES_cbc_encrypt((unsigned char*)cmdStr.c_str(), out, cmdStr.length(), &key, ivd, AES_ENCRYPT);
-
-					dcassert((aLen & 15) == 0);
-
-					cmdStr.clear();
-					cmdStr.insert(0, (char*)out, aLen);
-					delete[] out;
-				}
+				SUDPKeys::encrypt(cmdStr, aKey);
 				udp.writeTo(u->getIdentity().getIp(), u->getIdentity().getUdpPort(), cmdStr);
 			} catch(const SocketException&) {
 				dcdebug("Socket exception sending ADC UDP command\n");
@@ -938,6 +907,27 @@ void ClientManager::on(NmdcSearch, Client* aClient, const string& aSeeker, int a
 {
 	fire(ClientManagerListener::IncomingSearch(), aString);
 
+	ClientPtr client;
+	{
+		RLock l(cs);
+		auto i = clients.find(const_cast<string*>(&aClient->getHubUrl()));
+		if (i == clients.end()) {
+			return;
+		}
+
+		client = i->second;
+	}
+
+	// Searches from the same seeker are handled in order
+	auto key = hash<string>()(aClient->getHubUrl() + aSeeker);
+	SearchManager::getInstance()->queueIncoming(key, [=] {
+		if (client->isConnected()) {
+			respondNmdc(client, aSeeker, aSearchType, aSize, aFileType, aString, isPassive);
+		}
+	});
+}
+
+void ClientManager::respondNmdc(const ClientPtr& aClient, const string& aSeeker, int aSearchType, int64_t aSize, int aFileType, const string& aString, bool isPassive) noexcept {
 	bool hideShare = aClient->getShareProfile() == SP_HIDDEN;
 
 	SearchResultList l;
@@ -290,6 +290,8 @@ private:
 	void on(HubUserCommand, const Client*, int, int, const string&, const string&) noexcept;
 	void on(NmdcSearch, Client* aClient, const string& aSeeker, int aSearchType, int64_t aSize,
 		int aFileType, const string& aString, bool) noexcept;
+
+	void respondNmdc(const ClientPtr& aClient, const string& aSeeker, int aSearchType, int64_t aSize, int aFileType, const string& aString, bool isPassive) noexcept;
 	// TimerManagerListener
 	void on(TimerManagerListener::Minute, uint64_t aTick) noexcept;
 };
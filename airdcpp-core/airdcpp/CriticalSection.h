@@ -56,6 +56,7 @@ public:
 	}
 	void lock() noexcept{ pthread_mutex_lock(&mtx); }
 	void unlock() noexcept{ pthread_mutex_unlock(&mtx); }
+	bool try_lock() noexcept{ return pthread_mutex_trylock(&mtx) == 0; }
 	pthread_mutex_t& getMutex() { return mtx; }
 
 	CriticalSection(const CriticalSection&) = delete;
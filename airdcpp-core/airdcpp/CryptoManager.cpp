@@ -23,6 +23,7 @@
 
 #include "File.h"
 #include "LogManager.h"
+#include "TimerManager.h"
 #include "ClientManager.h"
 #include "version.h"
 
@@ -131,6 +132,11 @@ CryptoManager::CryptoManager()
 		SSL_CTX_set_tmp_rsa_callback(serverContext, CryptoManager::tmp_rsa_cb);
 		SSL_CTX_set_verify(clientContext, SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT, verify_callback);
 		SSL_CTX_set_verify(serverContext, SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT, verify_callback);
+
+		// Client sessions are stored by us (keyed by the keyprint), the server side issues session tickets
+		const unsigned char sessionContext[] = "AirDC++";
+		SSL_CTX_set_session_cache_mode(clientContext, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+		SSL_CTX_set_session_id_context(serverContext, sessionContext, sizeof(sessionContext) - 1);
 	}
 }
 
@@ -141,6 +147,10 @@ CryptoManager::~CryptoManager() {
 	/* thread-local cleanup */
 	ERR_remove_thread_state(NULL);
 
+	for (auto& s: sessions) {
+		SSL_SESSION_free(s.second.session);
+	}
+
 	clientContext.reset();
 	serverContext.reset();
 
@@ -495,6 +505,75 @@ SSL_CTX* CryptoManager::getSSLContext(SSLContext wanted) {
 	}
 }
 
+void CryptoManager::resumeSession(SSL* aSSL, const string& aKeyprint) noexcept {
+	Lock l(sessionCs);
+	auto i = sessions.find(aKeyprint);
+	if (i != sessions.end()) {
+		// Takes a reference
+		SSL_set_session(aSSL, i->second.session);
+		i->second.lastUsed = GET_TICK();
+	}
+}
+
+void CryptoManager::saveSession(SSL* aSSL, const string& aKeyprint) noexcept {
+	if (SSL_session_reused(aSSL)) {
+		return;
+	}
+
+	auto session = SSL_get1_session(aSSL);
+	if (!session) {
+		return;
+	}
+
+	Lock l(sessionCs);
+	auto i = sessions.find(aKeyprint);
+	if (i != sessions.end()) {
+		SSL_SESSION_free(i->second.session);
+		i->second = { session, GET_TICK() };
+		return;
+	}
+
+	if (sessions.size() >= MAX_SESSIONS) {
+		auto oldest = min_element(sessions.begin(), sessions.end(), [](const pair<const string, CachedSession>& a, const pair<const string, CachedSession>& b) {
+			return a.second.lastUsed < b.second.lastUsed; 
+		});
+
+		SSL_SESSION_free(oldest->second.session);
+		sessions.erase(oldest);
+	}
+
+	sessions.emplace(aKeyprint, CachedSession { session, GET_TICK() });
+}
+
+void CryptoManager::removeSession(const string& aKeyprint) noexcept {
+	Lock l(sessionCs);
+	auto i = sessions.find(aKeyprint);
+	if (i != sessions.end()) {
+		SSL_SESSION_free(i->second.session);
+		sessions.erase(i);
+	}
+}
+
+void CryptoManager::onHandshake(bool aResumed, uint64_t aDuration) noexcept {
+	Lock l(sessionCs);
+	handshakeStats.handshakes++;
+	handshakeStats.totalTime += aDuration;
+	if (aResumed) {
+		handshakeStats.resumed++;
+		handshakeStats.resumedTime += aDuration;
+	}
+}
+
+void CryptoManager::onHandshakeFailed() noexcept {
+	Lock l(sessionCs);
+	handshakeStats.failed++;
+}
+
+CryptoManager::HandshakeStats CryptoManager::getHandshakeStats() const noexcept {
+	Lock l(sessionCs);
+	return handshakeStats;
+}
+
 void CryptoManager::locking_function(int mode, int n, const char* /*file*/, int /*line*/) {
 	if(mode & CRYPTO_LOCK) {
 		cs[n].lock();
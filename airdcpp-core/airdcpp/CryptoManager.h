@@ -69,6 +69,22 @@ public:
 	static void setCertPaths();
 
 	static int idxVerifyData;
+
+	// Client sessions are cached by the keyprint of the peer so that reconnects to the same user can be resumed
+	void resumeSession(SSL* aSSL, const string& aKeyprint) noexcept;
+	void saveSession(SSL* aSSL, const string& aKeyprint) noexcept;
+	void removeSession(const string& aKeyprint) noexcept;
+
+	struct HandshakeStats {
+		uint64_t handshakes = 0, resumed = 0, failed = 0;
+
+		// Milliseconds
+		uint64_t totalTime = 0, resumedTime = 0;
+	};
+
+	void onHandshake(bool aResumed, uint64_t aDuration) noexcept;
+	void onHandshakeFailed() noexcept;
+	HandshakeStats getHandshakeStats() const noexcept;
 private:
 
 	friend class Singleton<CryptoManager>;
@@ -94,6 +110,18 @@ private:
 	static char idxVerifyDataName[];
 	static SSLVerifyData trustedKeyprint;
 
+	// Maximum number of cached client sessions
+	static const size_t MAX_SESSIONS = 500;
+
+	struct CachedSession {
+		SSL_SESSION* session;
+		uint64_t lastUsed;
+	};
+
+	mutable CriticalSection sessionCs;
+	unordered_map<string, CachedSession> sessions;
+	HandshakeStats handshakeStats;
+
 	ByteVector keyprint;
 	const string lock;
 	const string pk;
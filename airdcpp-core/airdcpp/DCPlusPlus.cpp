@@ -40,6 +40,7 @@
 #include "DirectoryListingManager.h"
 #include "UpdateManager.h"
 #include "ThrottleManager.h"
+#include "SocketReactor.h"
 #include "MessageManager.h"
 #include "HighlightManager.h"
 
@@ -91,6 +92,7 @@ void startup(function<void(const string&)> stepF, function<bool(const string& /*
 	DownloadManager::newInstance();
 	UploadManager::newInstance();
 	ThrottleManager::newInstance();
+	SocketReactor::newInstance();
 	QueueManager::newInstance();
 	FavoriteManager::newInstance();
 	FinishedManager::newInstance();
@@ -109,6 +111,7 @@ void startup(function<void(const string&)> stepF, function<bool(const string& /*
 	SettingsManager::getInstance()->load(messageF);
 
 	UploadManager::getInstance()->setFreeSlotMatcher();
+	ThrottleManager::getInstance()->loadUserLimits();
 	Localization::init();
 	if(SETTING(WIZARD_RUN) && runWizard) {
 		runWizard();
@@ -164,6 +167,7 @@ void shutdown(function<void (const string&)> stepF, function<void (float)> progr
 	};
 
 	ShareManager::getInstance()->abortRefresh();
+	SearchManager::getInstance()->shutdown();
 
 	announce(STRING(SAVING_HASH_DATA));
 	HashManager::getInstance()->shutdown(progressF);
@@ -197,6 +201,7 @@ void shutdown(function<void (const string&)> stepF, function<void (float)> progr
 	ADLSearchManager::deleteInstance();
 	FinishedManager::deleteInstance();
 	CryptoManager::deleteInstance();
+	SocketReactor::deleteInstance();
 	ThrottleManager::deleteInstance();
 	DirectoryListingManager::deleteInstance();
 	QueueManager::deleteInstance();
@@ -236,7 +236,8 @@ void Download::open(int64_t bytes, bool z, bool hasDownloadedBytes) {
 		output.reset(new MerkleTreeOutputStream<TigerTree>(tt));
 	}
 
-	if((getType() == Transfer::TYPE_FILE || getType() == Transfer::TYPE_FULL_LIST) && SETTING(BUFFER_SIZE) > 0 ) {
+	// SharedFileStream buffers the writes of files itself
+	if(getType() == Transfer::TYPE_FULL_LIST && SETTING(BUFFER_SIZE) > 0 ) {
 		output.reset(new BufferedOutputStream<true>(output.release()));
 	}
 
@@ -261,4 +262,42 @@ void Download::close()
 	output.reset();
 }
 
+void Download::verifySegment(const string& aPath, const Segment& aSegment, const TigerTree& aTree) {
+	const size_t BUF_SIZE = 1024 * 1024;
+
+	auto blockSize = aTree.getBlockSize();
+	auto start = aSegment.getStart();
+	auto end = min(aSegment.getEnd(), aTree.getFileSize());
+	dcassert(start % blockSize == 0);
+
+	File f(aPath, File::READ, File::OPEN | File::SHARED_WRITE, File::BUFFER_SEQUENTIAL);
+	f.setPos(start);
+
+	ByteVector buf(static_cast<size_t>(min(blockSize, static_cast<int64_t>(BUF_SIZE))));
+	for (auto blockStart = start; blockStart < end; blockStart += blockSize) {
+		auto leaf = static_cast<size_t>(blockStart / blockSize);
+		if (leaf >= aTree.getLeaves().size()) {
+			throw FileException(STRING(TTH_INCONSISTENCY));
+		}
+
+		TigerTree block(blockSize);
+		auto left = min(blockSize, end - blockStart);
+		while (left > 0) {
+			auto len = static_cast<size_t>(min(left, static_cast<int64_t>(buf.size())));
+			auto requested = len;
+			if (f.read(&buf[0], len) != requested) {
+				throw FileException(STRING(TTH_INCONSISTENCY));
+			}
+
+			block.update(&buf[0], len);
+			left -= len;
+		}
+
+		block.finalize();
+		if (!(block.getRoot() == aTree.getLeaves()[leaf])) {
+			throw FileException(STRING(TTH_INCONSISTENCY));
+		}
+	}
+}
+
 } // namespace dcpp
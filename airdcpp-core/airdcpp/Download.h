@@ -79,6 +79,9 @@ public:
 	/** Release the target output */
 	void close();
 
+	/** Read a written segment from the disk and compare it against the tree leaves, throws FileException on mismatch */
+	static void verifySegment(const string& aPath, const Segment& aSegment, const TigerTree& aTree);
+
 	/** @internal */
 	TigerTree& getTigerTree() { return tt; }
 	const string& getPFS() const { return pfs; }
@@ -22,6 +22,7 @@
 
 #include "ResourceManager.h"
 #include "QueueManager.h"
+#include "ThrottleManager.h"
 #include "HashManager.h"
 #include "Download.h"
 #include "LogManager.h"
@@ -44,7 +45,7 @@ namespace dcpp {
 
 static const string DOWNLOAD_AREA = "Downloads";
 
-DownloadManager::DownloadManager() {
+DownloadManager::DownloadManager() : verifier(true, Thread::LOW) {
 	TimerManager::getInstance()->addListener(this);
 }
 
@@ -425,6 +426,7 @@ void DownloadManager::startData(UserConnection* aSource, int64_t start, int64_t
 			failDownload(aSource, e.getError(), true);
 		}
 	} else {
+		aSource->setLimits(ThrottleManager::getInstance()->getLimits(aSource->getUser(), d->getBundle() ? d->getBundle()->getToken() : 0));
 		aSource->setDataMode();
 	}
 }
@@ -488,8 +490,61 @@ void DownloadManager::endData(UserConnection* aSource) {
 		aSource->updateChunkSize(d->getTigerTree().getBlockSize(), d->getSegmentSize(), GET_TICK() - d->getStart());
 		
 		dcdebug("Download finished: %s, size " I64_FMT ", downloaded " I64_FMT "\n", d->getPath().c_str(), d->getSegmentSize(), d->getPos());
+
+		if (SETTING(VERIFY_SEGMENTS) && d->getType() == Transfer::TYPE_FILE && d->isSet(Download::FLAG_TTH_CHECK)) {
+			// The data has been checked on the way, make sure that it also ended up on the disk intact
+			verifySegment(aSource, d);
+			return;
+		}
+	}
+
+	completeDownload(aSource, d);
+}
+
+void DownloadManager::verifySegment(UserConnection* aSource, Download* d) noexcept {
+	// The download may be removed while the segment is being read
+	auto path = d->getTempTarget();
+	auto segment = d->getSegment();
+	auto tree = d->getTigerTree();
+
+	verifier.addTask([=] {
+		string error;
+		try {
+			Download::verifySegment(path, segment, tree);
+		} catch (const Exception& e) {
+			error = e.getError();
+		}
+
+		RLock l(cs);
+		if (isRunning(d) && &d->getUserConnection() == aSource) {
+			aSource->callAsync([=] { onSegmentVerified(aSource, d, error); });
+		}
+	});
+}
+
+void DownloadManager::onSegmentVerified(UserConnection* aSource, Download* d, const string& aError) noexcept {
+	{
+		// The connection has been deleted if it failed after the check
+		RLock l(cs);
+		if (!isRunning(d)) {
+			return;
+		}
 	}
 
+	if (!aError.empty()) {
+		d->resetPos();
+		failDownload(aSource, aError, true);
+		return;
+	}
+
+	completeDownload(aSource, d);
+}
+
+bool DownloadManager::isRunning(const Download* aDownload) const noexcept {
+	return find(downloads.begin(), downloads.end(), aDownload) != downloads.end();
+}
+
+void DownloadManager::completeDownload(UserConnection* aSource, Download* d) {
 	removeDownload(d);
 
 	fire(DownloadManagerListener::Complete(), d, d->getType() == Transfer::TYPE_TREE);
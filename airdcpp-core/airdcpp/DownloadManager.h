@@ -29,6 +29,7 @@
 
 #include "Bundle.h"
 #include "CriticalSection.h"
+#include "DispatcherQueue.h"
 #include "MerkleTree.h"
 
 namespace dcpp {
@@ -110,6 +111,12 @@ private:
 
 	void revive(UserConnection* uc);
 	void endData(UserConnection* aSource);
+	void completeDownload(UserConnection* aSource, Download* aDownload);
+
+	// Reads the finished segment back from the disk in the verifier thread, the download is completed after that
+	void verifySegment(UserConnection* aSource, Download* aDownload) noexcept;
+	void onSegmentVerified(UserConnection* aSource, Download* aDownload, const string& aError) noexcept;
+	bool isRunning(const Download* aDownload) const noexcept;
 
 	void onFailed(UserConnection* aSource, const string& aError);
 
@@ -132,6 +139,9 @@ private:
 	uint64_t lastUpdate = 0;
 	int64_t lastUpBytes = 0;
 	int64_t lastDownBytes = 0;
+
+	// Destructed first so that the pending checks won't access the downloads afterwards
+	DispatcherQueue verifier;
 };
 
 } // namespace dcpp
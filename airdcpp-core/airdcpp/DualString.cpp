@@ -48,20 +48,36 @@ DualString::DualString(const string& aStr) {
 	int arrayPos = 0, bitPos = 0;
 	const char* end = &aStr[0] + aStr.size();
 	for (const char* p = &aStr[0]; p < end;) {
-		wchar_t c = 0;
-		int n = dcpp::Text::utf8ToWc(p, c);
-		if (n < 0) {
-			append("_");
-		} else {
-			auto lc = toLower(c);
-			if (lc != c) {
-				if (!charSizes) {
-					initSizeArray(aStr.size());
+		int n = static_cast<int>(dcpp::Text::asciiLength(p, std::min(end - p, static_cast<ptrdiff_t>(ARRAY_BITS - bitPos))));
+		if (n > 0) {
+			// ASCII characters up to the end of the current mask
+			auto pos = size();
+			resize(pos + n);
+			dcpp::Text::asciiToLower(p, n, &(*this)[pos]);
+			for (int i = 0; i < n; ++i) {
+				if ((*this)[pos + i] != p[i]) {
+					if (!charSizes) {
+						initSizeArray(aStr.size());
+					}
+					charSizes[arrayPos] |= (1 << (bitPos + i));
 				}
-				charSizes[arrayPos] |= (1 << bitPos);
 			}
+		} else {
+			wchar_t c = 0;
+			n = dcpp::Text::utf8ToWc(p, c);
+			if (n < 0) {
+				append("_");
+			} else {
+				auto lc = toLower(c);
+				if (lc != c) {
+					if (!charSizes) {
+						initSizeArray(aStr.size());
+					}
+					charSizes[arrayPos] |= (1 << bitPos);
+				}
 
-			dcpp::Text::wcToUtf8(lc, *this);
+				dcpp::Text::wcToUtf8(lc, *this);
+			}
 		}
 
 		p += n;
@@ -87,14 +103,19 @@ size_t DualString::initSizeArray(size_t strLen) {
 }
 
 DualString& DualString::operator=(DualString&& rhs) {
-	assign(rhs.begin(), rhs.end());
+	if (this == &rhs)
+		return *this;
+
+	if (charSizes)
+		delete[] charSizes;
+
+	string::operator=(std::move(rhs));
 	charSizes = rhs.charSizes;
 	rhs.charSizes = nullptr;
 	return *this; 
 }
 
-DualString::DualString(DualString&& rhs) : charSizes(rhs.charSizes) {
-	assign(rhs.begin(), rhs.end());
+DualString::DualString(DualString&& rhs) : string(std::move(rhs)), charSizes(rhs.charSizes) {
 	rhs.charSizes = nullptr;
 }
 
@@ -110,8 +131,11 @@ DualString::DualString(const DualString& rhs) {
 }
 
 DualString& DualString::operator= (const DualString& rhs) {
+	if (this == &rhs)
+		return *this;
+
 	if (charSizes) {
-		delete charSizes;
+		delete[] charSizes;
 		charSizes = nullptr;
 	}
 
@@ -127,7 +151,7 @@ DualString& DualString::operator= (const DualString& rhs) {
 
 DualString::~DualString() { 
 	if (charSizes)
-		delete charSizes; 
+		delete[] charSizes;
 }
 
 string DualString::getNormal() const {
@@ -127,10 +127,14 @@ int64_t File::getPos() const noexcept {
 }
 
 void File::setSize(int64_t newSize) {
-	int64_t pos = getPos();
-	setPos(newSize);
-	setEOF();
-	setPos(pos);
+	dcassert(isOpen());
+
+	// Doesn't use the file pointer, which is also moved by the positional writes running in parallel
+	FILE_END_OF_FILE_INFO info;
+	info.EndOfFile.QuadPart = newSize;
+	if(!::SetFileInformationByHandle(h, FileEndOfFileInfo, &info, sizeof(info))) {
+		throw FileException(Util::translateError(GetLastError()));
+	}
 }
 void File::setPos(int64_t pos) noexcept {
 	LONG x = (LONG) (pos>>32);
@@ -163,6 +167,37 @@ size_t File::write(const void* buf, size_t len) {
 	dcassert(x == len);
 	return x;
 }
+size_t File::readAt(void* buf, size_t len, int64_t pos) {
+	dcassert(isOpen());
+	OVERLAPPED ov = { 0 };
+	ov.Offset = (DWORD)(pos & 0xffffffff);
+	ov.OffsetHigh = (DWORD)(pos >> 32);
+
+	DWORD x;
+	if(!::ReadFile(h, buf, (DWORD)len, &x, &ov)) {
+		auto error = GetLastError();
+		if (error != ERROR_HANDLE_EOF) {
+			throw FileException(Util::translateError(error));
+		}
+		x = 0;
+	}
+	return x;
+}
+
+size_t File::writeAt(const void* buf, size_t len, int64_t pos) {
+	dcassert(isOpen());
+	OVERLAPPED ov = { 0 };
+	ov.Offset = (DWORD)(pos & 0xffffffff);
+	ov.OffsetHigh = (DWORD)(pos >> 32);
+
+	DWORD x;
+	if(!::WriteFile(h, buf, (DWORD)len, &x, &ov)) {
+		throw FileException(Util::translateError(GetLastError()));
+	}
+	dcassert(x == len);
+	return x;
+}
+
 void File::setEOF() {
 	dcassert(isOpen());
 	if(!SetEndOfFile(h)) {
@@ -397,6 +432,41 @@ size_t File::write(const void* buf, size_t len) {
 	return len;
 }
 
+size_t File::readAt(void* buf, size_t len, int64_t pos) {
+	ssize_t result;
+	do {
+		result = ::pread(h, buf, len, (off_t)pos);
+	} while (result == -1 && errno == EINTR);
+
+	if (result == -1) {
+		throw FileException(Util::translateError(errno));
+	}
+	return (size_t)result;
+}
+
+size_t File::writeAt(const void* buf, size_t len, int64_t pos) {
+	ssize_t result;
+	char* pointer = (char*)buf;
+	ssize_t left = len;
+
+	while (left > 0) {
+		result = ::pwrite(h, pointer, left, (off_t)pos);
+		if (result == -1) {
+			if (errno != EINTR) {
+				throw FileException(Util::translateError(errno));
+			}
+		} else if (result == 0) {
+			// No progress, don't spin forever
+			throw FileException(Util::translateError(EIO));
+		} else {
+			pointer += result;
+			pos += result;
+			left -= result;
+		}
+	}
+	return len;
+}
+
 // some ftruncate implementations can't extend files like SetEndOfFile,
 // not sure if the client code needs this...
 int File::extendFile(int64_t len) noexcept {
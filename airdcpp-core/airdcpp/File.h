@@ -96,6 +96,17 @@ public:
 	size_t write(const void* buf, size_t len);
 	size_t flush();
 
+	// Positional I/O that doesn't depend on the file position, so the handle may be used from multiple threads concurrently
+	size_t readAt(void* buf, size_t len, int64_t pos);
+	size_t writeAt(const void* buf, size_t len, int64_t pos);
+
+	// The file position is advanced by the sender
+	File* getDirectFile(int64_t& maxBytes_) noexcept { maxBytes_ = -1; return this; }
+
+#ifndef _WIN32
+	int getNativeHandle() const noexcept { return h; }
+#endif
+
 	uint64_t getLastModified() const noexcept;
 
 	static bool createFile(const string& aPath, const string& aContent = Util::emptyString) noexcept;
@@ -22,6 +22,7 @@
 
 #include "debug.h"
 #include "File.h"
+#include "ScopedFunctor.h"
 #include "Text.h"
 #include "Util.h"
 
@@ -42,16 +43,20 @@ static const size_t READ_FAILED = static_cast<size_t>(-1);
 size_t FileReader::read(const string& aPath, const DataCallback& callback) {
 	size_t ret = READ_FAILED;
 
-	if(direct) {
+	if(strategy == IO_URING) {
+		ret = readUring(aPath, callback);
+	}
+
+	if(ret == READ_FAILED && strategy <= DIRECT) {
 		ret = readDirect(aPath, callback);
 	}
 
-	if(ret == READ_FAILED) {
-			ret = readMapped(aPath, callback);
+	if(ret == READ_FAILED && strategy <= MAPPED) {
+		ret = readMapped(aPath, callback);
+	}
 
-		if(ret == READ_FAILED) {
-			ret = readCached(aPath, callback);
-		}
+	if(ret == READ_FAILED) {
+		ret = readCached(aPath, callback);
 	}
 
 	return ret;
@@ -102,6 +107,10 @@ struct Handle : boost::noncopyable {
 	HANDLE h;
 };
 
+size_t FileReader::readUring(const string& /*file*/, const DataCallback& /*callback*/) {
+	return READ_FAILED;
+}
+
 size_t FileReader::readDirect(const string& aPath, const DataCallback& callback) {
 	DWORD sector = 0, y;
 
@@ -273,6 +282,289 @@ size_t FileReader::readMapped(const string& /*file*/, const DataCallback& /*call
 #include <unistd.h>
 
 
+#ifdef HAVE_IO_URING_H
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+
+namespace {
+
+/** Minimal io_uring submission/completion ring for file reads (doesn't require liburing) */
+class ReadRing : boost::noncopyable {
+public:
+	ReadRing() { }
+	~ReadRing() {
+		if (sqes != MAP_FAILED)
+			munmap(sqes, sqesSize);
+		if (cqPtr != MAP_FAILED && cqPtr != sqPtr)
+			munmap(cqPtr, cqSize);
+		if (sqPtr != MAP_FAILED)
+			munmap(sqPtr, sqSize);
+		if (ringFd != -1)
+			::close(ringFd);
+	}
+
+	bool init(unsigned aEntries) {
+		io_uring_params p;
+		memzero(&p, sizeof(p));
+
+		ringFd = static_cast<int>(syscall(__NR_io_uring_setup, aEntries, &p));
+		if (ringFd < 0) {
+			dcdebug("io_uring_setup failed: %s\n", Util::translateError(errno).c_str());
+			return false;
+		}
+
+		sqSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+		cqSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+		auto singleMmap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+		if (singleMmap) {
+			sqSize = cqSize = max(sqSize, cqSize);
+		}
+
+		sqPtr = mmap(0, sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+		if (sqPtr == MAP_FAILED)
+			return false;
+
+		cqPtr = singleMmap ? sqPtr : mmap(0, cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+		if (cqPtr == MAP_FAILED)
+			return false;
+
+		sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+		sqes = mmap(0, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+		if (sqes == MAP_FAILED)
+			return false;
+
+		auto sq = static_cast<uint8_t*>(sqPtr);
+		sqTail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+		sqMask = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+		sqArray = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+
+		auto cq = static_cast<uint8_t*>(cqPtr);
+		cqHead = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+		cqTail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+		cqMask = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+		cqes = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+		return true;
+	}
+
+	void queueRead(int aFd, void* aBuf, unsigned aLen, uint64_t aOffset, uint64_t aUserData) {
+		auto tail = *sqTail;
+		auto index = tail & sqMask;
+
+		auto sqe = static_cast<io_uring_sqe*>(sqes) + index;
+		memzero(sqe, sizeof(io_uring_sqe));
+		sqe->opcode = IORING_OP_READ;
+		sqe->fd = aFd;
+		sqe->addr = reinterpret_cast<uint64_t>(aBuf);
+		sqe->len = aLen;
+		sqe->off = aOffset;
+		sqe->user_data = aUserData;
+
+		sqArray[index] = index;
+		__atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+		queued++;
+	}
+
+	/** Submits the queued reads and waits for at least one completion */
+	bool submitAndWait() {
+		for (;;) {
+			auto ret = syscall(__NR_io_uring_enter, ringFd, queued, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+			if (ret >= 0) {
+				queued -= static_cast<unsigned>(ret);
+				return true;
+			}
+
+			if (errno != EINTR) {
+				dcdebug("io_uring_enter failed: %s\n", Util::translateError(errno).c_str());
+				return false;
+			}
+		}
+	}
+
+	bool popCompletion(uint64_t& userData_, int& result_) {
+		auto head = *cqHead;
+		if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+			return false;
+
+		const auto& cqe = cqes[head & cqMask];
+		userData_ = cqe.user_data;
+		result_ = cqe.res;
+
+		__atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+		return true;
+	}
+private:
+	int ringFd = -1;
+	unsigned queued = 0;
+
+	void* sqPtr = MAP_FAILED;
+	void* cqPtr = MAP_FAILED;
+	void* sqes = MAP_FAILED;
+	size_t sqSize = 0, cqSize = 0, sqesSize = 0;
+
+	unsigned* sqTail = nullptr;
+	unsigned* sqArray = nullptr;
+	unsigned sqMask = 0;
+
+	unsigned* cqHead = nullptr;
+	unsigned* cqTail = nullptr;
+	unsigned cqMask = 0;
+	io_uring_cqe* cqes = nullptr;
+};
+
+// Don't bother setting up new rings if the kernel (or a seccomp filter) doesn't allow it
+static atomic<bool> uringUnsupported { false };
+
+}
+
+size_t FileReader::readUring(const string& aPath, const DataCallback& callback) {
+	if (uringUnsupported) {
+		return READ_FAILED;
+	}
+
+	int fd = open(Text::fromUtf8(aPath).c_str(), O_RDONLY | O_DIRECT);
+	if (fd == -1) {
+		dcdebug("Error opening file %s for direct reading: %s\n", aPath.c_str(), Util::translateError(errno).c_str());
+		return READ_FAILED;
+	}
+
+	ScopedFunctor([fd] { ::close(fd); });
+
+	struct stat statbuf;
+	if (fstat(fd, &statbuf) == -1) {
+		return READ_FAILED;
+	}
+
+	ReadRing ring;
+	if (!ring.init(URING_QUEUE_DEPTH)) {
+		if (errno == ENOSYS || errno == EPERM) {
+			uringUnsupported = true;
+		}
+		return READ_FAILED;
+	}
+
+	// O_DIRECT requires the buffers, offsets and lengths to be aligned to the logical block size of the device
+	const size_t alignment = 4096;
+	const auto bufSize = getBlockSize(alignment);
+	buffer.resize(bufSize * URING_QUEUE_DEPTH + alignment);
+	auto buf = static_cast<uint8_t*>(align(&buffer[0], alignment));
+
+	const int64_t size = statbuf.st_size;
+	int64_t queuePos = 0;
+	const int RESULT_PENDING = numeric_limits<int>::min();
+	int results[URING_QUEUE_DEPTH];
+	int64_t offsets[URING_QUEUE_DEPTH];
+	size_t filled[URING_QUEUE_DEPTH];
+	unsigned pending = 0;
+
+	// Reads the remaining part of the block of the slot
+	auto readSlot = [&](unsigned aSlot) {
+		results[aSlot] = RESULT_PENDING;
+		ring.queueRead(fd, buf + aSlot * bufSize + filled[aSlot], static_cast<unsigned>(bufSize - filled[aSlot]), offsets[aSlot] + filled[aSlot], aSlot);
+		pending++;
+	};
+
+	// Each slot (buffer) is used for every URING_QUEUE_DEPTH'th block
+	auto queueSlot = [&](unsigned aSlot) {
+		offsets[aSlot] = queuePos;
+		filled[aSlot] = 0;
+		readSlot(aSlot);
+		queuePos += bufSize;
+	};
+
+	auto waitCompletions = [&] {
+		if (!ring.submitAndWait()) {
+			return false;
+		}
+
+		uint64_t slot;
+		int res;
+		while (ring.popCompletion(slot, res)) {
+			results[slot] = res;
+			pending--;
+		}
+		return true;
+	};
+
+	// The reads must be finished before the buffer can be released
+	auto drain = [&] {
+		while (pending > 0) {
+			if (!waitCompletions())
+				break;
+		}
+	};
+
+	for (unsigned slot = 0; slot < URING_QUEUE_DEPTH && queuePos < size; ++slot) {
+		queueSlot(slot);
+	}
+
+	int64_t total = 0;
+	unsigned slot = 0;
+	bool go = true;
+	while (go && total < size) {
+		while (results[slot] == RESULT_PENDING) {
+			if (!waitCompletions()) {
+				auto error = errno;
+				drain();
+				if (total == 0) {
+					return READ_FAILED;
+				}
+				throw FileException(Util::translateError(error));
+			}
+		}
+
+		auto res = results[slot];
+		if (res < 0) {
+			drain();
+			if (total == 0) {
+				// Operation not supported by the kernel or the filesystem?
+				dcdebug("io_uring read failed for file %s: %s\n", aPath.c_str(), Util::translateError(-res).c_str());
+				return READ_FAILED;
+			}
+			throw FileException(Util::translateError(-res));
+		}
+
+		filled[slot] += res;
+		if (offsets[slot] + static_cast<int64_t>(filled[slot]) < min(offsets[slot] + static_cast<int64_t>(bufSize), size)) {
+			if (res == 0) {
+				// The file was truncated while reading it
+				drain();
+				throw FileException(Util::translateError(EIO));
+			}
+
+			// Short read in the middle of the file, read the rest of the block
+			readSlot(slot);
+			continue;
+		}
+
+		try {
+			go = callback(buf + slot * bufSize, filled[slot]);
+		} catch (...) {
+			drain();
+			throw;
+		}
+
+		total += filled[slot];
+
+		if (go && queuePos < size) {
+			queueSlot(slot);
+		}
+
+		slot = (slot + 1) % URING_QUEUE_DEPTH;
+	}
+
+	drain();
+	return total;
+}
+
+#else
+
+size_t FileReader::readUring(const string& /*file*/, const DataCallback& /*callback*/) {
+	return READ_FAILED;
+}
+
+#endif
+
 size_t FileReader::readDirect(const string& file, const DataCallback& callback) {
 	return READ_FAILED;
 }
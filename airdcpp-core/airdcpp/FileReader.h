@@ -37,7 +37,9 @@ using std::vector;
 class FileReader : boost::noncopyable {
 public:
 
+	/** Read strategies in the order of preference, the next one is used if a strategy isn't available */
 	enum Strategy {
+		IO_URING,
 		DIRECT,
 		MAPPED,
 		CACHED
@@ -47,10 +49,11 @@ public:
 
 	/**
 	 * Set up file reader
-	 * @param direct Bypass system caches - good for reading files which are not in the cache and should not be there (for example when hashing)
+	 * @param strategy Preferred read strategy. IO_URING and DIRECT bypass system caches - good for reading files which are
+	 * not in the cache and should not be there (for example when hashing)
 	 * @param blockSize Read block size, 0 = use default
 	 */
-	FileReader(bool direct = false, size_t blockSize = 0) : direct(direct), blockSize(blockSize) { }
+	FileReader(Strategy strategy = MAPPED, size_t blockSize = 0) : strategy(strategy), blockSize(blockSize) { }
 
 	/**
 	 * Read file - callback will be called for each read chunk which may or may not be a multiple of the requested block size.
@@ -65,8 +68,11 @@ private:
 	static const size_t DEFAULT_BLOCK_SIZE = 256*1024;
 	static const size_t DEFAULT_MMAP_SIZE = 64*1024*1024;
 
+	/** Number of blocks read ahead with io_uring */
+	static const unsigned URING_QUEUE_DEPTH = 4;
+
 	string file;
-	bool direct;
+	Strategy strategy;
 	size_t blockSize;
 
 	vector<uint8_t> buffer;
@@ -75,6 +81,7 @@ private:
 	size_t getBlockSize(size_t alignment);
 	void* align(void* buf, size_t alignment);
 
+	size_t readUring(const string& aFile, const DataCallback& callback);
 	size_t readDirect(const string& aFile, const DataCallback& callback);
 	size_t readMapped(const string& aFile, const DataCallback& callback);
 	size_t readCached(const string& aFile, const DataCallback& callback);
@@ -23,6 +23,7 @@
 #include "File.h"
 #include "FileReader.h"
 #include "LogManager.h"
+#include "ParallelTreeHasher.h"
 #include "QueueManager.h"
 #include "ShareManager.h"
 #include "ResourceManager.h"
@@ -188,13 +189,14 @@ void HashManager::getFileTTH(const string& aFile, int64_t aSize, bool addStore,
 		int64_t bs = max(TigerTree::calcBlockSize(aSize, 10), MIN_BLOCK_SIZE);
 		uint64_t timestamp = f.getLastModified();
 		TigerTree tt(bs);
+		ParallelTreeHasher treeHasher(tt, aSize);
 
 		auto start = GET_TICK();
 		int64_t tickHashed = 0;
 
-		FileReader fr(true);
+		FileReader fr(FileReader::IO_URING);
 		fr.read(aFile, [&](const void* buf, size_t n) -> bool {
-			tt.update(buf, n);
+			treeHasher.update(buf, n);
 
 			if (updateF) {
 				tickHashed += n;
@@ -214,7 +216,7 @@ void HashManager::getFileTTH(const string& aFile, int64_t aSize, bool addStore,
 		});
 
 		f.close();
-		tt.finalize();
+		treeHasher.finalize();
 		tth_ = tt.getRoot();
 
 		if (addStore && !aCancel) {
@@ -1161,6 +1163,7 @@ int HashManager::Hasher::run() {
 				int64_t bs = max(TigerTree::calcBlockSize(size, 10), MIN_BLOCK_SIZE);
 				uint64_t timestamp = f.getLastModified();
 				TigerTree tt(bs);
+				ParallelTreeHasher treeHasher(tt, size);
 
 				CRC32Filter crc32;
 
@@ -1168,7 +1171,7 @@ int HashManager::Hasher::run() {
 
 				uint64_t lastRead = GET_TICK();
  
-                FileReader fr(true);
+                FileReader fr(FileReader::IO_URING);
 				fr.read(fname, [&](const void* buf, size_t n) -> bool {
 					if(SETTING(MAX_HASH_SPEED)> 0) {
 						uint64_t now = GET_TICK();
@@ -1181,7 +1184,7 @@ int HashManager::Hasher::run() {
 					} else {
 						lastRead = GET_TICK();
 					}
-					tt.update(buf, n);
+					treeHasher.update(buf, n);
 				
 					if(fileCRC)
 						crc32(buf, n);
@@ -1198,7 +1201,7 @@ int HashManager::Hasher::run() {
 				});
 
 				f.close();
-				tt.finalize();
+				treeHasher.finalize();
 
 				failed = fileCRC && crc32.getValue() != *fileCRC;
 
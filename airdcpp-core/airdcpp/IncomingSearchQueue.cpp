@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2011-2015 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "stdinc.h"
+#include "IncomingSearchQueue.h"
+
+#include "SettingsManager.h"
+
+namespace dcpp {
+
+IncomingSearchQueue::IncomingSearchQueue() {
+
+}
+
+IncomingSearchQueue::~IncomingSearchQueue() {
+	stop();
+}
+
+bool IncomingSearchQueue::startWorkers() noexcept {
+	auto count = SETTING(INCOMING_SEARCH_THREADS);
+	for (int i = 0; i < count; ++i) {
+		unique_ptr<Worker> w(new Worker(*this));
+		try {
+			w->start();
+		} catch (const ThreadException& e) {
+			dcdebug("IncomingSearchQueue: failed to start a worker (%s)\n", e.getError().c_str());
+			break;
+		}
+
+		workers.push_back(move(w));
+	}
+
+	return !workers.empty();
+}
+
+bool IncomingSearchQueue::add(size_t aKey, Callback&& aTask) noexcept {
+	{
+		Lock l(cs);
+		if (stopping) {
+			// Shutting down
+			return true;
+		}
+
+		if (workers.empty() && !startWorkers()) {
+			return false;
+		}
+
+		auto& userCount = queuedCounts[aKey];
+		if (userCount >= MAX_USER_QUEUED) {
+			// Flooding, drop the oldest search from this user
+			dropTask(find_if(tasks.begin(), tasks.end(), [aKey](const QueuedTask& t) { return t.key == aKey; }));
+		} else if (static_cast<int>(tasks.size()) >= max(SETTING(INCOMING_SEARCH_QUEUE_SIZE), 1)) {
+			dropTask(tasks.begin());
+		}
+
+		tasks.push_back({ aKey, move(aTask) });
+		queuedCounts[aKey]++;
+	}
+
+	s.signal();
+	return true;
+}
+
+void IncomingSearchQueue::dropTask(deque<QueuedTask>::iterator i) noexcept {
+	auto c = queuedCounts.find(i->key);
+	if (--c->second == 0) {
+		queuedCounts.erase(c);
+	}
+
+	tasks.erase(i);
+	dropped++;
+}
+
+bool IncomingSearchQueue::pop(QueuedTask& task_) noexcept {
+	Lock l(cs);
+	if (stopping) {
+		return false;
+	}
+
+	// Keep the order of tasks from the same user
+	auto i = find_if(tasks.begin(), tasks.end(), [this](const QueuedTask& t) { return running.find(t.key) == running.end(); });
+	if (i == tasks.end()) {
+		return false;
+	}
+
+	task_ = move(*i);
+	tasks.erase(i);
+
+	auto c = queuedCounts.find(task_.key);
+	if (--c->second == 0) {
+		queuedCounts.erase(c);
+	}
+
+	running.insert(task_.key);
+	return true;
+}
+
+void IncomingSearchQueue::finished(size_t aKey) noexcept {
+	Lock l(cs);
+	running.erase(aKey);
+	processed++;
+}
+
+void IncomingSearchQueue::stop() noexcept {
+	{
+		Lock l(cs);
+		if (stopping) {
+			return;
+		}
+
+		stopping = true;
+		tasks.clear();
+		queuedCounts.clear();
+	}
+
+	for (size_t i = 0; i < workers.size(); ++i) {
+		s.signal();
+	}
+
+	for (auto& w: workers) {
+		w->join();
+	}
+}
+
+size_t IncomingSearchQueue::getQueued() const noexcept {
+	Lock l(cs);
+	return tasks.size();
+}
+
+int IncomingSearchQueue::Worker::run() {
+	while (true) {
+		queue.s.wait();
+
+		// Tasks that were skipped because another worker was running the same key are picked up
+		// by that worker after it has finished
+		QueuedTask task;
+		while (queue.pop(task)) {
+			task.f();
+			queue.finished(task.key);
+		}
+
+		Lock l(queue.cs);
+		if (queue.stopping) {
+			break;
+		}
+	}
+
+	return 0;
+}
+
+} // namespace dcpp
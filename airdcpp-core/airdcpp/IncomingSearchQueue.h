@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2011-2015 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef DCPLUSPLUS_DCPP_INCOMING_SEARCH_QUEUE_H
+#define DCPLUSPLUS_DCPP_INCOMING_SEARCH_QUEUE_H
+
+#include "typedefs.h"
+
+#include "CriticalSection.h"
+#include "Semaphore.h"
+#include "Thread.h"
+
+namespace dcpp {
+
+/**
+ * Bounded worker pool for responding to incoming searches, so that share searches won't block the socket thread of the hub.
+ *
+ * Tasks with the same key (the searching user) are run one at a time in the order they were added.
+ * When the queue is full, the oldest queued search is dropped.
+ */
+class IncomingSearchQueue {
+public:
+	typedef std::function<void()> Callback;
+
+	IncomingSearchQueue();
+	~IncomingSearchQueue();
+
+	/** Returns false if the search should be responded to synchronously (no worker threads are used) */
+	bool add(size_t aKey, Callback&& aTask) noexcept;
+
+	/** Drops the queued searches and waits for the running ones to finish. Searches added afterwards are ignored. */
+	void stop() noexcept;
+
+	size_t getQueued() const noexcept;
+	uint64_t getProcessed() const noexcept { return processed; }
+	uint64_t getDropped() const noexcept { return dropped; }
+private:
+	// Maximum number of queued searches from a single user
+	static const int MAX_USER_QUEUED = 5;
+
+	class Worker : public Thread {
+	public:
+		Worker(IncomingSearchQueue& aQueue) : queue(aQueue) { }
+	private:
+		int run();
+		IncomingSearchQueue& queue;
+	};
+
+	struct QueuedTask {
+		size_t key;
+		Callback f;
+	};
+
+	bool startWorkers() noexcept;
+
+	// Takes the oldest task whose key isn't being run by another worker
+	bool pop(QueuedTask& task_) noexcept;
+	void finished(size_t aKey) noexcept;
+	void dropTask(deque<QueuedTask>::iterator i) noexcept;
+
+	mutable CriticalSection cs;
+	deque<QueuedTask> tasks;
+
+	// Keys that are currently being run
+	unordered_set<size_t> running;
+
+	// Number of queued tasks for each key
+	unordered_map<size_t, int> queuedCounts;
+
+	vector<unique_ptr<Worker>> workers;
+	Semaphore s;
+	bool stopping = false;
+
+	atomic<uint64_t> processed { 0 };
+	atomic<uint64_t> dropped { 0 };
+};
+
+} // namespace dcpp
+
+#endif // !defined(DCPLUSPLUS_DCPP_INCOMING_SEARCH_QUEUE_H)
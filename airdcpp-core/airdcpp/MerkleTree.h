@@ -98,29 +98,62 @@ public:
 	 */
 	void update(const void* data, size_t len) {
 		uint8_t* buf = (uint8_t*)data;
-		uint8_t zero = 0;
 		size_t i = 0;
 
 		// Skip empty data sets if we already added at least one of them...
 		if(len == 0 && !(leaves.empty() && blocks.empty()))
 			return;
-		
-		do {
-			size_t n = min(baseBlockSize, len-i);
+
+		// Hash the full blocks in batches so that the hasher can process them in parallel
+		uint8_t hashes[LEAF_BATCH * BYTES];
+		while(len - i >= baseBlockSize) {
+			size_t n = min((len - i) / baseBlockSize, (size_t)LEAF_BATCH);
+			Hasher::hashLeaves(buf + i, baseBlockSize, n, hashes);
+			for(size_t j = 0; j < n; ++j) {
+				addLeaf(MerkleValue(hashes + j * BYTES));
+			}
+			i += n * baseBlockSize;
+		}
+
+		// Partial last block (or the only leaf of an empty file)
+		if(i < len || len == 0) {
+			uint8_t zero = 0;
 			Hasher h;
 			h.update(&zero, 1);
-			h.update(buf + i, n);
-			if((int64_t)baseBlockSize < blockSize) {
-				blocks.emplace_back(MerkleValue(h.finalize()), baseBlockSize);
-				reduceBlocks();
-			} else {
-				leaves.emplace_back(h.finalize());
-			}
-			i += n;
-		} while(i < len);
+			h.update(buf + i, len - i);
+			addLeaf(MerkleValue(h.finalize()));
+		}
 		fileSize += len;
 	}
 
+	/**
+	 * Adds a separately hashed (and finalized) part of the data that follows the data added so far.
+	 * The part must either use the same block size as this tree or a smaller power of two block
+	 * size that it fills completely (only the last part may be shorter).
+	 */
+	void append(const MerkleTree& aPart) {
+		if(aPart.blockSize == blockSize) {
+			dcassert(blocks.empty());
+			leaves.insert(leaves.end(), aPart.leaves.begin(), aPart.leaves.end());
+		} else {
+			dcassert(aPart.blockSize < blockSize && aPart.leaves.size() == 1);
+			blocks.emplace_back(aPart.leaves[0], aPart.fileSize);
+			reduceBlocks();
+		}
+		fileSize += aPart.fileSize;
+	}
+
+	/**
+	 * Adds separately calculated leaves of the base block size for the data that follows the data added so far.
+	 * All leaves must be full blocks, except the last one of the data.
+	 */
+	void appendLeaves(const MerkleList& aLeaves, int64_t aSize) {
+		for (const auto& l: aLeaves) {
+			addLeaf(l);
+		}
+		fileSize += aSize;
+	}
+
 	uint8_t* finalize() {
 		// No updates yet, make sure we have at least one leaf for 0-length files...
 		if(leaves.empty() && blocks.empty()) {
@@ -170,6 +203,9 @@ public:
 
 
 private:	
+	/** Maximum number of leaves hashed with a single call */
+	static const size_t LEAF_BATCH = 64;
+
 	typedef pair<MerkleValue, int64_t> MerkleBlock;
 	typedef vector<MerkleBlock> MBList;
 
@@ -205,6 +241,15 @@ private:
 		return MerkleValue(h.finalize());
 	}
 
+	void addLeaf(const MerkleValue& aHash) {
+		if((int64_t)baseBlockSize < blockSize) {
+			blocks.emplace_back(aHash, baseBlockSize);
+			reduceBlocks();
+		} else {
+			leaves.push_back(aHash);
+		}
+	}
+
 	void reduceBlocks() {
 		while(blocks.size() > 1) {
 			MerkleBlock& a = blocks[blocks.size()-2];
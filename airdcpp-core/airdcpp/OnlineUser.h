@@ -93,10 +93,10 @@ public:
 #undef GETSET_FIELD
 	uint8_t getSlots() const;
 	void setBytesShared(const string& bs) { set("SS", bs); }
-	int64_t getBytesShared() const { return Util::toInt64(get("SS")); }
+	int64_t getBytesShared() const { return getInt(INT_SS); }
 	
 	void setStatus(const string& st) { set("ST", st); }
-	StatusFlags getStatus() const { return static_cast<StatusFlags>(Util::toInt(get("ST"))); }
+	StatusFlags getStatus() const { return static_cast<StatusFlags>(getInt(INT_ST)); }
 
 	void setOp(bool op) { set("OP", op ? "1" : Util::emptyString); }
 	void setHub(bool hub) { set("HU", hub ? "1" : Util::emptyString); }
@@ -150,8 +150,53 @@ private:
 	UserPtr user;
 	uint32_t sid;
 
-	typedef map<short, string> InfMap;
-	InfMap info;
+	// The INF fields are stored compactly since hubs may have tens of thousands of users.
+	// Frequent numeric fields and IP addresses are kept in binary form when the value can be formatted back identically,
+	// values that are the same for many users (client versions, supports) are pooled and the rest are sorted by the field code.
+	enum IntField {
+		INT_SS,
+		INT_SF,
+		INT_SL,
+		INT_HN,
+		INT_HR,
+		INT_HO,
+		INT_CT,
+		INT_ST,
+		INT_US,
+		INT_DS,
+		INT_U4,
+		INT_U6,
+		INT_LAST
+	};
+
+	enum IpFlags {
+		IP4_SET = 0x01,
+		IP6_SET = 0x02
+	};
+
+	int64_t ints[INT_LAST];
+	uint16_t intsSet = 0;
+
+	uint8_t ipsSet = 0;
+	uint8_t ip4[4];
+	uint8_t ip6[16];
+
+	typedef vector<pair<short, const string*>> PooledInfoList;
+	PooledInfoList pooledInfo;
+
+	typedef vector<pair<short, string>> InfoList;
+	InfoList info;
+
+	static int getIntField(short aCode) noexcept;
+	static bool isPooledField(short aCode) noexcept;
+
+	int64_t getInt(IntField aField) const noexcept;
+	string getValue(short aCode) const noexcept;
+	bool hasValue(short aCode) const noexcept;
+	void removeValue(short aCode) noexcept;
+
+	template<typename F>
+	void forEachValue(F aF) const;
 
 	static SharedMutex cs;
 };
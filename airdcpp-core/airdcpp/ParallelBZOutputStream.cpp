@@ -0,0 +1,371 @@
+/*
+ * Copyright (C) 2011-2015 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "stdinc.h"
+#include "ParallelBZOutputStream.h"
+
+#include "Exception.h"
+#include "ResourceManager.h"
+
+#include <bzlib.h>
+#include <thread>
+
+namespace dcpp {
+
+// bzip2 stream structure: "BZh9" header, blocks (each starting with a 48-bit magic followed by the block CRC)
+// and the end of stream marker (48-bit magic, combined CRC of all blocks and padding to full bytes)
+#define BZ_HEADER_BITS 32
+#define BZ_EOS_MAGIC_HI 0x177245
+#define BZ_EOS_MAGIC_LO 0x385090
+
+static uint32_t getBits(const uint8_t* aData, size_t aPos, int aBits) noexcept {
+	uint32_t ret = 0;
+	for (int i = 0; i < aBits; ++i, ++aPos) {
+		ret = (ret << 1) | ((aData[aPos >> 3] >> (7 - (aPos & 7))) & 1);
+	}
+	return ret;
+}
+
+ParallelBZOutputStream::ParallelBZOutputStream(OutputStream* aStream, TigerTree* aInputTree) : s(aStream), inputTree(aInputTree), 
+	maxChunks(2 * max(std::thread::hardware_concurrency(), 1U)), out({ 'B', 'Z', 'h', '9' }) {
+
+}
+
+ParallelBZOutputStream::~ParallelBZOutputStream() noexcept {
+	// The tasks must not outlive the chunks (writing may have been aborted)
+	tasks.wait();
+}
+
+size_t ParallelBZOutputStream::write(const void* aBuf, size_t aLen) {
+	if (flushed)
+		throw Exception("No filtered writes after flush");
+
+	auto buf = static_cast<const uint8_t*>(aBuf);
+	auto len = aLen;
+	while (len > 0) {
+		if (!current) {
+			current = getChunk();
+			current->segment = segment;
+			if (inputTree) {
+				// The leaves are combined when merging as the chunks may not be aligned to the larger blocks
+				current->tree = TigerTree(TigerTree::BASE_BLOCK_SIZE);
+			}
+		}
+
+		auto n = min(len, CHUNK_SIZE - current->size);
+		memcpy(&current->data[current->size], buf, n);
+		current->size += n;
+		inputPos += n;
+		buf += n;
+		len -= n;
+
+		if (current->size == CHUNK_SIZE) {
+			dispatch();
+		}
+	}
+
+	return aLen;
+}
+
+ParallelBZOutputStream::ChunkPtr ParallelBZOutputStream::getChunk() {
+	if (running.size() >= maxChunks) {
+		mergeFront();
+	}
+
+	ChunkPtr ret;
+	if (unused.empty()) {
+		ret.reset(new Chunk);
+	} else {
+		ret = move(unused.back());
+		unused.pop_back();
+	}
+
+	ret->size = 0;
+	ret->done = false;
+	ret->segment = nullptr;
+	ret->cached = nullptr;
+	return ret;
+}
+
+void ParallelBZOutputStream::dispatch() {
+	auto chunk = current.get();
+	auto hash = inputTree != nullptr;
+	if (hash) {
+		// The chunk may start and end in the middle of a leaf
+		auto chunkStart = inputPos - static_cast<int64_t>(chunk->size);
+		chunk->leafStart = min(chunk->size, static_cast<size_t>((TigerTree::BASE_BLOCK_SIZE - chunkStart % TigerTree::BASE_BLOCK_SIZE) % TigerTree::BASE_BLOCK_SIZE));
+		chunk->leafEnd = chunk->leafStart + (chunk->size - chunk->leafStart) / TigerTree::BASE_BLOCK_SIZE * TigerTree::BASE_BLOCK_SIZE;
+	}
+
+	running.push_back(move(current));
+
+	tasks.run([chunk, hash] {
+		compress(*chunk);
+		if (hash && chunk->leafEnd > chunk->leafStart) {
+			chunk->tree.update(&chunk->data[chunk->leafStart], chunk->leafEnd - chunk->leafStart);
+		}
+		chunk->done = true;
+	});
+}
+
+void ParallelBZOutputStream::endChunk() {
+	if (current) {
+		dispatch();
+	}
+}
+
+void ParallelBZOutputStream::beginSegment() {
+	dcassert(!segment);
+	endChunk();
+	segment = make_shared<Segment>();
+	segment->phase = static_cast<size_t>(inputPos % TigerTree::BASE_BLOCK_SIZE);
+}
+
+ParallelBZOutputStream::SegmentPtr ParallelBZOutputStream::endSegment() {
+	endChunk();
+
+	SegmentPtr ret = segment;
+	segment = nullptr;
+	return ret;
+}
+
+void ParallelBZOutputStream::writeSegment(const SegmentPtr& aSegment, char aPadding) {
+	if (flushed)
+		throw Exception("No filtered writes after flush");
+
+	dcassert(!segment);
+	if (inputTree) {
+		// The leaves of the segment are valid only at the same offset within a leaf
+		auto padding = (aSegment->phase + TigerTree::BASE_BLOCK_SIZE - static_cast<size_t>(inputPos % TigerTree::BASE_BLOCK_SIZE)) % TigerTree::BASE_BLOCK_SIZE;
+		if (padding > 0) {
+			string tmp(padding, aPadding);
+			write(tmp);
+		}
+	}
+
+	endChunk();
+
+	auto chunk = getChunk();
+	chunk->cached = aSegment;
+	chunk->done = true;
+	running.push_back(move(chunk));
+	inputPos += aSegment->size;
+}
+
+void ParallelBZOutputStream::hashInput(const uint8_t* aData, size_t aLen, Segment* aRecording) {
+	while (aLen > 0) {
+		auto n = min(aLen, TigerTree::BASE_BLOCK_SIZE - leafBuf.size());
+		leafBuf.insert(leafBuf.end(), aData, aData + n);
+
+		if (aRecording) {
+			// The data before the first leaf boundary of the segment is stored separately
+			auto& seg = *aRecording;
+			auto headLen = (TigerTree::BASE_BLOCK_SIZE - seg.phase) % TigerTree::BASE_BLOCK_SIZE;
+			auto h = seg.head.size() < headLen ? min(n, headLen - seg.head.size()) : 0;
+			seg.head.insert(seg.head.end(), aData, aData + h);
+			seg.tail.insert(seg.tail.end(), aData + h, aData + n);
+			seg.size += n;
+		}
+
+		aData += n;
+		aLen -= n;
+
+		if (leafBuf.size() == TigerTree::BASE_BLOCK_SIZE) {
+			TigerTree leaf(TigerTree::BASE_BLOCK_SIZE);
+			leaf.update(&leafBuf[0], leafBuf.size());
+			leafBuf.clear();
+
+			// Leaves starting before the segment aren't stored in it
+			inputTree->appendLeaves(leaf.getLeaves(), TigerTree::BASE_BLOCK_SIZE);
+			if (aRecording && aRecording->size >= static_cast<int64_t>(TigerTree::BASE_BLOCK_SIZE)) {
+				aRecording->leaves.push_back(leaf.getLeaves()[0]);
+				aRecording->tail.clear();
+			}
+		}
+	}
+}
+
+void ParallelBZOutputStream::appendLeaves(const TigerTree::MerkleList& aLeaves, Segment* aRecording) {
+	dcassert(leafBuf.empty());
+	auto size = static_cast<int64_t>(aLeaves.size() * TigerTree::BASE_BLOCK_SIZE);
+	inputTree->appendLeaves(aLeaves, size);
+
+	if (aRecording) {
+		dcassert(aRecording->tail.empty());
+		aRecording->leaves.insert(aRecording->leaves.end(), aLeaves.begin(), aLeaves.end());
+		aRecording->size += size;
+	}
+}
+
+void ParallelBZOutputStream::compress(Chunk& aChunk) noexcept {
+	aChunk.failed = true;
+
+	// Worst case expansion of bzip2 is about 1%
+	aChunk.compressed.resize(aChunk.size + aChunk.size / 100 + 600);
+	auto outLen = static_cast<unsigned int>(aChunk.compressed.size());
+	if (BZ2_bzBuffToBuffCompress(reinterpret_cast<char*>(&aChunk.compressed[0]), &outLen, reinterpret_cast<char*>(&aChunk.data[0]), aChunk.size, 9, 0, 30) != BZ_OK) {
+		return;
+	}
+
+	// Locate the end of stream marker, it's followed by the CRC (equal to the block CRC as there is a single block) and 0-7 padding bits
+	auto data = &aChunk.compressed[0];
+	auto totalBits = static_cast<size_t>(outLen) * 8;
+	if (totalBits < BZ_HEADER_BITS + 48 + 32 + 80) {
+		return;
+	}
+
+	aChunk.blockCRC = getBits(data, BZ_HEADER_BITS + 48, 32);
+	for (size_t padding = 0; padding < 8; ++padding) {
+		auto eos = totalBits - padding - 80;
+		if (getBits(data, eos, 24) == BZ_EOS_MAGIC_HI && getBits(data, eos + 24, 24) == BZ_EOS_MAGIC_LO && getBits(data, eos + 48, 32) == aChunk.blockCRC) {
+			aChunk.blockStart = BZ_HEADER_BITS;
+			aChunk.blockEnd = eos;
+			aChunk.failed = false;
+			return;
+		}
+	}
+}
+
+void ParallelBZOutputStream::mergeFront() {
+	auto& chunk = running.front();
+	if (chunk->cached) {
+		for (const auto& b: chunk->cached->blocks) {
+			putBlock(&b.data[0], b.start, b.end, b.crc);
+		}
+
+		if (inputTree) {
+			auto& seg = *chunk->cached;
+			dcassert(leafBuf.size() == seg.phase);
+			if (!seg.head.empty())
+				hashInput(&seg.head[0], seg.head.size(), nullptr);
+			if (!seg.leaves.empty())
+				appendLeaves(seg.leaves, nullptr);
+			if (!seg.tail.empty())
+				hashInput(&seg.tail[0], seg.tail.size(), nullptr);
+		}
+	} else {
+		if (!chunk->done) {
+			// Help with compressing (there may not be any idle worker threads)
+			tasks.wait();
+		}
+
+		if (chunk->failed) {
+			throw Exception(STRING(COMPRESSION_ERROR));
+		}
+
+		putBlock(&chunk->compressed[0], chunk->blockStart, chunk->blockEnd, chunk->blockCRC);
+
+		auto seg = chunk->segment.get();
+		if (inputTree) {
+			hashInput(&chunk->data[0], chunk->leafStart, seg);
+			if (chunk->leafEnd > chunk->leafStart)
+				appendLeaves(chunk->tree.getLeaves(), seg);
+			hashInput(&chunk->data[0] + chunk->leafEnd, chunk->size - chunk->leafEnd, seg);
+		} else if (seg) {
+			seg->size += chunk->size;
+		}
+
+		if (seg) {
+			// Store only the bytes containing the block bits
+			auto first = chunk->blockStart / 8;
+			seg->blocks.push_back({ ByteVector(chunk->compressed.begin() + first, chunk->compressed.begin() + (chunk->blockEnd + 7) / 8),
+				chunk->blockStart - first * 8, chunk->blockEnd - first * 8, chunk->blockCRC });
+		}
+	}
+
+	chunk->segment = nullptr;
+	chunk->cached = nullptr;
+	unused.push_back(move(chunk));
+	running.pop_front();
+
+	writeOutput(false);
+}
+
+void ParallelBZOutputStream::putBlock(const uint8_t* aData, size_t aStartBit, size_t aEndBit, uint32_t aCRC) noexcept {
+	putBits(aData, aStartBit, aEndBit);
+	combinedCRC = ((combinedCRC << 1) | (combinedCRC >> 31)) ^ aCRC;
+}
+
+void ParallelBZOutputStream::putBits(uint32_t aValue, int aBits) noexcept {
+	bitBuf = (bitBuf << aBits) | aValue;
+	bitCount += aBits;
+	while (bitCount >= 8) {
+		bitCount -= 8;
+		out.push_back(static_cast<uint8_t>(bitBuf >> bitCount));
+	}
+}
+
+void ParallelBZOutputStream::putBits(const uint8_t* aData, size_t aStartBit, size_t aEndBit) noexcept {
+	auto pos = aStartBit;
+	auto shift = pos & 7;
+	for (; aEndBit - pos >= 8; pos += 8) {
+		auto p = aData + (pos >> 3);
+		putBits(shift == 0 ? p[0] : static_cast<uint8_t>((p[0] << shift) | (p[1] >> (8 - shift))), 8);
+	}
+
+	if (pos < aEndBit) {
+		putBits(getBits(aData, pos, static_cast<int>(aEndBit - pos)), static_cast<int>(aEndBit - pos));
+	}
+}
+
+size_t ParallelBZOutputStream::writeOutput(bool aFinal) {
+	if (aFinal && bitCount > 0) {
+		putBits(0, 8 - bitCount);
+	}
+
+	auto n = aFinal ? out.size() : out.size() & ~static_cast<size_t>(1023);
+	if (n == 0) {
+		return 0;
+	}
+
+	auto written = s->write(&out[0], n);
+	out.erase(out.begin(), out.begin() + n);
+	return written;
+}
+
+size_t ParallelBZOutputStream::flush() {
+	if (flushed)
+		return 0;
+
+	flushed = true;
+	if (current && current->size > 0) {
+		dispatch();
+	}
+
+	while (!running.empty()) {
+		mergeFront();
+	}
+
+	tasks.wait();
+
+	putBits(BZ_EOS_MAGIC_HI, 24);
+	putBits(BZ_EOS_MAGIC_LO, 24);
+	putBits(combinedCRC, 32);
+
+	auto written = writeOutput(true);
+	if (inputTree) {
+		if (!leafBuf.empty()) {
+			inputTree->update(&leafBuf[0], leafBuf.size());
+		}
+		inputTree->finalize();
+	}
+
+	return written + s->flush();
+}
+
+} // namespace dcpp
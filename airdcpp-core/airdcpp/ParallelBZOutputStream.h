@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2011-2015 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef DCPLUSPLUS_DCPP_PARALLEL_BZ_OUTPUT_STREAM_H
+#define DCPLUSPLUS_DCPP_PARALLEL_BZ_OUTPUT_STREAM_H
+
+#include "typedefs.h"
+
+#include "concurrency.h"
+#include "MerkleTree.h"
+#include "Streams.h"
+
+namespace dcpp {
+
+/**
+ * Output stream that compresses the written data with bzip2 using multiple threads.
+ * The input is split into chunks that are small enough to fit in a single bzip2 block and
+ * the compressed blocks are joined into one regular bzip2 stream, which can be read by
+ * any decompressor (also by the ones that stop after the first stream).
+ * The tree of the uncompressed data can be calculated by the compression tasks as well.
+ * The number of chunks in memory is bounded. The underlying stream isn't deleted.
+ *
+ * Parts of the stream can be recorded as segments, which can be written in later streams
+ * without compressing and hashing the data again. The tree leaves of a segment depend on its
+ * offset within a leaf, which is matched by padding when the segment is written.
+ */
+class ParallelBZOutputStream : public OutputStream {
+public:
+	using OutputStream::write;
+
+	/** Compressed blocks and the input tree leaves of a part of the stream */
+	struct Segment {
+		struct Block {
+			ByteVector data;
+			/** Bit range of the block in data */
+			size_t start;
+			size_t end;
+			uint32_t crc;
+		};
+
+		vector<Block> blocks;
+
+		/** Offset of the segment within a tree leaf */
+		size_t phase = 0;
+		/** Data before the first leaf boundary and after the last one (the leaves spanning the segment borders need them) */
+		ByteVector head;
+		ByteVector tail;
+		/** Leaves that are completely inside the segment */
+		TigerTree::MerkleList leaves;
+
+		int64_t size = 0;
+	};
+
+	typedef shared_ptr<const Segment> SegmentPtr;
+
+	/** Size of the data compressed by a single task (fits in a 900k block even after the initial RLE pass) */
+	static const size_t CHUNK_SIZE = 512 * 1024;
+
+	/**
+	 * @param aStream Stream for the compressed data. The data is written in multiples of 1024 bytes (except the last write)
+	 * so that a TTFilter can be used for it.
+	 * @param aInputTree Optional tree that will be updated with the uncompressed data.
+	 */
+	ParallelBZOutputStream(OutputStream* aStream, TigerTree* aInputTree = nullptr);
+	~ParallelBZOutputStream() noexcept;
+
+	size_t write(const void* aBuf, size_t aLen);
+
+	/** Finishes the bzip2 stream and finalizes the input tree */
+	size_t flush();
+
+	/** Starts recording the following data in a new segment */
+	void beginSegment();
+
+	/** Ends the current segment, which is complete after the stream has been flushed */
+	SegmentPtr endSegment();
+
+	/**
+	 * Writes a segment recorded by an earlier stream (using the same input tree settings).
+	 * If the segment was recorded at a different offset within a tree leaf, the data written so far
+	 * is padded with aPadding first.
+	 */
+	void writeSegment(const SegmentPtr& aSegment, char aPadding);
+private:
+	struct Chunk {
+		Chunk() : data(CHUNK_SIZE) { }
+
+		ByteVector data;
+		size_t size = 0;
+
+		ByteVector compressed;
+		/** Bit range of the compressed block in the single-block stream */
+		size_t blockStart = 0;
+		size_t blockEnd = 0;
+		uint32_t blockCRC = 0;
+		bool failed = false;
+
+		/** Full leaves of the data hashed by the task (the partial ones are hashed when merging) */
+		TigerTree tree;
+		size_t leafStart = 0;
+		size_t leafEnd = 0;
+		atomic<bool> done { false };
+
+		/** Segment that is being recorded */
+		shared_ptr<Segment> segment;
+
+		/** Recorded segment that is written instead of the chunk data */
+		SegmentPtr cached;
+	};
+
+	typedef unique_ptr<Chunk> ChunkPtr;
+
+	static void compress(Chunk& aChunk) noexcept;
+
+	ChunkPtr getChunk();
+	void dispatch();
+	void mergeFront();
+
+	/** Dispatches the current chunk */
+	void endChunk();
+
+	/** Adds data that doesn't fill complete leaves by itself to the input tree (and to the segment being recorded) */
+	void hashInput(const uint8_t* aData, size_t aLen, Segment* aRecording);
+	void appendLeaves(const TigerTree::MerkleList& aLeaves, Segment* aRecording);
+	void putBlock(const uint8_t* aData, size_t aStartBit, size_t aEndBit, uint32_t aCRC) noexcept;
+
+	void putBits(uint32_t aValue, int aBits) noexcept;
+	void putBits(const uint8_t* aData, size_t aStartBit, size_t aEndBit) noexcept;
+
+	/** Passes the completed output to the underlying stream */
+	size_t writeOutput(bool aFinal);
+
+	OutputStream* s;
+	TigerTree* inputTree;
+	const size_t maxChunks;
+
+	ChunkPtr current;
+	shared_ptr<Segment> segment;
+
+	/** Total size of the input written */
+	int64_t inputPos = 0;
+	/** Merged data of the incomplete input tree leaf */
+	ByteVector leafBuf;
+	deque<ChunkPtr> running;
+	vector<ChunkPtr> unused;
+
+	ByteVector out;
+	uint64_t bitBuf = 0;
+	int bitCount = 0;
+	uint32_t combinedCRC = 0;
+	bool flushed = false;
+
+	task_group tasks;
+};
+
+} // namespace dcpp
+
+#endif // !defined(DCPLUSPLUS_DCPP_PARALLEL_BZ_OUTPUT_STREAM_H)
@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2011-2015 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "stdinc.h"
+#include "ParallelTreeHasher.h"
+
+#include <thread>
+
+namespace dcpp {
+
+bool ParallelTreeHasher::isEnabled(int64_t aFileSize) noexcept {
+#ifndef HAVE_PARALLEL_TASKS
+	// The tasks would be run synchronously, copying the data would only slow down hashing
+	return false;
+#endif
+
+	return aFileSize >= static_cast<int64_t>(2 * CHUNK_SIZE) && std::thread::hardware_concurrency() > 1;
+}
+
+// The chunk being filled is included in the buffer size
+ParallelTreeHasher::ParallelTreeHasher(TigerTree& aTree, int64_t aFileSize) noexcept : tree(aTree),
+	chunkBlockSize(min(aTree.getBlockSize(), static_cast<int64_t>(CHUNK_SIZE))),
+	maxChunks(min<size_t>(MAX_BUFFER_SIZE / CHUNK_SIZE - 1, 2 * max(std::thread::hardware_concurrency(), 1U))), parallel(isEnabled(aFileSize)) {
+
+}
+
+ParallelTreeHasher::~ParallelTreeHasher() {
+	// The tasks must not outlive the chunks (hashing may have been aborted)
+	tasks.wait();
+}
+
+void ParallelTreeHasher::update(const void* aData, size_t aLen) {
+	if (!parallel) {
+		tree.update(aData, aLen);
+		return;
+	}
+
+	auto buf = static_cast<const uint8_t*>(aData);
+	while (aLen > 0) {
+		if (!current) {
+			if (running.size() >= maxChunks) {
+				mergeFront();
+			}
+
+			if (unused.empty()) {
+				current.reset(new Chunk);
+			} else {
+				current = move(unused.back());
+				unused.pop_back();
+			}
+
+			current->size = 0;
+			current->done = false;
+			current->tree = TigerTree(chunkBlockSize);
+		}
+
+		auto n = min(aLen, CHUNK_SIZE - current->size);
+		memcpy(&current->data[current->size], buf, n);
+		current->size += n;
+		buf += n;
+		aLen -= n;
+
+		if (current->size == CHUNK_SIZE) {
+			dispatch();
+		}
+	}
+}
+
+void ParallelTreeHasher::dispatch() {
+	auto chunk = current.get();
+	running.push_back(move(current));
+
+	tasks.run([chunk] {
+		chunk->tree.update(&chunk->data[0], chunk->size);
+		chunk->tree.finalize();
+		chunk->done = true;
+	});
+}
+
+void ParallelTreeHasher::mergeFront() {
+	auto& chunk = running.front();
+	if (!chunk->done) {
+		// Help with hashing (there may not be any idle worker threads)
+		tasks.wait();
+	}
+
+	tree.append(chunk->tree);
+
+	unused.push_back(move(chunk));
+	running.pop_front();
+}
+
+void ParallelTreeHasher::finalize() {
+	if (!parallel) {
+		tree.finalize();
+		return;
+	}
+
+	if (current && current->size > 0) {
+		dispatch();
+	}
+
+	while (!running.empty()) {
+		mergeFront();
+	}
+
+	tasks.wait();
+	tree.finalize();
+}
+
+} // namespace dcpp
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2011-2015 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef DCPLUSPLUS_DCPP_PARALLEL_TREE_HASHER_H
+#define DCPLUSPLUS_DCPP_PARALLEL_TREE_HASHER_H
+
+#include "typedefs.h"
+
+#include "concurrency.h"
+#include "MerkleTree.h"
+
+namespace dcpp {
+
+/**
+ * Calculates the tree of a single file by hashing fixed-size chunks of it in parallel.
+ * The data is still read sequentially by the caller and the subtrees of the chunks are
+ * appended to the tree in file order. The memory used by the chunks is bounded.
+ * Small files are hashed directly on the calling thread.
+ */
+class ParallelTreeHasher : boost::noncopyable {
+public:
+	/** Size of the data hashed by a single task */
+	static const size_t CHUNK_SIZE = 4 * 1024 * 1024;
+
+	/** Maximum size of the chunk buffers of a single file */
+	static const size_t MAX_BUFFER_SIZE = 16 * 1024 * 1024;
+
+	ParallelTreeHasher(TigerTree& aTree, int64_t aFileSize) noexcept;
+	~ParallelTreeHasher();
+
+	void update(const void* aData, size_t aLen);
+
+	/** Waits for the running tasks and finalizes the tree */
+	void finalize();
+private:
+	struct Chunk {
+		Chunk() : data(CHUNK_SIZE) { }
+
+		ByteVector data;
+		size_t size = 0;
+		TigerTree tree;
+		atomic<bool> done { false };
+	};
+
+	typedef unique_ptr<Chunk> ChunkPtr;
+
+	/** Whether parallel hashing is worth it for a file of the given size */
+	static bool isEnabled(int64_t aFileSize) noexcept;
+
+	void dispatch();
+	void mergeFront();
+
+	TigerTree& tree;
+	const int64_t chunkBlockSize;
+	const size_t maxChunks;
+	const bool parallel;
+
+	ChunkPtr current;
+	deque<ChunkPtr> running;
+	vector<ChunkPtr> unused;
+
+	task_group tasks;
+};
+
+} // namespace dcpp
+
+#endif // !defined(DCPLUSPLUS_DCPP_PARALLEL_TREE_HASHER_H)
@@ -177,17 +177,12 @@ bool QueueItem::isBadSourceExcept(const UserPtr& aUser, Flags::MaskType exceptio
 bool QueueItem::isChunkDownloaded(int64_t startPos, int64_t& len) const {
 	if(len <= 0) return false;
 
-	for(auto& i: done) {
-		int64_t first  = i.getStart();
-		int64_t second = i.getEnd();
-
-		if(first <= startPos && startPos < second){
-			len = min(len, second - startPos);
-			return true;
-		}
-	}
+	auto end = done.coveredUntil(startPos);
+	if(end == startPos)
+		return false;
 
-	return false;
+	len = min(len, end - startPos);
+	return true;
 }
 
 string QueueItem::getListName() const {
@@ -326,7 +321,7 @@ double QueueItem::getDownloadedFraction() const {
 }
 
 bool QueueItem::isFinished() const {
-	return done.size() == 1 && *done.begin() == Segment(0, size);
+	return size > 0 ? done.contains(Segment(0, size)) : doneUnknownSize;
 }
 
 Segment QueueItem::getNextSegment(int64_t aBlockSize, int64_t wantedSize, int64_t lastSpeed, const PartialSource::Ptr partialSource, bool allowOverlap) const {
@@ -343,16 +338,15 @@ Segment QueueItem::getNextSegment(int64_t aBlockSize, int64_t wantedSize, int64_
 		int64_t end = size;
 
 		if(!done.empty()) {
-			const Segment& first = *done.begin();
+			auto first = done.getRanges().begin();
 
-			if(first.getStart() > 0) {
-				end = Util::roundUp(first.getStart(), aBlockSize);
+			if(first->first > 0) {
+				end = Util::roundUp(first->first, aBlockSize);
 			} else {
-				start = Util::roundDown(first.getEnd(), aBlockSize);
+				start = Util::roundDown(first->second, aBlockSize);
 
 				if(done.size() > 1) {
-					const Segment& second = *(++done.begin());
-					end = Util::roundUp(second.getStart(), aBlockSize);
+					end = Util::roundUp(std::next(first)->first, aBlockSize);
 				}
 			}
 		}
@@ -393,57 +387,40 @@ Segment QueueItem::getNextSegment(int64_t aBlockSize, int64_t wantedSize, int64_
 		targetSize = aBlockSize;
 	}		
 
-	int64_t start = 0;
-	int64_t curSize = targetSize;
-
-	while(start < size) {
-		int64_t end = std::min(size, start + curSize);
-		Segment block(start, end - start);
-		bool overlaps = false;
-		for(auto i = done.begin(); !overlaps && i != done.end(); ++i) {
-			if(curSize <= aBlockSize) {
-				int64_t dstart = i->getStart();
-				int64_t dend = i->getEnd();
-				// We accept partial overlaps, only consider the block done if it is fully consumed by the done block
-				if(dstart <= start && dend >= end) {
-					overlaps = true;
-				}
-			} else {
-				overlaps = block.overlaps(*i);
-			}
-		}
-		
-		for(auto i = downloads.begin(); !overlaps && i != downloads.end(); ++i) {
-			overlaps = block.overlaps((*i)->getSegment());
+	// Running segments may overlap each other
+	SegmentMap running;
+	for(auto d: downloads) {
+		running.add(d->getSegment());
+	}
+
+	Segment selected(0, 0);
+	findFreeBlocks(done, running, size, aBlockSize, targetSize, [&](const Segment& aBlock) {
+		if(!partialSource) {
+			selected = aBlock;
+			return false;
 		}
-		
-		if(!overlaps) {
-			if(partialSource) {
-				// store all chunks we could need
-				for(auto j = posArray.begin(); j < posArray.end(); j += 2){
-					if( (*j <= start && start < *(j+1)) || (start <= *j && *j < end) ) {
-						int64_t b = max(start, *j);
-						int64_t e = min(end, *(j+1));
-
-						// segment must be blockSize aligned
-						dcassert(b % aBlockSize == 0);
-						dcassert(e % aBlockSize == 0 || e == size);
-
-						neededParts.emplace_back(b, e - b);
-					}
-				}
-			} else {
-				//dcassert(find_if(downloads.begin(), downloads.end(), [&block](const Download* d) { return block.getEnd() == d->getSegment().getEnd(); }) == downloads.end());
-				return block;
+
+		// store all chunks we could need
+		int64_t start = aBlock.getStart();
+		int64_t end = aBlock.getEnd();
+		for(auto j = posArray.begin(); j < posArray.end(); j += 2){
+			if( (*j <= start && start < *(j+1)) || (start <= *j && *j < end) ) {
+				int64_t b = max(start, *j);
+				int64_t e = min(end, *(j+1));
+
+				// segment must be blockSize aligned
+				dcassert(b % aBlockSize == 0);
+				dcassert(e % aBlockSize == 0 || e == size);
+
+				neededParts.emplace_back(b, e - b);
 			}
 		}
-		
-		if(overlaps && (curSize > aBlockSize)) {
-			curSize -= aBlockSize;
-		} else {
-			start = end;
-			curSize = targetSize;
-		}
+
+		return true;
+	});
+
+	if(selected.getSize() > 0) {
+		return selected;
 	}
 
 	if(!neededParts.empty()) {
@@ -459,6 +436,57 @@ Segment QueueItem::getNextSegment(int64_t aBlockSize, int64_t wantedSize, int64_
 	return checkOverlaps(aBlockSize, lastSpeed, partialSource, allowOverlap);
 }
 
+void QueueItem::findFreeBlocks(const SegmentMap& aDone, const SegmentMap& aRunning, int64_t aFileSize, int64_t aBlockSize, int64_t aTargetSize, const BlockHandler& aHandler) noexcept {
+	dcassert(aTargetSize >= aBlockSize && aTargetSize % aBlockSize == 0);
+
+	int64_t start = 0;
+	while(start < aFileSize) {
+		int64_t blockEnd = std::min(aFileSize, start + aBlockSize);
+
+		auto runningEnd = aRunning.coveredUntil(start);
+		if(runningEnd > start) {
+			// all blocks overlapping the running segment are skipped
+			start += Util::roundUp(runningEnd - start, aBlockSize);
+			continue;
+		}
+
+		int64_t end;
+		auto doneEnd = aDone.coveredUntil(start);
+		if(doneEnd > start) {
+			if(doneEnd >= blockEnd) {
+				// skip the blocks that are fully downloaded
+				start = doneEnd >= aFileSize ? aFileSize : start + Util::roundDown(doneEnd - start, aBlockSize);
+				continue;
+			}
+
+			// partially downloaded block, larger ones would overlap the done segment
+			end = blockEnd;
+		} else {
+			auto next = std::min(aDone.nextCovered(start), aRunning.nextCovered(start));
+			if(next >= std::min(aFileSize, start + aTargetSize)) {
+				end = std::min(aFileSize, start + aTargetSize);
+			} else if(next - start >= aBlockSize) {
+				// shrink the block to end before the next done or running segment
+				end = start + Util::roundDown(next - start, aBlockSize);
+			} else {
+				// the block is only partially downloaded
+				end = blockEnd;
+			}
+		}
+
+		if(end == blockEnd && aRunning.nextCovered(start) < blockEnd) {
+			start = blockEnd;
+			continue;
+		}
+
+		if(!aHandler(Segment(start, end - start))) {
+			return;
+		}
+
+		start = end;
+	}
+}
+
 Segment QueueItem::checkOverlaps(int64_t aBlockSize, int64_t aLastSpeed, const PartialSource::Ptr partialSource, bool allowOverlap) const {
 	if(allowOverlap && !partialSource && bundle && SETTING(OVERLAP_SLOW_SOURCES) && aLastSpeed > 0) {
 		// overlap slow running chunk
@@ -491,21 +519,11 @@ Segment QueueItem::checkOverlaps(int64_t aBlockSize, int64_t aLastSpeed, const P
 }
 
 uint64_t QueueItem::getDownloadedSegments() const {
-	uint64_t total = 0;
-	// count done segments
-	for(auto& i: done) {
-		total += i.getSize();
-	}
-	return total;
+	return done.getLength();
 }
 
 uint64_t QueueItem::getDownloadedBytes() const {
-	uint64_t total = 0;
-
-	// count done segments
-	for(auto& i: done) {
-		total += i.getSize();
-	}
+	uint64_t total = done.getLength();
 
 	// count running segments
 	for(auto d: downloads) {
@@ -522,36 +540,17 @@ void QueueItem::addFinishedSegment(const Segment& segment) {
 #endif
 
 	dcassert(segment.getOverlapped() == false);
-	done.insert(segment);
-
-	// Consolidate segments
-
-	bool added = false;
-	if(done.size() != 1) {
-		for(auto i = ++done.begin() ; i != done.end(); ) {
-			auto prev = i;
-			prev--;
-			if(prev->getEnd() >= i->getStart()) {
-				Segment big(prev->getStart(), i->getEnd() - prev->getStart());
-				auto newBytes = big.getSize() - (*prev == segment ? i->getSize() : prev->getSize()); //minus the part that has been counted before...
-
-				done.erase(prev);
-				done.erase(i++);
-				done.insert(big);
-				if (bundle && !added) {
-					dcdebug("added " I64_FMT " for the bundle (segments merged)\n", newBytes);
-					bundle->addFinishedSegment(newBytes);
-				}
-				added = true;
-			} else {
-				++i;
-			}
-		}
+	if (size <= 0) {
+		// file lists are finished with a segment of their (unknown) size
+		doneUnknownSize = true;
+		return;
 	}
 
-	if (!added && bundle) {
-		dcdebug("added " I64_FMT " for the bundle (no merging)\n", segment.getSize());
-		bundle->addFinishedSegment(segment.getSize());
+	// Consolidated with the existing segments
+	auto newBytes = done.add(segment);
+	if (bundle && newBytes > 0) {
+		dcdebug("added " I64_FMT " for the bundle\n", newBytes);
+		bundle->addFinishedSegment(newBytes);
 	}
 }
 
@@ -559,12 +558,10 @@ bool QueueItem::isNeededPart(const PartsInfo& aPartsInfo, int64_t aBlockSize)
 {
 	dcassert(aPartsInfo.size() % 2 == 0);
 	
-	SegmentConstIter i  = done.begin();
 	for(auto j = aPartsInfo.begin(); j != aPartsInfo.end(); j+=2){
-		while(i != done.end() && (*i).getEnd() <= (*j) * aBlockSize)
-			i++;
-
-		if(i == done.end() || !((*i).getStart() <= (*j) * aBlockSize && (*i).getEnd() >= (*(j+1)) * aBlockSize))
+		int64_t start = static_cast<int64_t>(*j) * aBlockSize;
+		int64_t end = static_cast<int64_t>(*(j+1)) * aBlockSize;
+		if(!done.contains(Segment(start, end - start)))
 			return true;
 	}
 	
@@ -575,11 +572,11 @@ void QueueItem::getPartialInfo(PartsInfo& aPartialInfo, int64_t aBlockSize) cons
 	size_t maxSize = min(done.size() * 2, (size_t)510);
 	aPartialInfo.reserve(maxSize);
 
-	SegmentConstIter i = done.begin();
-	for(; i != done.end() && aPartialInfo.size() < maxSize; i++) {
+	auto i = done.getRanges().begin();
+	for(; i != done.getRanges().end() && aPartialInfo.size() < maxSize; i++) {
 
-		uint16_t s = (uint16_t)((*i).getStart() / aBlockSize);
-		uint16_t e = (uint16_t)(((*i).getEnd() - 1) / aBlockSize + 1);
+		uint16_t s = (uint16_t)(i->first / aBlockSize);
+		uint16_t e = (uint16_t)((i->second - 1) / aBlockSize + 1);
 
 		aPartialInfo.push_back(s);
 		aPartialInfo.push_back(e);
@@ -597,10 +594,7 @@ void QueueItem::getChunksVisualisation(vector<Segment>& running_, vector<Segment
 		downloaded_.emplace_back(d->getStartPos(), d->getPos());
 	}
 
-	done_.reserve(done.size());
-	for(auto& i: done) {
-		done_.push_back(i);
-	}
+	done_ = done.getSegments();
 }
 
 bool QueueItem::hasSegment(const UserPtr& aUser, const OrderedStringSet& onlineHubs, string& lastError, int64_t wantedSize, int64_t lastSpeed, DownloadType aType, bool allowOverlap) {
@@ -745,7 +739,7 @@ void QueueItem::save(OutputStream &f, string tmp, string b32tmp) {
 
 	f.write(LIT("\">\r\n"));
 
-	for(const auto& s: done) {
+	for(const auto& s: done.getSegments()) {
 		f.write(indent);
 		f.write(LIT("\t<Segment Start=\""));
 		f.write(Util::toString(s.getStart()));
@@ -804,6 +798,7 @@ void QueueItem::resetDownloaded() {
 	}
 
 	done.clear();
+	doneUnknownSize = false;
 }
 
 }
@@ -26,6 +26,7 @@
 #include "MerkleTree.h"
 #include "Pointer.h"
 #include "Segment.h"
+#include "SegmentMap.h"
 #include "SettingsManager.h"
 #include "User.h"
 
@@ -167,9 +168,8 @@ public:
 
 	typedef SourceList::const_iterator SourceConstIter;
 
-	typedef set<Segment> SegmentSet;
-	typedef SegmentSet::const_iterator SegmentConstIter;
-	
+	typedef function<bool (const Segment&)> BlockHandler;
+
 	QueueItem(const string& aTarget, int64_t aSize, Priority aPriority, Flags::MaskType aFlag, time_t aAdded, const TTHValue& tth, const string& aTempTarget);
 
 	~QueueItem();
@@ -222,6 +222,12 @@ public:
 	void removeDownload(const string& aToken);
 	void removeDownloads(const UserPtr& aUser);
 	
+	/**
+	 * Walks the blocks that aren't done or running in file order, the handler returns false to stop walking
+	 * Blocks start from aTargetSize and are shrunk in aBlockSize steps until they don't overlap done or running segments
+	 */
+	static void findFreeBlocks(const SegmentMap& aDone, const SegmentMap& aRunning, int64_t aFileSize, int64_t aBlockSize, int64_t aTargetSize, const BlockHandler& aHandler) noexcept;
+
 	/** Next segment that is not done and not being downloaded, zero-sized segment returned if there is none is found */
 	Segment getNextSegment(int64_t blockSize, int64_t wantedSize, int64_t lastSpeed, const PartialSource::Ptr partialSource, bool allowOverlap) const;
 	Segment checkOverlaps(int64_t blockSize, int64_t lastSpeed, const PartialSource::Ptr partialSource, bool allowOverlap) const;
@@ -246,7 +252,7 @@ public:
 	void setTempTarget(const string& aTempTarget) { tempTarget = aTempTarget; }
 
 	GETSET(TTHValue, tthRoot, TTH);
-	GETSET(SegmentSet, done, Done);	
+	const SegmentMap& getDone() const noexcept { return done; }
 	IGETSET(uint64_t, fileBegin, FileBegin, 0);
 	IGETSET(uint64_t, nextPublishingTime, NextPublishingTime, 0);
 	IGETSET(uint8_t, maxSegments, MaxSegments, 1);
@@ -270,6 +276,10 @@ private:
 	SourceList sources;
 	SourceList badSources;
 	string tempTarget;
+	SegmentMap done;
+
+	// file lists don't have a known size
+	bool doneUnknownSize = false;
 
 	void addSource(const HintedUser& aUser);
 	void blockSourceHub(const HintedUser& aUser);
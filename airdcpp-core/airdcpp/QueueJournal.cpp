@@ -0,0 +1,536 @@
+/*
+ * Copyright (C) 2011-2015 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "stdinc.h"
+#include "QueueJournal.h"
+
+#include "ClientManager.h"
+#include "File.h"
+#include "LogManager.h"
+#include "QueueItem.h"
+#include "SharedFileStream.h"
+#include "ZUtils.h"
+
+namespace dcpp {
+
+namespace {
+
+template<typename T>
+void writeInt(string& aBuf, T aValue) noexcept {
+	aBuf.append(reinterpret_cast<const char*>(&aValue), sizeof(T));
+}
+
+void writeString(string& aBuf, const string& aStr) noexcept {
+	writeInt<uint32_t>(aBuf, static_cast<uint32_t>(aStr.size()));
+	aBuf += aStr;
+}
+
+class RecordReader {
+public:
+	RecordReader(const char* aData, size_t aSize) noexcept : data(aData), end(aData + aSize) { }
+
+	template<typename T>
+	T readInt() {
+		T ret;
+		memcpy(&ret, take(sizeof(T)), sizeof(T));
+		return ret;
+	}
+
+	string readString() {
+		auto len = readInt<uint32_t>();
+		return string(take(len), len);
+	}
+
+	const char* take(size_t aLen) {
+		if (static_cast<size_t>(end - data) < aLen) {
+			throw Exception("Truncated record");
+		}
+
+		auto ret = data;
+		data += aLen;
+		return ret;
+	}
+private:
+	const char* data;
+	const char* end;
+};
+
+void writeSource(string& aBuf, const QueueJournal::Source& aSource) noexcept {
+	aBuf.append(reinterpret_cast<const char*>(aSource.cid.data()), CID::SIZE);
+	writeString(aBuf, aSource.nick);
+	writeString(aBuf, aSource.hubHint);
+}
+
+QueueJournal::Source readSource(RecordReader& aReader) {
+	QueueJournal::Source ret;
+	ret.cid = CID(reinterpret_cast<const uint8_t*>(aReader.take(CID::SIZE)));
+	ret.nick = aReader.readString();
+	ret.hubHint = aReader.readString();
+	return ret;
+}
+
+void writeSegment(string& aBuf, const Segment& aSegment) noexcept {
+	writeInt<int64_t>(aBuf, aSegment.getStart());
+	writeInt<int64_t>(aBuf, aSegment.getSize());
+}
+
+Segment readSegment(RecordReader& aReader) {
+	auto start = aReader.readInt<int64_t>();
+	auto size = aReader.readInt<int64_t>();
+	return Segment(start, size);
+}
+
+string serialize(const QueueJournal::Record& aRecord) noexcept {
+	string buf;
+	writeInt<uint8_t>(buf, aRecord.type);
+	writeString(buf, aRecord.target);
+	writeInt<uint32_t>(buf, aRecord.bundle);
+
+	switch (aRecord.type) {
+		case QueueJournal::ITEM_ADDED: {
+			writeInt<int64_t>(buf, aRecord.size);
+			buf.append(reinterpret_cast<const char*>(aRecord.tth.data), TTHValue::BYTES);
+			writeInt<int64_t>(buf, aRecord.added);
+			writeInt<int64_t>(buf, aRecord.finished);
+			writeString(buf, aRecord.lastSource);
+			writeInt<uint8_t>(buf, aRecord.maxSegments);
+			writeInt<int8_t>(buf, static_cast<int8_t>(aRecord.priority));
+			writeInt<uint8_t>(buf, aRecord.autoPriority);
+			writeString(buf, aRecord.tempTarget);
+
+			writeInt<uint32_t>(buf, static_cast<uint32_t>(aRecord.segments.size()));
+			for (const auto& s: aRecord.segments) {
+				writeSegment(buf, s);
+			}
+
+			writeInt<uint32_t>(buf, static_cast<uint32_t>(aRecord.sources.size()));
+			for (const auto& s: aRecord.sources) {
+				writeSource(buf, s);
+			}
+			break;
+		}
+		case QueueJournal::SEGMENT_DONE: {
+			writeString(buf, aRecord.tempTarget);
+			writeSegment(buf, aRecord.segments.front());
+			break;
+		}
+		case QueueJournal::SEGMENTS_RESET: {
+			writeString(buf, aRecord.tempTarget);
+			writeInt<uint32_t>(buf, static_cast<uint32_t>(aRecord.segments.size()));
+			for (const auto& s: aRecord.segments) {
+				writeSegment(buf, s);
+			}
+			break;
+		}
+		case QueueJournal::SOURCE_ADDED: {
+			writeSource(buf, aRecord.sources.front());
+			break;
+		}
+		case QueueJournal::SOURCE_REMOVED: {
+			writeSource(buf, aRecord.sources.front());
+			writeInt<uint32_t>(buf, aRecord.removeReason);
+			break;
+		}
+		case QueueJournal::PRIORITY_CHANGED: {
+			writeInt<int8_t>(buf, static_cast<int8_t>(aRecord.priority));
+			writeInt<uint8_t>(buf, aRecord.autoPriority);
+			break;
+		}
+		default: break;
+	}
+
+	return buf;
+}
+
+QueueJournal::Record deserialize(const char* aData, size_t aSize) {
+	RecordReader reader(aData, aSize);
+
+	QueueJournal::Record r;
+	auto type = reader.readInt<uint8_t>();
+	if (type == 0 || type >= QueueJournal::TYPE_LAST) {
+		throw Exception("Unknown record type");
+	}
+
+	r.type = static_cast<QueueJournal::RecordType>(type);
+	r.target = reader.readString();
+	r.bundle = reader.readInt<uint32_t>();
+
+	switch (r.type) {
+		case QueueJournal::ITEM_ADDED: {
+			r.size = reader.readInt<int64_t>();
+			r.tth = TTHValue(reinterpret_cast<const uint8_t*>(reader.take(TTHValue::BYTES)));
+			r.added = static_cast<time_t>(reader.readInt<int64_t>());
+			r.finished = static_cast<time_t>(reader.readInt<int64_t>());
+			r.lastSource = reader.readString();
+			r.maxSegments = reader.readInt<uint8_t>();
+			r.priority = static_cast<QueueItemBase::Priority>(reader.readInt<int8_t>());
+			r.autoPriority = reader.readInt<uint8_t>() != 0;
+			r.tempTarget = reader.readString();
+
+			auto segments = reader.readInt<uint32_t>();
+			for (uint32_t i = 0; i < segments; ++i) {
+				r.segments.push_back(readSegment(reader));
+			}
+
+			auto sources = reader.readInt<uint32_t>();
+			for (uint32_t i = 0; i < sources; ++i) {
+				r.sources.push_back(readSource(reader));
+			}
+			break;
+		}
+		case QueueJournal::SEGMENT_DONE: {
+			r.tempTarget = reader.readString();
+			r.segments.push_back(readSegment(reader));
+			break;
+		}
+		case QueueJournal::SEGMENTS_RESET: {
+			r.tempTarget = reader.readString();
+
+			auto segments = reader.readInt<uint32_t>();
+			for (uint32_t i = 0; i < segments; ++i) {
+				r.segments.push_back(readSegment(reader));
+			}
+			break;
+		}
+		case QueueJournal::SOURCE_ADDED: {
+			r.sources.push_back(readSource(reader));
+			break;
+		}
+		case QueueJournal::SOURCE_REMOVED: {
+			r.sources.push_back(readSource(reader));
+			r.removeReason = reader.readInt<uint32_t>();
+			break;
+		}
+		case QueueJournal::PRIORITY_CHANGED: {
+			r.priority = static_cast<QueueItemBase::Priority>(reader.readInt<int8_t>());
+			r.autoPriority = reader.readInt<uint8_t>() != 0;
+			break;
+		}
+		default: break;
+	}
+
+	return r;
+}
+
+}
+
+QueueJournal::~QueueJournal() {
+	close();
+}
+
+string QueueJournal::getPath() noexcept {
+	return Util::getPath(Util::PATH_BUNDLES) + "Queue.journal";
+}
+
+size_t QueueJournal::replay(const RecordHandler& aHandler) noexcept {
+	replayedSize = 0;
+
+	string data;
+	try {
+		File f(getPath(), File::READ, File::OPEN, File::BUFFER_SEQUENTIAL);
+		data = f.read();
+	} catch (const FileException&) {
+		// No journal
+		return 0;
+	}
+
+	if (data.size() < sizeof(Header)) {
+		return 0;
+	}
+
+	Header header;
+	memcpy(&header, data.data(), sizeof(Header));
+	if (header.magic != MAGIC || header.version != VERSION) {
+		LogManager::getInstance()->message("The queue journal " + getPath() + " is not supported and it will be discarded", LogMessage::SEV_WARNING);
+		return 0;
+	}
+
+	size_t pos = sizeof(Header), records = 0;
+	while (data.size() - pos >= sizeof(uint32_t) * 2) {
+		uint32_t len, checksum;
+		memcpy(&len, data.data() + pos, sizeof(uint32_t));
+		memcpy(&checksum, data.data() + pos + sizeof(uint32_t), sizeof(uint32_t));
+
+		auto payload = pos + sizeof(uint32_t) * 2;
+		if (data.size() - payload < len) {
+			break;
+		}
+
+		CRC32Filter crc;
+		crc(data.data() + payload, len);
+		if (crc.getValue() != checksum) {
+			break;
+		}
+
+		Record r;
+		try {
+			r = deserialize(data.data() + payload, len);
+		} catch (const Exception&) {
+			break;
+		}
+
+		auto bundle = aHandler(move(r));
+		if (bundle != 0) {
+			// Compacting the replayed records requires saving the bundle
+			FastLock l(pendingCs);
+			bundles.insert(bundle);
+		}
+
+		records++;
+		pos = payload + len;
+	}
+
+	if (pos != data.size()) {
+		LogManager::getInstance()->message("The queue journal " + getPath() + " contains corrupted data (" + Util::toString(data.size() - pos) + " bytes were discarded)", LogMessage::SEV_WARNING);
+	}
+
+	replayedSize = pos;
+	return records;
+}
+
+void QueueJournal::open() noexcept {
+	Lock l(cs);
+	try {
+		file.reset(new File(getPath(), File::WRITE, File::OPEN | File::CREATE, File::BUFFER_SEQUENTIAL));
+		if (replayedSize == 0) {
+			Header header = { MAGIC, VERSION };
+			file->setPos(0);
+			file->write(&header, sizeof(Header));
+		} else {
+			file->setPos(replayedSize);
+		}
+
+		// Drop anything that couldn't be replayed
+		file->setEOF();
+		size = file->getPos();
+		opened = true;
+	} catch (const FileException& e) {
+		LogManager::getInstance()->message(STRING_F(SAVE_FAILED_X, getPath() % e.getError()), LogMessage::SEV_ERROR);
+		file.reset();
+	}
+}
+
+void QueueJournal::close() noexcept {
+	// Stop accepting new records before writing the remaining ones
+	opened = false;
+	flush();
+
+	Lock l(cs);
+	file.reset();
+}
+
+void QueueJournal::itemAdded(const QueueItemPtr& qi) noexcept {
+	if (!opened || !qi->getBundle())
+		return;
+
+	Record r;
+	r.type = ITEM_ADDED;
+	r.size = qi->getSize();
+	r.tth = qi->getTTH();
+	r.added = qi->getTimeAdded();
+	r.maxSegments = qi->getMaxSegments();
+	r.priority = qi->getPriority();
+	r.autoPriority = qi->getAutoPriority();
+
+	if (qi->isSet(QueueItem::FLAG_FINISHED)) {
+		r.finished = qi->getTimeFinished();
+		r.lastSource = qi->getLastSource();
+	} else {
+		r.segments = qi->getDone().getSegments();
+		if (!r.segments.empty()) {
+			r.tempTarget = qi->getTempTarget();
+		}
+
+		for (const auto& s: qi->getSources()) {
+			if (s.isSet(QueueItem::Source::FLAG_PARTIAL))
+				continue;
+
+			const auto& u = s.getUser();
+			r.sources.push_back({ u.user->getCID(), ClientManager::getInstance()->getNick(u.user, u.hint), u.hint });
+		}
+	}
+
+	append(move(r), qi);
+}
+
+void QueueJournal::itemRemoved(const QueueItemPtr& qi) noexcept {
+	if (!opened || !qi->getBundle())
+		return;
+
+	Record r;
+	r.type = ITEM_REMOVED;
+	append(move(r), qi);
+}
+
+void QueueJournal::segmentDone(const QueueItemPtr& qi, const Segment& aSegment) noexcept {
+	if (!opened || !qi->getBundle())
+		return;
+
+	Record r;
+	r.type = SEGMENT_DONE;
+	r.tempTarget = qi->getTempTarget();
+	r.segments.push_back(aSegment);
+	append(move(r), qi);
+}
+
+void QueueJournal::sourceAdded(const QueueItemPtr& qi, const HintedUser& aUser) noexcept {
+	if (!opened || !qi->getBundle())
+		return;
+
+	Record r;
+	r.type = SOURCE_ADDED;
+	r.sources.push_back({ aUser.user->getCID(), ClientManager::getInstance()->getNick(aUser.user, aUser.hint), aUser.hint });
+	append(move(r), qi);
+}
+
+void QueueJournal::priorityChanged(const QueueItemPtr& qi) noexcept {
+	if (!opened || !qi->getBundle())
+		return;
+
+	Record r;
+	r.type = PRIORITY_CHANGED;
+	r.priority = qi->getPriority();
+	r.autoPriority = qi->getAutoPriority();
+	append(move(r), qi);
+}
+
+void QueueJournal::segmentsReset(const QueueItemPtr& qi) noexcept {
+	if (!opened || !qi->getBundle())
+		return;
+
+	Record r;
+	r.type = SEGMENTS_RESET;
+	r.segments = qi->getDone().getSegments();
+	if (!r.segments.empty()) {
+		r.tempTarget = qi->getTempTarget();
+	}
+
+	append(move(r), qi);
+}
+
+void QueueJournal::sourceRemoved(const QueueItemPtr& qi, const UserPtr& aUser, Flags::MaskType aReason) noexcept {
+	if (!opened || !qi->getBundle())
+		return;
+
+	Record r;
+	r.type = SOURCE_REMOVED;
+	r.sources.push_back({ aUser->getCID(), Util::emptyString, Util::emptyString });
+	r.removeReason = static_cast<uint32_t>(aReason);
+	append(move(r), qi);
+}
+
+void QueueJournal::append(Record&& aRecord, const QueueItemPtr& qi) noexcept {
+	aRecord.target = qi->getTarget();
+	aRecord.bundle = qi->getBundle()->getToken();
+	auto payload = serialize(aRecord);
+
+	CRC32Filter crc;
+	crc(payload.data(), payload.size());
+
+	FastLock l(pendingCs);
+	writeInt<uint32_t>(pending, static_cast<uint32_t>(payload.size()));
+	writeInt<uint32_t>(pending, crc.getValue());
+	pending += payload;
+
+	// Set for records containing downloaded segments
+	if (!aRecord.tempTarget.empty()) {
+		pendingFiles.insert(aRecord.tempTarget);
+	}
+
+	bundles.insert(aRecord.bundle);
+}
+
+void QueueJournal::flush() noexcept {
+	auto snapshot = takePending(false);
+
+	// Segments must not be marked as done before their data is on the disk
+	for (const auto& f: snapshot.files) {
+		SharedFileStream::syncFile(f);
+	}
+
+	write(snapshot);
+}
+
+QueueJournal::Snapshot QueueJournal::takePending(bool aCompact) noexcept {
+	Snapshot ret;
+
+	FastLock l(pendingCs);
+	ret.records.swap(pending);
+	ret.files.swap(pendingFiles);
+	if (aCompact) {
+		ret.bundles.swap(bundles);
+	}
+
+	return ret;
+}
+
+void QueueJournal::write(Snapshot& aSnapshot) noexcept {
+	Lock l(cs);
+	writeUnsafe(aSnapshot);
+}
+
+void QueueJournal::writeUnsafe(Snapshot& aSnapshot) noexcept {
+	if (!aSnapshot.records.empty() && file) {
+		try {
+			file->write(aSnapshot.records);
+			size += aSnapshot.records.size();
+		} catch (const FileException& e) {
+			LogManager::getInstance()->message(STRING_F(SAVE_FAILED_X, getPath() % e.getError()), LogMessage::SEV_ERROR);
+
+			// Don't leave a partial record at the tail, the replay would stop there and skip everything appended after it
+			try {
+				file->setPos(size);
+				file->setEOF();
+			} catch (const FileException&) {
+				//...
+			}
+
+			// Retry with the next flush, the records are older than anything that has been appended after taking them
+			// (the bundles must still be saved in full if this was the compaction)
+			FastLock fl(pendingCs);
+			pending.insert(0, aSnapshot.records);
+			pendingFiles.insert(aSnapshot.files.begin(), aSnapshot.files.end());
+			bundles.insert(aSnapshot.bundles.begin(), aSnapshot.bundles.end());
+		}
+	}
+
+	aSnapshot.size = size;
+}
+
+void QueueJournal::compact(Snapshot&& aSnapshot, bool aSaved) noexcept {
+	Lock l(cs);
+	if (file && aSaved && size == aSnapshot.size) {
+		try {
+			// Make sure that the truncation can't be ordered before the earlier writes
+			file->flush();
+
+			file->setPos(sizeof(Header));
+			file->setEOF();
+			size = sizeof(Header);
+			return;
+		} catch (const FileException& e) {
+			LogManager::getInstance()->message(STRING_F(SAVE_FAILED_X, getPath() % e.getError()), LogMessage::SEV_ERROR);
+		}
+	}
+
+	// The bundles must be saved again during the next compaction
+	FastLock fl(pendingCs);
+	bundles.insert(aSnapshot.bundles.begin(), aSnapshot.bundles.end());
+}
+
+} // namespace dcpp
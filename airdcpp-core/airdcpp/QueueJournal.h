@@ -0,0 +1,194 @@
+/*
+ * Copyright (C) 2011-2015 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef DCPLUSPLUS_DCPP_QUEUE_JOURNAL_H
+#define DCPLUSPLUS_DCPP_QUEUE_JOURNAL_H
+
+#include "typedefs.h"
+
+#include "CID.h"
+#include "CriticalSection.h"
+#include "HintedUser.h"
+#include "MerkleTree.h"
+#include "QueueItemBase.h"
+#include "Segment.h"
+
+namespace dcpp {
+
+class File;
+
+/*
+Append-only journal of queue item changes
+
+The bundle XML files act as snapshots and the journal contains the item changes that have been made after them,
+so that a finished segment or a new source doesn't require rewriting the whole bundle file. The journal is replayed
+on top of the loaded bundles on startup. Once it grows large enough, the bundles having records in it are saved
+and the journal is truncated (compaction).
+
+Header: uint32 magic, uint32 version
+Records: uint32 payload size, uint32 CRC32 of the payload, payload starting with the uint8 record type, the target and the uint32 bundle token
+
+Strings are stored as uint32 length followed by the UTF-8 data and integers in the byte order of the host.
+Every change to the journaled item state (including resets and removals) is recorded and the records are replayed
+in order, so replaying records that are already included in the snapshot ends in the same state.
+Replaying stops at the first incomplete or corrupted record (such as a write interrupted by a crash).
+*/
+class QueueJournal : boost::noncopyable {
+public:
+	static const uint32_t MAGIC = 0x4a514441; // "ADQJ"
+	static const uint32_t VERSION = 2;
+
+	// Journals larger than this are compacted when the queue is saved
+	static const int64_t COMPACT_SIZE = 4 * 1024 * 1024;
+
+	enum RecordType : uint8_t {
+		ITEM_ADDED = 1,
+		ITEM_REMOVED,
+		SEGMENT_DONE,
+		SOURCE_ADDED,
+		PRIORITY_CHANGED,
+		SEGMENTS_RESET,
+		SOURCE_REMOVED,
+		TYPE_LAST
+	};
+
+	struct Header {
+		uint32_t magic;
+		uint32_t version;
+	};
+
+	struct Source {
+		CID cid;
+		string nick;
+		string hubHint;
+	};
+
+	// Fields that aren't used by the record type are left to their default values
+	struct Record {
+		RecordType type = TYPE_LAST;
+		string target;
+
+		// Records of other bundles having an item with the same target are ignored
+		QueueToken bundle = 0;
+
+		// ITEM_ADDED
+		int64_t size = 0;
+		TTHValue tth;
+		time_t added = 0;
+		time_t finished = 0;
+		string lastSource;
+		uint8_t maxSegments = 1;
+
+		// ITEM_ADDED, SEGMENT_DONE, SEGMENTS_RESET
+		string tempTarget;
+		vector<Segment> segments;
+
+		// ITEM_ADDED, SOURCE_ADDED, SOURCE_REMOVED
+		vector<Source> sources;
+
+		// SOURCE_REMOVED
+		uint32_t removeReason = 0;
+
+		// ITEM_ADDED, PRIORITY_CHANGED
+		QueueItemBase::Priority priority = QueueItemBase::DEFAULT;
+		bool autoPriority = false;
+	};
+
+	// Records taken from memory for writing
+	struct Snapshot {
+		string records;
+
+		// Downloaded files having segments in the records, they must be synced before writing the records
+		StringSet files;
+
+		// Bundles that must be saved before the journal can be compacted (only set for compaction)
+		QueueTokenSet bundles;
+
+		// Size of the journal after the records were written
+		int64_t size = 0;
+	};
+
+	// Returns the token of the bundle that was modified (or 0 if the record was ignored)
+	typedef function<QueueToken (Record&& aRecord)> RecordHandler;
+
+	QueueJournal() { }
+	~QueueJournal();
+
+	/** Calls the handler for each valid record in the existing journal, returns the number of records */
+	size_t replay(const RecordHandler& aHandler) noexcept;
+
+	/** Starts accepting new records, must be called after replaying the journal */
+	void open() noexcept;
+	void close() noexcept;
+
+	// The records are kept in memory until the journal is flushed
+	void itemAdded(const QueueItemPtr& qi) noexcept;
+	void itemRemoved(const QueueItemPtr& qi) noexcept;
+	void segmentDone(const QueueItemPtr& qi, const Segment& aSegment) noexcept;
+	void sourceAdded(const QueueItemPtr& qi, const HintedUser& aUser) noexcept;
+	void priorityChanged(const QueueItemPtr& qi) noexcept;
+
+	// Records the current downloaded segments of the item (after some of them have been discarded)
+	void segmentsReset(const QueueItemPtr& qi) noexcept;
+	void sourceRemoved(const QueueItemPtr& qi, const UserPtr& aUser, Flags::MaskType aReason) noexcept;
+
+	/**
+	 * Syncs the downloaded files of the pending records and writes the records in the file
+	 * (without syncing the journal to the disk)
+	 */
+	void flush() noexcept;
+
+	/**
+	 * Takes the pending records from memory, aCompact also returns the bundles that must be saved before compacting them
+	 * The snapshots must be written in the order they were taken
+	 */
+	Snapshot takePending(bool aCompact) noexcept;
+
+	/** Writes the records of the snapshot, the files of it must have been synced */
+	void write(Snapshot& aSnapshot) noexcept;
+
+	/** Truncates the journal if all bundles of the snapshot were saved and nothing has been written after it (the file is synced first) */
+	void compact(Snapshot&& aSnapshot, bool aSaved) noexcept;
+
+	int64_t getSize() const noexcept { return size; }
+	static string getPath() noexcept;
+private:
+	void append(Record&& aRecord, const QueueItemPtr& qi) noexcept;
+	void writeUnsafe(Snapshot& aSnapshot) noexcept;
+
+	// Guards the file
+	CriticalSection cs;
+	unique_ptr<File> file;
+	atomic<int64_t> size { 0 };
+
+	// Valid data in the existing journal, everything after it is discarded when opening the file
+	int64_t replayedSize = 0;
+
+	// Guards the pending records, their downloaded files and the bundle set
+	FastCriticalSection pendingCs;
+	string pending;
+	StringSet pendingFiles;
+
+	// Bundles having records in the journal since the previous checkpoint
+	QueueTokenSet bundles;
+	atomic<bool> opened { false };
+};
+
+} // namespace dcpp
+
+#endif // !defined(DCPLUSPLUS_DCPP_QUEUE_JOURNAL_H)
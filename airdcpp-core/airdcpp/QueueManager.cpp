@@ -35,9 +35,11 @@
 #include "ScopedFunctor.h"
 #include "SearchManager.h"
 #include "SearchResult.h"
+#include "SharedFileStream.h"
 #include "ShareManager.h"
 #include "ShareScannerManager.h"
 #include "SimpleXMLReader.h"
+#include "ThrottleManager.h"
 #include "Transfer.h"
 #include "UploadManager.h"
 #include "UserConnection.h"
@@ -91,7 +93,10 @@ void QueueManager::shutdown() noexcept {
 		for_each(bl.begin(), bl.end(), [=](BundlePtr& b) { bundleQueue.removeBundle(b); });
 	}
 
+	SharedFileStream::syncFiles(GET_TICK(), true);
+
 	saveQueue(false);
+	bundleQueue.getJournal().close();
 
 	if (!SETTING(KEEP_LISTS)) {
 		string path = Util::getListPath();
@@ -280,7 +285,7 @@ bool QueueManager::recheckFileImpl(const string& aPath, bool isBundleCheck, int6
 
 	TigerTree tt;
 	bool gotTree = HashManager::getInstance()->getTree(tth, tt);
-	QueueItem::SegmentSet done;
+	SegmentMap done;
 
 	{
 		RLock l(cs);
@@ -340,7 +345,7 @@ bool QueueManager::recheckFileImpl(const string& aPath, bool isBundleCheck, int6
 				q->addFinishedSegment(blockSegment);
 			} else {
 				// undownloaded segments aren't corrupted...
-				if (!blockSegment.inSet(done))
+				if (!done.contains(blockSegment))
 					return;
 
 				dcdebug("Integrity check failed for the block at pos " I64_FMT "\n", pos);
@@ -350,6 +355,11 @@ bool QueueManager::recheckFileImpl(const string& aPath, bool isBundleCheck, int6
 			pos += tt.getBlockSize();
 		});
 
+		// The segments were reset
+		if (q->getBundle()) {
+			q->getBundle()->setDirty();
+			bundleQueue.getJournal().segmentsReset(q);
+		}
 	}
 
 	if (failedBytes > 0) {
@@ -1103,9 +1113,8 @@ bool QueueManager::addSource(QueueItemPtr& qi, const HintedUser& aUser, Flags::M
 	if (!newBundle) {
 		fire(QueueManagerListener::SourcesUpdated(), qi);
 	}
-	if (qi->getBundle()) {
-		qi->getBundle()->setDirty();
-	}
+
+	bundleQueue.getJournal().sourceAdded(qi, aUser);
 
 	return wantConnection;
 	
@@ -1134,6 +1143,7 @@ Download* QueueManager::getDownload(UserConnection& aSource, const QueueTokenSet
 					// no other partial chunk from this user, remove him from queue
 					userQueue.removeQI(q, u);
 					q->removeSource(u, QueueItem::Source::FLAG_NO_NEED_PARTS);
+					bundleQueue.getJournal().sourceRemoved(q, u, QueueItem::Source::FLAG_NO_NEED_PARTS);
 					lastError_ = STRING(NO_NEEDED_PART);
 					return nullptr;
 				}
@@ -1148,6 +1158,10 @@ Download* QueueManager::getDownload(UserConnection& aSource, const QueueTokenSet
 			if (!Util::fileExists(q->getTempTarget())) {
 				// Temp target gone?
 				q->resetDownloaded();
+				if (q->getBundle()) {
+					q->getBundle()->setDirty();
+					bundleQueue.getJournal().segmentsReset(q);
+				}
 			}
 		}
 
@@ -1397,6 +1411,9 @@ void QueueManager::moveFinishedFileImpl(const string& source, const string& targ
 	try {
 		File::ensureDirectory(target);
 		UploadManager::getInstance()->abortUpload(source);
+
+		// Don't leave unsynced data behind when the file is moved
+		SharedFileStream::syncFile(source);
 		File::renameFile(source, target);
 		
 		if (SETTING(DCTMP_STORE_DESTINATION) && qi->getBundle() && !qi->getBundle()->isFileBundle() && compare(Util::getFilePath(source), Util::getFilePath(target)) != 0) {
@@ -1738,7 +1755,9 @@ void QueueManager::putDownload(Download* aDownload, bool finished, bool noAccess
 				downloaded -= downloaded % d->getTigerTree().getBlockSize();
 
 				if(downloaded > 0) {
-					q->addFinishedSegment(Segment(d->getStartPos(), downloaded));
+					Segment segment(d->getStartPos(), downloaded);
+					q->addFinishedSegment(segment);
+					bundleQueue.getJournal().segmentDone(q, segment);
 				}
 
 				if (rotateQueue && q->getBundle()) {
@@ -1804,6 +1823,7 @@ void QueueManager::putDownload(Download* aDownload, bool finished, bool noAccess
 			} else if(d->getType() == Transfer::TYPE_FILE) {
 				d->setOverlapped(false);
 				q->addFinishedSegment(d->getSegment());
+				bundleQueue.getJournal().segmentDone(q, d->getSegment());
 				//dcdebug("Finish segment");
 				dcdebug("Finish segment for %s (" I64_FMT ", " I64_FMT ")\n", d->getToken().c_str(), d->getSegment().getStart(), d->getSegment().getEnd());
 
@@ -2019,6 +2039,7 @@ void QueueManager::removeFileSource(QueueItemPtr& q, const UserPtr& aUser, Flags
 
 		if (q->getBundle()) {
 			q->getBundle()->setDirty();
+			bundleQueue.getJournal().sourceRemoved(q, aUser, reason);
 			fire(QueueManagerListener::BundleSources(), q->getBundle());
 		}
 	}
@@ -2124,6 +2145,13 @@ void QueueManager::setBundleAutoPriority(QueueToken aBundleToken) noexcept {
 	setBundleAutoPriority(bundle);
 }
 
+void QueueManager::setBundleDownloadLimit(BundlePtr& aBundle, int aLimit) noexcept {
+	ThrottleManager::getInstance()->setBundleLimit(aBundle->getToken(), aLimit);
+
+	// The limit is saved with the bundle
+	aBundle->setDirty();
+}
+
 void QueueManager::setBundleAutoPriority(BundlePtr& aBundle) noexcept {
 	if (aBundle->isFinished())
 		return;
@@ -2222,11 +2250,11 @@ void QueueManager::setQIPriority(QueueItemPtr& q, QueueItemBase::Priority p, boo
 				q->setAutoPriority(false);
 
 			userQueue.setQIPriority(q, p);
+			bundleQueue.getJournal().priorityChanged(q);
 			fire(QueueManagerListener::StatusUpdated(), q);
 		}
 	}
 
-	b->setDirty();
 	if(p == QueueItem::PAUSED && running) {
 		DownloadManager::getInstance()->abortDownload(q->getTarget());
 	} else if (p != QueueItemBase::PAUSED) {
@@ -2258,7 +2286,7 @@ void QueueManager::setQIAutoPriority(const string& aTarget) noexcept {
 	q->setAutoPriority(!q->getAutoPriority());
 	fire(QueueManagerListener::StatusUpdated(), q);
 
-	q->getBundle()->setDirty();
+	bundleQueue.getJournal().priorityChanged(q);
 
 	if(q->getAutoPriority()) {
 		if (SETTING(AUTOPRIO_TYPE) == SettingsManager::PRIO_PROGRESS) {
@@ -2325,8 +2353,25 @@ void QueueManager::sendRemovePBD(const HintedUser& aUser, const string& aRemoteT
 }
 
 void QueueManager::saveQueue(bool force) noexcept {
-	RLock l(cs);	
-	bundleQueue.saveQueue(force);
+	// The files are synced and written without holding the queue lock (the saves must not overlap)
+	Lock sl(saveCs);
+
+	BundleQueue::SaveBatch batch;
+	{
+		RLock l(cs);
+		batch = bundleQueue.prepareSave(force);
+	}
+
+	bundleQueue.writeSave(batch);
+
+	{
+		RLock l(cs);
+		bundleQueue.finishSave(batch);
+	}
+
+	if (batch.compact) {
+		bundleQueue.getJournal().compact(move(batch.journal), batch.saved);
+	}
 
 	// Put this here to avoid very many saves tries when disk is full...
 	lastSave = GET_TICK();
@@ -2340,6 +2385,7 @@ public:
 	void endTag(const string& name);
 	void createFile(QueueItemPtr& aQI, bool aAddedByAutoSearch);
 	QueueItemBase::Priority validatePrio(const string& aPrio);
+	void setBundleLimit() noexcept;
 	void resetBundle() {
 		curFile = nullptr;
 		curBundle = nullptr;
@@ -2347,6 +2393,7 @@ public:
 		inBundle = false;
 		inDownloads = false;
 		curToken = 0;
+		downloadLimit = 0;
 		currentFileTarget.clear();
 	}
 private:
@@ -2360,6 +2407,7 @@ private:
 	QueueToken curToken = 0;
 	time_t bundleDate = 0;
 	bool addedByAutosearch = false;
+	int downloadLimit = 0;
 
 	int version;
 	QueueManager* qm;
@@ -2408,6 +2456,15 @@ void QueueManager::loadQueue(function<void (float)> progressF) noexcept {
 		// ...
 	}
 
+	{
+		// Apply the changes that were made after the bundles were last saved
+		WLock l(cs);
+		auto records = bundleQueue.getJournal().replay([this](QueueJournal::Record&& aRecord) { return replayJournalRecord(move(aRecord)); });
+		dcdebug("%d queue journal records replayed\n", static_cast<int>(records));
+	}
+
+	bundleQueue.getJournal().open();
+
 	TimerManager::getInstance()->addListener(this); 
 	SearchManager::getInstance()->addListener(this);
 	ClientManager::getInstance()->addListener(this);
@@ -2444,6 +2501,7 @@ static const string sVersion = "Version";
 static const string sTimeFinished = "TimeFinished";
 static const string sLastSource = "LastSource";
 static const string sAddedByAutoSearch = "AddedByAutoSearch";
+static const string sDownloadLimit = "DownloadLimit";
 
 QueueItemBase::Priority QueueLoader::validatePrio(const string& aPrio) {
 	int prio = Util::toInt(aPrio);
@@ -2458,6 +2516,14 @@ QueueItemBase::Priority QueueLoader::validatePrio(const string& aPrio) {
 	return static_cast<QueueItemBase::Priority>(prio);
 }
 
+void QueueLoader::setBundleLimit() noexcept {
+	if (downloadLimit > 0 && downloadLimit <= ThrottleManager::MAX_LIMIT) {
+		ThrottleManager::getInstance()->setBundleLimit(curBundle->getToken(), downloadLimit);
+	}
+
+	downloadLimit = 0;
+}
+
 void QueueLoader::createFile(QueueItemPtr& aQI, bool aAddedByAutosearch) {
 	if (ConnectionManager::getInstance()->tokens.addToken(Util::toString(curToken), CONNECTION_TYPE_DOWNLOAD)) {
 		curBundle = new Bundle(aQI, bundleDate, curToken, false);
@@ -2476,6 +2542,7 @@ void QueueLoader::startTag(const string& name, StringPairList& attribs, bool sim
 		curToken = Util::toUInt32(getAttrib(attribs, sToken, 1));
 		bundleDate = Util::toInt64(getAttrib(attribs, sDate, 2));
 		addedByAutosearch = Util::toBool(Util::toInt(getAttrib(attribs, sAddedByAutoSearch, 3)));
+		downloadLimit = Util::toInt(getAttrib(attribs, sDownloadLimit, 4));
 		inFile = true;
 		version = Util::toInt(getAttrib(attribs, sVersion, 0));
 		if (version == 0 || version > Util::toInt(FILE_BUNDLE_VERSION))
@@ -2494,6 +2561,7 @@ void QueueLoader::startTag(const string& name, StringPairList& attribs, bool sim
 		time_t dirDate = static_cast<time_t>(Util::toInt64(getAttrib(attribs, sDate, 3)));
 		bool b_autoSearch = Util::toBool(Util::toInt(getAttrib(attribs, sAddedByAutoSearch, 4)));
 		const string& prio = getAttrib(attribs, sPriority, 4);
+		downloadLimit = Util::toInt(getAttrib(attribs, sDownloadLimit, 6));
 		if(added == 0) {
 			added = GET_TIME();
 		}
@@ -2650,6 +2718,7 @@ void QueueLoader::endTag(const string& name) {
 			if (curBundle->getQueueItems().empty() && curBundle->getFinishedFiles().empty()) {
 				throw Exception(STRING_F(NO_FILES_WERE_LOADED, curBundle->getTarget()));
 			} else {
+				setBundleLimit();
 				qm->addLoadedBundle(curBundle);
 			}
 		} else if(name == sFile) {
@@ -2658,6 +2727,7 @@ void QueueLoader::endTag(const string& name) {
 			if (!curBundle || (curBundle->isEmpty()))
 				throw Exception(STRING(NO_FILES_FROM_FILE));
 
+			setBundleLimit();
 			qm->addLoadedBundle(curBundle);
 		} else if(name == sDownload) {
 			if (inDownloads && curBundle && curBundle->isFileBundle()) {
@@ -2862,36 +2932,36 @@ void QueueManager::on(ClientManagerListener::UserDisconnected, const UserPtr& aU
 }
 
 void QueueManager::on(TimerManagerListener::Second, uint64_t aTick) noexcept {
-	if((lastSave + 10000) < aTick) {
-		saveQueue(false);
+	// The pending segments can't be saved before their files are synced so there's no point to save more often than that
+	if ((lastSave + max<uint64_t>(10000, max(SETTING(DOWNLOAD_SYNC_INTERVAL), 0) * 1000)) < aTick) {
+		lastSave = aTick;
+		tasks.addTask([=] { saveQueue(false); });
 	}
 
+	// Sync the written files to the disk in batches
+	tasks.addTask([=] { SharedFileStream::syncFiles(aTick, false); });
+
 	vector<pair<QueueItemPtr, QueueItemBase::Priority>> qiPriorities;
 	vector<pair<BundlePtr, QueueItemBase::Priority>> bundlePriorities;
+	QueueItemList stoppedItems;
 	auto prioType = SETTING(AUTOPRIO_TYPE);
 	bool calculate = lastAutoPrio == 0 || (aTick >= lastAutoPrio + (SETTING(AUTOPRIO_INTERVAL)*1000));
 
 	{
 		RLock l(cs);
 
-		// bundles
-		for (auto& b: bundleQueue.getBundles() | map_values) {
-			if (b->isFinished()) {
+		// Only the running items and their bundles can have progressed
+		Bundle::TokenBundleMap runningBundles;
+		for (auto& q : userQueue.getRunningItems() | map_values) {
+			if (!q->isRunning()) {
+				stoppedItems.push_back(q);
 				continue;
 			}
 
-			if (calculate && prioType == SettingsManager::PRIO_PROGRESS && b->getAutoPriority()) {
-				auto p2 = b->calculateProgressPriority();
-				if(b->getPriority() != p2) {
-					bundlePriorities.emplace_back(b, p2);
-				}
+			auto b = q->getBundle();
+			if (b) {
+				runningBundles.emplace(b->getToken(), b);
 			}
-		}
-		
-		// queueitems
-		for (auto& q : fileQueue.getPathQueue() | map_values) {
-			if (!q->isRunning())
-				continue;
 
 			fire(QueueManagerListener::StatusUpdated(), q);
 			if (calculate && SETTING(QI_AUTOPRIO) && prioType == SettingsManager::PRIO_PROGRESS && q->getAutoPriority() && q->getBundle() && !q->getBundle()->isFileBundle()) {
@@ -2903,6 +2973,30 @@ void QueueManager::on(TimerManagerListener::Second, uint64_t aTick) noexcept {
 				}
 			}
 		}
+
+		// bundles
+		for (auto& b: runningBundles | map_values) {
+			if (b->isFinished()) {
+				continue;
+			}
+
+			if (calculate && prioType == SettingsManager::PRIO_PROGRESS && b->getAutoPriority()) {
+				auto p2 = b->calculateProgressPriority();
+				if(b->getPriority() != p2) {
+					bundlePriorities.emplace_back(b, p2);
+				}
+			}
+		}
+	}
+
+	if (!stoppedItems.empty()) {
+		WLock l(cs);
+		for (const auto& q: stoppedItems) {
+			// A new download may have been started meanwhile
+			if (!q->isRunning()) {
+				userQueue.removeRunning(q);
+			}
+		}
 	}
 
 	if (calculate && prioType != SettingsManager::PRIO_DISABLED) {
@@ -3360,6 +3454,173 @@ void QueueManager::addLoadedBundle(BundlePtr& aBundle) noexcept {
 	bundleQueue.addBundle(aBundle);
 }
 
+QueueToken QueueManager::replayJournalRecord(QueueJournal::Record&& aRecord) noexcept {
+	auto qi = fileQueue.findFile(aRecord.target);
+
+	auto removeItem = [this](QueueItemPtr& q) {
+		if (!q->isFinished()) {
+			userQueue.removeQI(q);
+		}
+
+		fileQueue.remove(q);
+		bundleQueue.removeBundleItem(q, false);
+	};
+
+	auto addSource = [this](QueueItemPtr& q, const QueueJournal::Source& aSource) {
+		auto cm = ClientManager::getInstance();
+		auto user = cm->getUser(aSource.cid);
+
+		try {
+			WLock l(cm->getCS());
+			cm->addOfflineUser(user, aSource.nick, aSource.hubHint);
+			// The source was accepted when the record was written
+			QueueManager::addSource(q, HintedUser(user, aSource.hubHint), QueueItem::Source::FLAG_MASK, true, false);
+		} catch (const Exception&) {
+			// ...
+		}
+	};
+
+	if (aRecord.type == QueueJournal::ITEM_ADDED) {
+		auto bundle = bundleQueue.findBundle(aRecord.bundle);
+		if (!bundle) {
+			// Removed or it was never saved
+			return 0;
+		}
+
+		auto finished = aRecord.finished > 0;
+		if (finished) {
+			if (!Util::fileExists(aRecord.target)) {
+				// Not moved to the target before exiting, keep the current state
+				return 0;
+			}
+
+			if (qi && qi->getBundle() == bundle) {
+				if (!qi->isFinished()) {
+					// Finish the existing item in the same way as a completed download
+					userQueue.removeQI(qi);
+					qi->addFinishedSegment(Segment(0, qi->getSize()));
+					qi->setTimeFinished(aRecord.finished);
+					qi->setLastSource(aRecord.lastSource);
+					qi->setFlag(QueueItem::FLAG_FINISHED | QueueItem::FLAG_MOVED);
+
+					bundleQueue.removeBundleItem(qi, true);
+					fileQueue.decreaseSize(qi->getSize());
+					if (bundle->getQueueItems().empty()) {
+						bundleQueue.removeSearchPrio(bundle);
+					}
+				}
+
+				return bundle->getToken();
+			}
+		}
+
+		if (qi && qi->getBundle()) {
+			// The record contains the full state of the item
+			removeItem(qi);
+		}
+
+		auto p = aRecord.autoPriority || finished ? QueueItemBase::DEFAULT : aRecord.priority;
+		auto ret = fileQueue.add(aRecord.target, aRecord.size, finished ? QueueItem::FLAG_FINISHED | QueueItem::FLAG_MOVED : 0, p, aRecord.tempTarget, aRecord.added, aRecord.tth);
+		if (!ret.second) {
+			return 0;
+		}
+
+		qi = ret.first;
+		if (finished) {
+			qi->addFinishedSegment(Segment(0, qi->getSize()));
+			qi->setTimeFinished(aRecord.finished);
+			qi->setLastSource(aRecord.lastSource);
+		} else {
+			qi->setMaxSegments(max((uint8_t)1, aRecord.maxSegments));
+			for (const auto& segment: aRecord.segments) {
+				if (segment.getSize() > 0 && segment.getStart() >= 0 && segment.getEnd() <= qi->getSize()) {
+					qi->addFinishedSegment(segment);
+				}
+			}
+		}
+
+		bundleQueue.addBundleItem(qi, bundle);
+		for (const auto& source: aRecord.sources) {
+			addSource(qi, source);
+		}
+
+		return bundle->getToken();
+	}
+
+	if (!qi || !qi->getBundle()) {
+		return 0;
+	}
+
+	auto token = qi->getBundle()->getToken();
+	if (token != aRecord.bundle) {
+		// A removed item of another bundle had the same target
+		return 0;
+	}
+
+	if (aRecord.type == QueueJournal::ITEM_REMOVED) {
+		removeItem(qi);
+		return token;
+	}
+
+	if (qi->isFinished()) {
+		return 0;
+	}
+
+	switch (aRecord.type) {
+		case QueueJournal::SEGMENT_DONE: {
+			const auto& segment = aRecord.segments.front();
+			if (segment.getSize() <= 0 || segment.getStart() < 0 || segment.getEnd() > qi->getSize()) {
+				return 0;
+			}
+
+			if (qi->getDone().empty() && !aRecord.tempTarget.empty()) {
+				// Not saved in the bundle file yet
+				qi->setTempTarget(aRecord.tempTarget);
+			}
+
+			qi->addFinishedSegment(segment);
+			break;
+		}
+		case QueueJournal::SEGMENTS_RESET: {
+			qi->resetDownloaded();
+			if (!aRecord.tempTarget.empty()) {
+				qi->setTempTarget(aRecord.tempTarget);
+			}
+
+			for (const auto& segment: aRecord.segments) {
+				if (segment.getSize() > 0 && segment.getStart() >= 0 && segment.getEnd() <= qi->getSize()) {
+					qi->addFinishedSegment(segment);
+				}
+			}
+			break;
+		}
+		case QueueJournal::SOURCE_ADDED: {
+			addSource(qi, aRecord.sources.front());
+			break;
+		}
+		case QueueJournal::SOURCE_REMOVED: {
+			auto user = ClientManager::getInstance()->findUser(aRecord.sources.front().cid);
+			if (!user || !qi->isSource(user)) {
+				return 0;
+			}
+
+			userQueue.removeQI(qi, user, false, aRecord.removeReason);
+			qi->removeSource(user, aRecord.removeReason);
+			break;
+		}
+		case QueueJournal::PRIORITY_CHANGED: {
+			qi->setAutoPriority(aRecord.autoPriority);
+			if (qi->getPriority() != aRecord.priority) {
+				userQueue.setQIPriority(qi, aRecord.priority);
+			}
+			break;
+		}
+		default: return 0;
+	}
+
+	return token;
+}
+
 bool QueueManager::addBundle(BundlePtr& aBundle, const string& aTarget, int itemsAdded) noexcept {
 	if (aBundle->getQueueItems().empty() && itemsAdded > 0) {
 		// it finished already? (only 0 byte files were added)
@@ -3842,6 +4103,7 @@ void QueueManager::removeBundle(BundlePtr& aBundle, bool removeFinishedFiles) no
 	StringList deleteFiles;
 
 	DownloadManager::getInstance()->disconnectBundle(aBundle);
+	ThrottleManager::getInstance()->setBundleLimit(aBundle->getToken(), 0);
 	fire(QueueManagerListener::BundleRemoved(), aBundle);
 
 	{
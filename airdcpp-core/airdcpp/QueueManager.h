@@ -199,6 +199,9 @@ public:
 
 	// Force will force bundle to be saved even when it's not dirty (not recommended as it may take a long time with huge queues)
 	void saveQueue(bool force) noexcept;
+
+	// Called by the bundle when it has been modified
+	void onBundleDirty(const BundlePtr& aBundle) noexcept { bundleQueue.addDirty(aBundle); }
 	void shutdown() noexcept;
 
 	void noDeleteFileList(const string& path) noexcept;
@@ -275,6 +278,9 @@ public:
 	// Use DEFAULT priority to enable auto priority
 	void setBundlePriority(BundlePtr& aBundle, QueueItemBase::Priority p, bool aKeepAutoPrio=false) noexcept;
 
+	// Set the download speed limit (KiB/s) for the bundle, zero removes the limit
+	void setBundleDownloadLimit(BundlePtr& aBundle, int aLimit) noexcept;
+
 	// Toggle autoprio state for the bundle
 	void setBundleAutoPriority(QueueToken aBundleToken) noexcept;
 	void setBundleAutoPriority(BundlePtr& aBundle) noexcept;
@@ -368,6 +374,9 @@ private:
 	
 	mutable SharedMutex cs;
 
+	// Serializes the queue saves
+	CriticalSection saveCs;
+
 	Socket udp;
 
 	/** QueueItems by target and TTH */
@@ -394,6 +403,8 @@ private:
 	void removeBundleItem(QueueItemPtr& qi, bool finished) noexcept;
 	void moveBundleItem(QueueItemPtr qi, BundlePtr& targetBundle) noexcept; //don't use reference here!
 	void addLoadedBundle(BundlePtr& aBundle) noexcept;
+	// Returns the token of the modified bundle
+	QueueToken replayJournalRecord(QueueJournal::Record&& aRecord) noexcept;
 	bool addBundle(BundlePtr& aBundle, const string& aTarget, int filesAdded) noexcept;
 	void readdBundle(BundlePtr& aBundle) noexcept;
 	void removeBundleLists(BundlePtr& aBundle) noexcept;
@@ -78,7 +78,7 @@ bool DirSFVReader::isCrcValid(const string& fileName) const {
 	auto p = content.find(fileName);
 	if (p != content.end()) {
 		CRC32Filter crc32;
-		FileReader(true).read(path + fileName, [&](const void* x, size_t n) {
+		FileReader(FileReader::IO_URING).read(path + fileName, [&](const void* x, size_t n) {
 			return crc32(x, n), true;
 		});
 		return crc32.getValue() == p->second;
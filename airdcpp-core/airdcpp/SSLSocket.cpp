@@ -24,6 +24,7 @@
 #include "ResourceManager.h"
 #include "format.h"
 #include "StringTokenizer.h"
+#include "TimerManager.h"
 
 #include <openssl/err.h>
 
@@ -47,15 +48,11 @@ bool SSLSocket::waitConnected(uint64_t millis) {
 		if(!Socket::waitConnected(millis)) {
 			return false;
 		}
-		ssl.reset(SSL_new(ctx));
-		if(!ssl)
-			checkSSL(-1);
 
-		if(!verifyData) {
-			SSL_set_verify(ssl, SSL_VERIFY_NONE, NULL);
-		} else SSL_set_ex_data(ssl, CryptoManager::idxVerifyData, verifyData.get());
-
-		checkSSL(SSL_set_fd(ssl, static_cast<int>(getSock())));
+		initSSL();
+		if(!ssl->server && !sessionKeyprint.empty()) {
+			CryptoManager::getInstance()->resumeSession(ssl, sessionKeyprint);
+		}
 	}
 
 	if(SSL_is_init_finished(ssl)) {
@@ -66,9 +63,10 @@ bool SSLSocket::waitConnected(uint64_t millis) {
 		int ret = ssl->server?SSL_accept(ssl):SSL_connect(ssl);
 		if(ret == 1) {
 			dcdebug("Connected to SSL server using %s as %s\n", SSL_get_cipher(ssl), ssl->server?"server":"client");
+			onHandshakeCompleted();
 			return true;
 		}
-		if(!waitWant(ret, millis)) {
+		if(!waitHandshake(ret, millis)) {
 			return false;
 		}
 	}
@@ -87,15 +85,8 @@ bool SSLSocket::waitAccepted(uint64_t millis) {
 		if(!Socket::waitAccepted(millis)) {
 			return false;
 		}
-		ssl.reset(SSL_new(ctx));
-		if(!ssl)
-			checkSSL(-1);
-
-		if(!verifyData) {
-			SSL_set_verify(ssl, SSL_VERIFY_NONE, NULL);
-		} else SSL_set_ex_data(ssl, CryptoManager::idxVerifyData, verifyData.get());
 
-		checkSSL(SSL_set_fd(ssl, static_cast<int>(getSock())));
+		initSSL();
 	}
 
 	if(SSL_is_init_finished(ssl)) {
@@ -106,14 +97,56 @@ bool SSLSocket::waitAccepted(uint64_t millis) {
 		int ret = SSL_accept(ssl);
 		if(ret == 1) {
 			dcdebug("Connected to SSL client using %s\n", SSL_get_cipher(ssl));
+			onHandshakeCompleted();
 			return true;
 		}
-		if(!waitWant(ret, millis)) {
+		if(!waitHandshake(ret, millis)) {
 			return false;
 		}
 	}
 }
 
+void SSLSocket::initSSL() {
+	ssl.reset(SSL_new(ctx));
+	if(!ssl)
+		checkSSL(-1);
+
+	if(!verifyData) {
+		SSL_set_verify(ssl, SSL_VERIFY_NONE, NULL);
+	} else {
+		SSL_set_ex_data(ssl, CryptoManager::idxVerifyData, verifyData.get());
+
+		// Sessions can only be resumed with peers that have been verified by their keyprint
+		if(verifyData->second.compare(0, 7, "SHA256/") == 0)
+			sessionKeyprint = verifyData->second;
+	}
+
+	checkSSL(SSL_set_fd(ssl, static_cast<int>(getSock())));
+	handshakeStart = GET_TICK();
+}
+
+bool SSLSocket::waitHandshake(int ret, uint64_t millis) {
+	try {
+		return waitWant(ret, millis);
+	} catch(const SocketException&) {
+		CryptoManager::getInstance()->onHandshakeFailed();
+		if(!sessionKeyprint.empty()) {
+			// Don't try to resume a session that the peer may not accept
+			CryptoManager::getInstance()->removeSession(sessionKeyprint);
+		}
+		throw;
+	}
+}
+
+void SSLSocket::onHandshakeCompleted() noexcept {
+	bool resumed = SSL_session_reused(ssl) ? true : false;
+	CryptoManager::getInstance()->onHandshake(resumed, GET_TICK() - handshakeStart);
+
+	if(!ssl->server && !sessionKeyprint.empty() && SSL_get_verify_result(ssl) == X509_V_OK) {
+		CryptoManager::getInstance()->saveSession(ssl, sessionKeyprint);
+	}
+}
+
 bool SSLSocket::waitWant(int ret, uint64_t millis) {
 	int err = SSL_get_error(ssl, ret);
 	switch(err) {
@@ -54,6 +54,9 @@ public:
 	virtual void connect(const Socket::AddressInfo& aIp, const string& aPort);
 	virtual int read(void* aBuffer, int aBufLen);
 	virtual int write(const void* aBuffer, int aLen);
+
+	// Kernel TLS isn't available with our OpenSSL version
+	virtual bool canSendFile() const noexcept { return false; }
 	virtual std::pair<bool, bool> wait(uint64_t millis, bool checkRead, bool checkWrite);
 	virtual void shutdown() noexcept;
 	virtual void close() noexcept;
@@ -75,8 +78,16 @@ private:
 
 	unique_ptr<CryptoManager::SSLVerifyData> verifyData;	// application data used by CryptoManager::verify_callback(...)
 
+	// Expected keyprint of the peer that the client session is cached with (empty if the session shouldn't be cached)
+	string sessionKeyprint;
+	uint64_t handshakeStart = 0;
+
+	void initSSL();
+	void onHandshakeCompleted() noexcept;
+
 	int checkSSL(int ret);
 	bool waitWant(int ret, uint64_t millis);
+	bool waitHandshake(int ret, uint64_t millis);
 };
 
 } // namespace dcpp
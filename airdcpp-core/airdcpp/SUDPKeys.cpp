@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2011-2015 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "stdinc.h"
+#include "SUDPKeys.h"
+
+#include "Encoder.h"
+
+#include <openssl/rand.h>
+
+namespace dcpp {
+
+string SUDPKeys::addKey(uint64_t aTick) noexcept {
+	uint8_t key[BLOCK_SIZE];
+	RAND_bytes(key, BLOCK_SIZE);
+
+	Key k;
+	AES_set_decrypt_key(key, 128, &k.decryptKey);
+	k.added = aTick;
+
+	{
+		WLock l(cs);
+		k.id = nextId++;
+		keys.push_back(k);
+	}
+
+	return Encoder::toBase32(key, BLOCK_SIZE);
+}
+
+void SUDPKeys::removeExpired(uint64_t aTick) noexcept {
+	WLock l(cs);
+	auto i = find_if(keys.begin(), keys.end(), [=](const Key& k) { return k.added >= aTick; });
+	keys.erase(keys.begin(), i);
+}
+
+size_t SUDPKeys::size() const noexcept {
+	RLock l(cs);
+	return keys.size();
+}
+
+bool SUDPKeys::isCommandStart(const uint8_t* aBlock) noexcept {
+	// ADC command type and FOURCC followed by a separator
+	return isupper(aBlock[0]) && isalnum(aBlock[1]) && isalnum(aBlock[2]) && isalnum(aBlock[3]) && (aBlock[4] == ' ' || aBlock[4] == '\n');
+}
+
+bool SUDPKeys::decrypt(const Key& aKey, const uint8_t* aBuf, size_t aLen, string& x_) noexcept {
+	// CBC: the second plaintext block is the decrypted block XOR the previous cipher block
+	uint8_t block[BLOCK_SIZE];
+	AES_decrypt(aBuf + BLOCK_SIZE, block, &aKey.decryptKey);
+	for (size_t i = 0; i < BLOCK_SIZE; ++i) {
+		block[i] ^= aBuf[i];
+	}
+
+	if (!isCommandStart(block)) {
+		return false;
+	}
+
+	// Decrypt everything after the random block, the first cipher block acts as the IV
+	uint8_t iv[BLOCK_SIZE];
+	memcpy(iv, aBuf, BLOCK_SIZE);
+
+	x_.resize(aLen - BLOCK_SIZE);
+	AES_cbc_encrypt(aBuf + BLOCK_SIZE, (uint8_t*)&x_[0], x_.size(), &aKey.decryptKey, iv, AES_DECRYPT);
+
+	// Validate and remove the PKCS#5 padding
+	size_t padLen = (uint8_t)x_.back();
+	if (padLen < 1 || padLen > BLOCK_SIZE || count(x_.end() - padLen, x_.end(), (char)padLen) != (ptrdiff_t)padLen) {
+		return false;
+	}
+
+	x_.resize(x_.size() - padLen);
+	return true;
+}
+
+bool SUDPKeys::decrypt(const uint8_t* aBuf, size_t aLen, string& x_) const noexcept {
+	if (aLen < 2 * BLOCK_SIZE || (aLen % BLOCK_SIZE) != 0) {
+		return false;
+	}
+
+	RLock l(cs);
+
+	auto last = lastMatch.load(std::memory_order_relaxed);
+	auto lastKey = lower_bound(keys.begin(), keys.end(), last, [](const Key& k, uint64_t aId) { return k.id < aId; });
+	if (lastKey != keys.end() && lastKey->id == last && decrypt(*lastKey, aBuf, aLen, x_)) {
+		return true;
+	}
+
+	// Most results are for the latest searches
+	for (const auto& k: keys | reversed) {
+		if (k.id != last && decrypt(k, aBuf, aLen, x_)) {
+			lastMatch.store(k.id, std::memory_order_relaxed);
+			return true;
+		}
+	}
+
+	x_.clear();
+	return false;
+}
+
+bool SUDPKeys::encrypt(string& aCmd_, const string& aKey) noexcept {
+	if (aKey.empty() || !Encoder::isBase32(aKey.c_str())) {
+		return false;
+	}
+
+	uint8_t keyChar[BLOCK_SIZE];
+	Encoder::fromBase32(aKey.c_str(), keyChar, BLOCK_SIZE);
+
+	uint8_t ivd[BLOCK_SIZE] = { };
+
+	// prepend 16 random bytes to message
+	RAND_bytes(ivd, BLOCK_SIZE);
+	aCmd_.insert(0, (char*)ivd, BLOCK_SIZE);
+
+	// use PKCS#5 padding to align the message length to the cypher block size (16)
+	uint8_t pad = BLOCK_SIZE - (aCmd_.length() % BLOCK_SIZE);
+	aCmd_.append(pad, (char)pad);
+
+	// encrypt it (in place)
+	memset(ivd, 0, BLOCK_SIZE);
+
+	AES_KEY key;
+	AES_set_encrypt_key(keyChar, 128, &key);
+	AES_cbc_encrypt((uint8_t*)&aCmd_[0], (uint8_t*)&aCmd_[0], aCmd_.length(), &key, ivd, AES_ENCRYPT);
+	return true;
+}
+
+} // namespace dcpp
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2011-2015 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef DCPLUSPLUS_DCPP_SUDP_KEYS_H
+#define DCPLUSPLUS_DCPP_SUDP_KEYS_H
+
+#include "typedefs.h"
+#include "CriticalSection.h"
+
+#include <openssl/aes.h>
+
+#include <boost/noncopyable.hpp>
+
+namespace dcpp {
+
+/**
+ * AES keys of the outgoing searches used for decrypting SUDP (encrypted UDP) search results.
+ *
+ * The packets don't identify the key that was used for encrypting them. Instead of decrypting the
+ * whole packet with each key, only the second cipher block (the start of the command, the first block
+ * is random) is decrypted with the expanded key schedules that are kept for each search. Results
+ * usually arrive in bursts for the same search so the previously matched key is tried first.
+ */
+class SUDPKeys : boost::noncopyable {
+public:
+	/** Generates a new key, returns it encoded in base32 */
+	string addKey(uint64_t aTick) noexcept;
+
+	/** Removes the keys that were added before the given time */
+	void removeExpired(uint64_t aTick) noexcept;
+
+	/** Decrypts the packet to x_ if it was encrypted with any of the stored keys */
+	bool decrypt(const uint8_t* aBuf, size_t aLen, string& x_) const noexcept;
+
+	/** Encrypts a command with the key from a search (encoded in base32) */
+	static bool encrypt(string& aCmd_, const string& aKey) noexcept;
+
+	size_t size() const noexcept;
+private:
+	static const size_t BLOCK_SIZE = 16;
+
+	struct Key {
+		AES_KEY decryptKey;
+		uint64_t added;
+		uint64_t id;
+	};
+
+	static bool isCommandStart(const uint8_t* aBlock) noexcept;
+	static bool decrypt(const Key& aKey, const uint8_t* aBuf, size_t aLen, string& x_) noexcept;
+
+	// Ordered by the time when the keys were added (the IDs are ascending as well)
+	vector<Key> keys;
+	uint64_t nextId = 1;
+
+	mutable atomic<uint64_t> lastMatch { 0 };
+
+	mutable SharedMutex cs;
+};
+
+} // namespace dcpp
+
+#endif // !defined(DCPLUSPLUS_DCPP_SUDP_KEYS_H)
@@ -30,9 +30,6 @@
 #include "SimpleXML.h"
 #include "StringTokenizer.h"
 
-#include <openssl/evp.h>
-#include <openssl/rand.h>
-
 namespace dcpp {
 
 const char* SearchManager::types[TYPE_LAST] = {
@@ -64,9 +61,6 @@ SearchManager::SearchManager() {
 SearchManager::~SearchManager() {
 	TimerManager::getInstance()->removeListener(this);
 	SettingsManager::getInstance()->removeListener(this);
-
-	for(auto& p: searchKeys) 
-		delete p.first;
 }
 
 string SearchManager::normalizeWhitespace(const string& aString){
@@ -91,13 +85,7 @@ uint64_t SearchManager::search(StringList& who, const string& aName, int64_t aSi
 	string keyStr;
 	if (SETTING(ENABLE_SUDP)) {
 		//generate a random key and store it so we can check the results
-		uint8_t* key = new uint8_t[16];
-		RAND_bytes(key, 16);
-		{
-			WLock l (cs);
-			searchKeys.emplace_back(key, GET_TICK());
-		}
-		keyStr = Encoder::toBase32(key, 16);
+		keyStr = searchKeys.addKey(GET_TICK());
 	}
 
 	auto s = SearchPtr(new Search);
@@ -125,43 +113,8 @@ uint64_t SearchManager::search(StringList& who, const string& aName, int64_t aSi
 	return estimateSearchSpan;
 }
 
-bool SearchManager::decryptPacket(string& x, size_t aLen, uint8_t* buf, size_t bufLen) {
-	RLock l (cs);
-	for(auto& i: searchKeys | reversed) {
-		boost::scoped_array<uint8_t> out(new uint8_t[bufLen]);
-
-		uint8_t ivd[16] = { };
-
-		EVP_CIPHER_CTX ctx;
-		EVP_CIPHER_CTX_init(&ctx);
-
-		int len = 0, tmpLen=0;
-		EVP_DecryptInit_ex(&ctx, EVP_aes_128_cbc(), NULL, i.first, ivd);
-		EVP_DecryptUpdate(&ctx, &out[0], &len, buf, aLen);
-		EVP_DecryptFinal_ex(&ctx, &out[0] + aLen, &tmpLen);
-		EVP_CIPHER_CTX_cleanup(&ctx);
-
-		// Validate padding and replace with 0-bytes.
-		int padlen = out[aLen-1];
-		if(padlen < 1 || padlen > 16) {
-			continue;
-		}
-
-		bool valid = true;
-		for(auto r=0; r<padlen; r++) {
-			if(out[aLen-padlen+r] != padlen) {
-				valid = false;
-				break;
-			} else
-				out[aLen-padlen+r] = 0;
-		}
-
-		if (valid) {
-			x = (char*)&out[0]+16;
-			break;
-		}
-	}
-	return true;
+bool SearchManager::decryptPacket(string& x, size_t aLen, const uint8_t* aBuf) const noexcept {
+	return searchKeys.decrypt(aBuf, aLen, x);
 }
 
 const string& SearchManager::getPort() const { 
@@ -176,6 +129,26 @@ void SearchManager::disconnect() noexcept {
 	udpServer.disconnect();
 }
 
+void SearchManager::shutdown() noexcept {
+	incomingSearches.stop();
+}
+
+void SearchManager::queueIncoming(size_t aKey, IncomingSearchQueue::Callback&& aTask) noexcept {
+	if (!incomingSearches.add(aKey, move(aTask))) {
+		aTask();
+	}
+}
+
+void SearchManager::respondAsync(const AdcCommand& adc, const OnlineUserPtr& aUser, bool isUdpActive, const string& hubIpPort, ProfileToken aProfile) noexcept {
+	queueIncoming(reinterpret_cast<size_t>(aUser->getUser().get()), [=] {
+		if (!aUser->getClient()->isConnected()) {
+			return;
+		}
+
+		respond(adc, *aUser, isUdpActive, hubIpPort, aProfile);
+	});
+}
+
 void SearchManager::onSR(const string& x, const string& aRemoteIP /*Util::emptyString*/) {
 	string::size_type i, j;
 	// Directories: $SR <nick><0x20><directory><0x20><free slots>/<total slots><0x05><Hubname><0x20>(<Hubip:port>)
@@ -318,15 +291,8 @@ void SearchManager::onRES(const AdcCommand& cmd, const UserPtr& from, const stri
 }
 
 void SearchManager::on(TimerManagerListener::Minute, uint64_t aTick) noexcept {
-	WLock l (cs);
-	for (auto i = searchKeys.begin(); i != searchKeys.end();) {
-		if (i->second + 1000*60*15 < aTick) {
-			delete i->first;
-			searchKeys.erase(i);
-			i = searchKeys.begin();
-		} else {
-			++i;
-		}
+	if (aTick > 1000*60*15) {
+		searchKeys.removeExpired(aTick - 1000*60*15);
 	}
 }
 
@@ -21,10 +21,12 @@
 
 #include "AdcCommand.h"
 #include "CriticalSection.h"
+#include "IncomingSearchQueue.h"
 #include "Search.h"
 #include "SearchManagerListener.h"
 #include "SettingsManager.h"
 #include "Singleton.h"
+#include "SUDPKeys.h"
 #include "TimerManager.h"
 #include "UDPServer.h"
 #include "User.h"
@@ -84,6 +86,17 @@ public:
 	
 	void respond(const AdcCommand& cmd, OnlineUser& aUser, bool isUdpActive, const string& hubIpPort, ProfileToken aProfile);
 
+	// Responds to the search from the incoming search pool (searches from the same user are handled in order)
+	void respondAsync(const AdcCommand& cmd, const OnlineUserPtr& aUser, bool isUdpActive, const string& hubIpPort, ProfileToken aProfile) noexcept;
+
+	// Runs the task in the incoming search pool or synchronously if the pool isn't used
+	void queueIncoming(size_t aKey, IncomingSearchQueue::Callback&& aTask) noexcept;
+
+	const IncomingSearchQueue& getIncomingSearches() const noexcept { return incomingSearches; }
+
+	// Stops responding to searches
+	void shutdown() noexcept;
+
 	const string& getPort() const;
 
 	void listen();
@@ -115,9 +128,9 @@ public:
 	void getSearchType(const string& aName, int& type, StringList& extList, bool lock=false);
 	string getNameByExtension(const string& aExtension, bool defaultsOnly = false) const noexcept;
 
-	bool decryptPacket(string& x, size_t aLen, uint8_t* aBuf, size_t bufLen);
+	bool decryptPacket(string& x, size_t aLen, const uint8_t* aBuf) const noexcept;
 private:
-	vector<pair<uint8_t*, uint64_t>> searchKeys;
+	SUDPKeys searchKeys;
 
 	mutable SharedMutex cs;
 
@@ -143,6 +156,7 @@ private:
 	SearchTypesIter getSearchType(const string& name);
 
 	UDPServer udpServer;
+	IncomingSearchQueue incomingSearches;
 };
 
 } // namespace dcpp
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2011-2015 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "stdinc.h"
+#include "SegmentMap.h"
+
+namespace dcpp {
+
+int64_t SegmentMap::add(const Segment& aSegment) noexcept {
+	if (aSegment.getSize() <= 0) {
+		return 0;
+	}
+
+	auto start = aSegment.getStart();
+	auto end = aSegment.getEnd();
+	auto oldLength = length;
+
+	// The first range that may be merged is the one before the segment (if it reaches the start)
+	auto i = ranges.upper_bound(start);
+	if (i != ranges.begin()) {
+		auto prev = std::prev(i);
+		if (prev->second >= start) {
+			i = prev;
+		}
+	}
+
+	while (i != ranges.end() && i->first <= end) {
+		start = min(start, i->first);
+		end = max(end, i->second);
+		length -= i->second - i->first;
+		i = ranges.erase(i);
+	}
+
+	ranges.emplace_hint(i, start, end);
+	length += end - start;
+	return length - oldLength;
+}
+
+void SegmentMap::clear() noexcept {
+	ranges.clear();
+	length = 0;
+}
+
+bool SegmentMap::contains(const Segment& aSegment) const noexcept {
+	auto end = coveredUntil(aSegment.getStart());
+	return end > aSegment.getStart() && end >= aSegment.getEnd();
+}
+
+bool SegmentMap::overlaps(const Segment& aSegment) const noexcept {
+	if (aSegment.getSize() <= 0) {
+		return false;
+	}
+
+	return coveredUntil(aSegment.getStart()) > aSegment.getStart() || nextCovered(aSegment.getStart()) < aSegment.getEnd();
+}
+
+int64_t SegmentMap::coveredUntil(int64_t aPos) const noexcept {
+	auto i = ranges.upper_bound(aPos);
+	if (i == ranges.begin()) {
+		return aPos;
+	}
+
+	--i;
+	return i->second > aPos ? i->second : aPos;
+}
+
+int64_t SegmentMap::nextCovered(int64_t aPos) const noexcept {
+	auto i = ranges.upper_bound(aPos);
+	return i != ranges.end() ? i->first : numeric_limits<int64_t>::max();
+}
+
+vector<Segment> SegmentMap::getSegments() const noexcept {
+	vector<Segment> ret;
+	ret.reserve(ranges.size());
+	for (const auto& r: ranges) {
+		ret.emplace_back(r.first, r.second - r.first);
+	}
+
+	return ret;
+}
+
+} // namespace dcpp
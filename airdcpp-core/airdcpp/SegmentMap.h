@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2011-2015 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef DCPLUSPLUS_DCPP_SEGMENT_MAP_H_
+#define DCPLUSPLUS_DCPP_SEGMENT_MAP_H_
+
+#include "typedefs.h"
+
+#include "GetSet.h"
+#include "Segment.h"
+
+namespace dcpp {
+
+/*
+Set of file ranges (run-length encoded)
+
+Added segments are merged with the ones they overlap or touch, so the ranges are always disjoint and sorted by
+their start position. Position lookups are O(log n) and the total length is kept up to date.
+*/
+class SegmentMap {
+public:
+	typedef map<int64_t, int64_t> RangeMap; // start -> end
+
+	/** Returns the number of bytes that weren't included before */
+	int64_t add(const Segment& aSegment) noexcept;
+	void clear() noexcept;
+
+	bool empty() const noexcept { return ranges.empty(); }
+	size_t size() const noexcept { return ranges.size(); }
+	int64_t getLength() const noexcept { return length; }
+
+	/** Is the segment inside a single range? */
+	bool contains(const Segment& aSegment) const noexcept;
+	bool overlaps(const Segment& aSegment) const noexcept;
+
+	/** Returns the end of the range including the position or aPos if the position isn't included */
+	int64_t coveredUntil(int64_t aPos) const noexcept;
+
+	/** Returns the start of the first range beginning after aPos (or numeric_limits<int64_t>::max() if there isn't one) */
+	int64_t nextCovered(int64_t aPos) const noexcept;
+
+	vector<Segment> getSegments() const noexcept;
+	const RangeMap& getRanges() const noexcept { return ranges; }
+private:
+	RangeMap ranges;
+	int64_t length = 0;
+};
+
+} // namespace dcpp
+
+#endif /*DCPLUSPLUS_DCPP_SEGMENT_MAP_H_*/
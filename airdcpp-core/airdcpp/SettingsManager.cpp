@@ -224,7 +224,8 @@ const string SettingsManager::settingTags[] =
 	"QueueSplitterPosition", "FullListDLLimit", "ASDelayHours", "LastListProfile", "MaxHashingThreads", "HashersPerVolume", "SubtractlistSkip", "BloomMode", "FavUsersSplitterPos", "AwayIdleTime",
 	"SearchHistoryMax", "ExcludeHistoryMax", "DirectoryHistoryMax", "MinDupeCheckSize", "DbCacheSize", "DLAutoDisconnectMode", "RemovedTrees", "RemovedFiles", "MultithreadedRefresh", "MonitoringMode",
 	"MonitoringDelay", "DelayCountMode", "MaxRunningBundles", "DefaultShareProfile", "UpdateChannel", "ColorStatusFinished", "ColorStatusShared", "ProgressLighten",
-	"ConfigBuildNumber", "PmMessageCache", "HubMessageCache", "LogMessageCache",
+	"ConfigBuildNumber", "PmMessageCache", "HubMessageCache", "LogMessageCache", "RefreshThreadsPerVolume", "SocketReactorThreads",
+	"IncomingSearchThreads", "IncomingSearchQueueSize", "DownloadSyncInterval",
 	"SENTRY",
 
 	// Bools
@@ -274,7 +275,7 @@ const string SettingsManager::settingTags[] =
 	"RemoveExpiredAs", "AdcLogGroupCID", "ShareFollowSymlinks", "ScanMonitoredFolders", "FinishedNoHash", "ConfirmFileDeletions", "UseDefaultCertPaths", "StartupRefresh", "DctmpStoreDestination", "FLReportDupeFiles",
 	"FilterFLShared", "FilterFLQueued", "FilterFLInversed", "FilterFLTop", "FilterFLPartialDupes", "FilterFLResetChange", "FilterSearchShared", "FilterSearchQueued", "FilterSearchInversed", "FilterSearchTop", "FilterSearchPartialDupes", "FilterSearchResetChange",
 	"SearchAschOnlyMan", "IgnoreIndirectSR", "UseUploadBundles", "CloseMinimize", "LogIgnored", "UsersFilterIgnore", "NfoExternal", "SingleClickTray", "QueueShowFinished", "RemoveFinishedBundles", "LogCRCOk",
-	"FilterQueueInverse", "FilterQueueTop", "FilterQueueReset", "AlwaysCCPM",
+	"FilterQueueInverse", "FilterQueueTop", "FilterQueueReset", "AlwaysCCPM", "ShareCacheXml", "SocketReactor", "VerifySegments", "ShareSearchIndex",
 	"SENTRY",
 	// Int64
 	"TotalUpload", "TotalDownload",
@@ -412,6 +413,12 @@ SettingsManager::SettingsManager() : connectionRegex("(\\d+(\\.\\d+)?)")
 	setDefault(NO_IP_OVERRIDE6, false);
 	setDefault(SOCKET_IN_BUFFER, 64*1024);
 	setDefault(SOCKET_OUT_BUFFER, 64*1024);
+	setDefault(SOCKET_REACTOR, false);
+	setDefault(SOCKET_REACTOR_THREADS, 2);
+	setDefault(INCOMING_SEARCH_THREADS, 2);
+	setDefault(INCOMING_SEARCH_QUEUE_SIZE, 200);
+	setDefault(DOWNLOAD_SYNC_INTERVAL, 30);
+	setDefault(VERIFY_SEGMENTS, false);
 	setDefault(OPEN_WAITING_USERS, false);
 	setDefault(TLS_TRUSTED_CERTIFICATES_PATH, Util::getPath(Util::PATH_USER_CONFIG) + "Certificates" PATH_SEPARATOR_STR);
 	setDefault(TLS_PRIVATE_KEY_FILE, Util::getPath(Util::PATH_USER_CONFIG) + "Certificates" PATH_SEPARATOR_STR "client.key");
@@ -842,6 +849,8 @@ SettingsManager::SettingsManager() : connectionRegex("(\\d+(\\.\\d+)?)")
 	setDefault(SKIP_EMPTY_DIRS_SHARE, true);
 
 	setDefault(LOG_SHARE_SCANS, false);
+	setDefault(SHARE_CACHE_XML, false);
+	setDefault(SHARE_SEARCH_INDEX, true);
 	setDefault(LOG_SHARE_SCAN_PATH, "Scan Results" + string(PATH_SEPARATOR_STR) + "Scan %Y-%m-%d %H:%M.log");
 
 	setDefault(LAST_FL_FILETYPE, "0");
@@ -852,6 +861,7 @@ SettingsManager::SettingsManager() : connectionRegex("(\\d+(\\.\\d+)?)")
 
 	setDefault(DL_AUTO_DISCONNECT_MODE, QUEUE_FILE);
 	setDefault(REFRESH_THREADING, MULTITHREAD_MANUAL);
+	setDefault(REFRESH_THREADS_PER_VOLUME, 1);
 
 	setDefault(REMOVE_EXPIRED_AS, false);
 
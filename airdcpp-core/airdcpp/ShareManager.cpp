@@ -26,6 +26,7 @@
 #include "FilteredFile.h"
 #include "LogManager.h"
 #include "HashManager.h"
+#include "ParallelBZOutputStream.h"
 #include "QueueManager.h"
 #include "ResourceManager.h"
 #include "ScopedFunctor.h"
@@ -83,6 +84,7 @@ ShareManager::~ShareManager() {
 	SettingsManager::getInstance()->removeListener(this);
 
 	join();
+	for_each(retiredFiles, DeleteFunction());
 }
 
 void ShareManager::startup(function<void(const string&)> splashF, function<void(float)> progressF) noexcept {
@@ -547,7 +549,10 @@ void ShareManager::on(DirectoryMonitorListener::FileRenamed, const string& aOldP
 
 					//rename
 					parent->directories.erase(p);
-					d->realName = DualString(Util::getFileName(aNewPath));
+					{
+						InPlaceUpdate u(*this);
+						d->realName = DualString(Util::getFileName(aNewPath));
+					}
 					parent->directories.insert_sorted(d);
 					parent->updateModifyDate();
 
@@ -571,6 +576,7 @@ void ShareManager::on(DirectoryMonitorListener::FileRenamed, const string& aOldP
 
 						//remove old
 						cleanIndices(*parent, *f);
+						retire(*f);
 						parent->files.erase(f);
 
 						//add new
@@ -684,6 +690,7 @@ bool ShareManager::handleDeletedFile(const string& aPath, bool isDirectory, Prof
 			auto p = parent->directories.find(dirNameLower);
 			if (p != parent->directories.end()) {
 				cleanIndices(**p);
+				retire(*p);
 				parent->directories.erase(p);
 				deleted = true;
 			}
@@ -692,6 +699,7 @@ bool ShareManager::handleDeletedFile(const string& aPath, bool isDirectory, Prof
 			auto f = parent->files.find(fileNameLower);
 			if (f != parent->files.end()) {
 				cleanIndices(*parent, *f);
+				retire(*f);
 				parent->files.erase(f);
 				deleted = true;
 			}
@@ -701,6 +709,7 @@ bool ShareManager::handleDeletedFile(const string& aPath, bool isDirectory, Prof
 		if (SETTING(SKIP_EMPTY_DIRS_SHARE) && parent->directories.empty() && parent->files.empty() && parent->getParent()) {
 			//remove the parent
 			cleanIndices(*parent);
+			retire(parent);
 			parent->getParent()->directories.erase_key(parent->realName.getLower());
 		}
 	}
@@ -761,10 +770,11 @@ void ShareManager::setProfilesDirty(ProfileTokenSet aProfiles, bool aIsMajorChan
 }
 
 ShareManager::Directory::Directory(DualString&& aRealName, const ShareManager::Directory::Ptr& aParent, uint64_t aLastWrite, ProfileDirectory::Ptr aProfileDir) :
-	size(0),
+	lastWrite(aLastWrite),
 	parent(aParent.get()),
 	profileDir(aProfileDir),
-	lastWrite(aLastWrite),
+	size(0),
+	searchIndexId(SearchIndex::INVALID_ID),
 	realName(move(aRealName))
 {
 }
@@ -773,6 +783,11 @@ ShareManager::Directory::~Directory() {
 	for_each(files, DeleteFunction());
 }
 
+void ShareManager::Directory::shrinkToFit() noexcept {
+	files.shrink_to_fit();
+	directories.shrink_to_fit();
+}
+
 void ShareManager::Directory::updateModifyDate() {
 	lastWrite = dcpp::File::getLastModified(getRealPath());
 }
@@ -828,15 +843,72 @@ string ShareManager::Directory::getFullName(ProfileToken aProfile) const noexcep
 	return parent->getFullName(aProfile) + realName.getNormal() + '\\';
 }
 
-StringList ShareManager::getRealPaths(const TTHValue& root) const noexcept {
-	StringList ret;
+template<class F>
+bool ShareManager::findFiles(const TTHValue& aTTH, F aF) const noexcept {
+	{
+		HashFileMap::ReadGuard g(tthIndex);
+
+		// Checked after taking the guard, an update that starts after this will wait for us
+		if (inPlaceUpdates == 0) {
+			return tthIndex.find(aTTH, aF);
+		}
+	}
 
+	// The update may be waiting for the guard to be released, don't hold it while waiting for the lock
 	RLock l(cs);
-	const auto i = tthIndex.equal_range(const_cast<TTHValue*>(&root)); 
-	for (auto f = i.first; f != i.second; ++f) {
-		ret.push_back((*f).second->getRealPath());
+	return tthIndex.find(aTTH, aF);
+}
+
+ShareManager::InPlaceUpdate::InPlaceUpdate(ShareManager& aSm) noexcept : sm(aSm) {
+	sm.inPlaceUpdates++;
+
+	// Wait for the lookups that didn't see the update
+	sm.tthIndex.synchronize();
+}
+
+ShareManager::InPlaceUpdate::~InPlaceUpdate() noexcept {
+	sm.inPlaceUpdates--;
+}
+
+void ShareManager::retire(const Directory::Ptr& aDir) noexcept {
+	FastLock l(retiredCs);
+	retiredDirectories.push_back(aDir);
+}
+
+void ShareManager::retire(Directory::File* aFile) noexcept {
+	FastLock l(retiredCs);
+	retiredFiles.push_back(aFile);
+}
+
+void ShareManager::releaseRetired() noexcept {
+	Directory::List dirs;
+	vector<Directory::File*> files;
+
+	{
+		FastLock l(retiredCs);
+		dirs.swap(retiredDirectories);
+		files.swap(retiredFiles);
 	}
 
+	if (dirs.empty() && files.empty()) {
+		return;
+	}
+
+	// Everything has been removed from the TTH index before retiring it
+	tthIndex.synchronize();
+
+	for_each(files, DeleteFunction());
+}
+
+StringList ShareManager::getRealPaths(const TTHValue& root) const noexcept {
+	StringList ret;
+
+	findFiles(root, [&](const Directory::File* f) {
+		ret.push_back(f->getRealPath());
+		return false;
+	});
+
+	RLock l(tempShareCs);
 	const auto k = tempShares.find(root);
 	if (k != tempShares.end()) {
 		ret.push_back(k->second.path);
@@ -847,8 +919,7 @@ StringList ShareManager::getRealPaths(const TTHValue& root) const noexcept {
 
 
 bool ShareManager::isTTHShared(const TTHValue& tth) const noexcept {
-	RLock l(cs);
-	return tthIndex.find(const_cast<TTHValue*>(&tth)) != tthIndex.end();
+	return tthIndex.contains(tth);
 }
 
 string ShareManager::Directory::getRealPath(const string& path) const noexcept {
@@ -909,10 +980,19 @@ bool ShareManager::ProfileDirectory::hasRootProfile(ProfileToken aProfile) const
 	return rootProfiles.find(aProfile) != rootProfiles.end();
 }
 
+atomic<uint64_t> ShareManager::ProfileDirectory::nextRevision { 0 };
+
 ShareManager::ProfileDirectory::ProfileDirectory(const string& aRootPath, const string& aVname, const ProfileTokenSet& aProfiles, bool aIncoming /*false*/) :
-	path(aRootPath), cacheDirty(false), virtualName(unique_ptr<DualString>(new DualString(aVname))), 
-	incoming(aIncoming), rootProfiles(aProfiles) {
+	path(aRootPath), virtualName(unique_ptr<DualString>(new DualString(aVname))), 
+	incoming(aIncoming), rootProfiles(aProfiles), revision(++nextRevision) {
+
+}
 
+void ShareManager::ProfileDirectory::setCacheDirty(bool aDirty) noexcept {
+	cacheDirty = aDirty;
+	if (aDirty) {
+		revision = ++nextRevision;
+	}
 }
 
 void ShareManager::ProfileDirectory::addRootProfile(ProfileToken aProfile) noexcept {
@@ -935,9 +1015,9 @@ string ShareManager::toVirtual(const TTHValue& tth, ProfileToken aProfile) const
 		return Transfer::USER_LIST_NAME;
 	}
 
-	auto i = tthIndex.find(const_cast<TTHValue*>(&tth)); 
-	if(i != tthIndex.end()) 
-		return i->second->getADCPath(aProfile);
+	string path;
+	if (tthIndex.find(tth, [&](const Directory::File* f) { path = f->getADCPath(aProfile); return true; }))
+		return path;
 
 	//nothing found throw;
 	throw ShareException(UserConnection::FILE_NOT_AVAILABLE);
@@ -969,22 +1049,26 @@ void ShareManager::toRealWithSize(const string& virtualFile, const ProfileTokenS
 	if(virtualFile.compare(0, 4, "TTH/") == 0) {
 		TTHValue tth(virtualFile.substr(4));
 
-		RLock l(cs);
 		if(any_of(aProfiles.begin(), aProfiles.end(), [](ProfileToken s) { return s != SP_HIDDEN; })) {
-			const auto flst = tthIndex.equal_range(const_cast<TTHValue*>(&tth));
-			for(auto f = flst.first; f != flst.second; ++f) {
+			auto found = findFiles(tth, [&](const Directory::File* f) {
 				noAccess_ = false; //we may throw if the file doesn't exist on the disk so always reset this to prevent invalid access denied messages
 				auto profiles = aProfiles;
-				if (f->second->getParent()->hasProfile(profiles)) {
-					path_ = f->second->getRealPath();
-					size_ = f->second->getSize();
-					return;
-				} else {
-					noAccess_ = true;
+				if (f->getParent()->hasProfile(profiles)) {
+					path_ = f->getRealPath();
+					size_ = f->getSize();
+					return true;
 				}
+
+				noAccess_ = true;
+				return false;
+			});
+
+			if (found) {
+				return;
 			}
 		}
 
+		RLock l(tempShareCs);
 		const auto files = tempShares.equal_range(tth);
 		for(auto i = files.first; i != files.second; ++i) {
 			noAccess_ = false;
@@ -1068,9 +1152,8 @@ AdcCommand ShareManager::getFileInfo(const string& aFile, ProfileToken aProfile)
 	TTHValue val(aFile.substr(4));
 	
 	RLock l(cs);
-	auto i = tthIndex.find(const_cast<TTHValue*>(&val)); 
-	if(i != tthIndex.end()) {
-		const Directory::File* f = i->second;
+	const Directory::File* f = nullptr;
+	if (tthIndex.find(val, [&](const Directory::File* aFile) { f = aFile; return true; })) {
 		AdcCommand cmd(AdcCommand::CMD_RES);
 		cmd.addParam("FN", f->getADCPath(aProfile));
 		cmd.addParam("SI", Util::toString(f->getSize()));
@@ -1083,7 +1166,7 @@ AdcCommand ShareManager::getFileInfo(const string& aFile, ProfileToken aProfile)
 }
 
 bool ShareManager::isTempShared(const string& aKey, const TTHValue& tth) {
-	RLock l(cs);
+	RLock l(tempShareCs);
 	const auto fp = tempShares.equal_range(tth);
 	for(auto i = fp.first; i != fp.second; ++i) {
 		if(i->second.key.empty() || (i->second.key == aKey)) // if no key is set, it means its a hub share.
@@ -1099,6 +1182,7 @@ void ShareManager::addTempShare(const string& aKey, const TTHValue& tth, const s
 		return;
 	} else {
 		WLock l(cs);
+		WLock tl(tempShareCs);
 		const auto files = tempShares.equal_range(tth);
 		for(auto i = files.first; i != files.second; ++i) {
 			if(i->second.key == aKey)
@@ -1110,6 +1194,7 @@ void ShareManager::addTempShare(const string& aKey, const TTHValue& tth, const s
 }
 void ShareManager::removeTempShare(const string& aKey, const TTHValue& tth) {
 	WLock l(cs);
+	WLock tl(tempShareCs);
 	const auto files = tempShares.equal_range(tth);
 	for(auto i = files.first; i != files.second; ++i) {
 		if(i->second.key == aKey) {
@@ -1120,6 +1205,7 @@ void ShareManager::removeTempShare(const string& aKey, const TTHValue& tth) {
 }
 void ShareManager::clearTempShares() {
 	WLock l(cs);
+	WLock tl(tempShareCs);
 	tempShares.clear();
 }
 
@@ -1305,16 +1391,95 @@ static const string SHARE = "Share";
 static const string SVERSION = "Version";
 
 struct ShareManager::ShareLoader : public SimpleXMLReader::ThreadedCallBack, public ShareManager::RefreshInfo {
-	ShareLoader(const string& aPath, const ShareManager::Directory::Ptr& aOldRoot, ShareManager::ShareBloom* aBloom) : 
+	ShareLoader(const string& aPath, const ShareManager::Directory::Ptr& aOldRoot, ShareManager::ShareBloom* aBloom, const string& aCachePath) : 
 		ShareManager::RefreshInfo(aPath, aOldRoot, 0),
-		ThreadedCallBack(aOldRoot->getProfileDir()->getCacheXmlPath()),
+		ThreadedCallBack(aCachePath),
 		curDirPath(aOldRoot->getProfileDir()->getPath()),
 		curDirPathLower(Text::toLower(aOldRoot->getProfileDir()->getPath())),
 		bloom(aBloom)
 	{ 
+		xmlPath = aCachePath;
 		cur = root;
 	}
 
+	bool isBinary() const noexcept {
+		return Util::getFileExt(xmlPath) == ".bin";
+	}
+
+	void loadBinary() {
+		// Reuse the handle that was opened for getting the file size
+		BinaryShareCache::Reader reader(*file);
+		file.reset();
+
+		// The directories are listed in depth-first order, keep the path to the current one
+		struct Parent {
+			uint32_t index;
+			ShareManager::Directory::Ptr dir;
+			size_t pathLen;
+			size_t pathLowerLen;
+		};
+
+		vector<Parent> parents;
+		for (uint32_t i = 0; i < reader.getDirectoryCount(); ++i) {
+			const auto& d = reader.getDirectory(i);
+			if (i == 0) {
+				cur->setLastWrite(d.lastWrite);
+			} else {
+				while (!parents.empty() && parents.back().index != d.parent) {
+					parents.pop_back();
+				}
+
+				if (parents.empty()) {
+					// The parent isn't an ancestor of the previous directory
+					throw ShareCacheException("Invalid directory order");
+				}
+
+				curDirPath.erase(parents.back().pathLen);
+				curDirPathLower.erase(parents.back().pathLowerLen);
+
+				auto name = reader.getString(d.name);
+				curDirPath += name + PATH_SEPARATOR;
+
+				ShareManager::ProfileDirectory::Ptr pd = nullptr;
+				if (!subProfiles.empty()) {
+					auto p = subProfiles.find(curDirPath);
+					if (p != subProfiles.end()) {
+						pd = p->second;
+					}
+				}
+
+				cur = ShareManager::Directory::create(move(name), parents.back().dir, d.lastWrite, pd);
+				curDirPathLower += cur->realName.getLower() + PATH_SEPARATOR;
+				if (pd) {
+					rootPathsNew[curDirPathLower] = cur;
+				}
+			}
+
+			cur->addBloom(*bloom);
+			dirNameMapNew.emplace(const_cast<string*>(&cur->realName.getLower()), cur);
+
+			for (uint32_t j = d.firstFile; j < d.firstFile + d.fileCount; ++j) {
+				const auto& f = reader.getFile(j);
+				auto fname = reader.getString(f.name);
+
+				try {
+					// Files that are missing from the hash database (or have been modified) must be hashed again
+					DualString name(fname);
+					HashedFile fi;
+					HashManager::getInstance()->getFileInfo(curDirPathLower + name.getLower(), curDirPath + fname, fi);
+					auto pos = cur->files.insert_sorted(new ShareManager::Directory::File(move(name), cur, fi));
+					ShareManager::updateIndices(*cur, *pos.first, *bloom, addedSize, tthIndexNew);
+				} catch (const Exception& e) {
+					hashSize += File::getSize(curDirPath + fname);
+					dcdebug("Error loading file list %s \n", e.getError().c_str());
+				}
+			}
+
+			cur->shrinkToFit();
+			parents.push_back({ i, cur, curDirPath.size(), curDirPathLower.size() });
+		}
+	}
+
 
 	void startTag(const string& aName, StringPairList& attribs, bool simple) {
 		if(compare(aName, SDIRECTORY) == 0) {
@@ -1377,6 +1542,7 @@ struct ShareManager::ShareLoader : public SimpleXMLReader::ThreadedCallBack, pub
 	void endTag(const string& name) {
 		if(compare(name, SDIRECTORY) == 0) {
 			if(cur) {
+				cur->shrinkToFit();
 				curDirPath = Util::getParentDir(curDirPath);
 				curDirPathLower = Util::getParentDir(curDirPathLower);
 				cur = cur->getParent();
@@ -1424,11 +1590,16 @@ bool ShareManager::loadCache(function<void(float)> progressF) noexcept{
 
 	//create the info dirs
 	for (const auto& p : fileList) {
-		if (Util::getFileExt(p) == ".xml") {
-			auto rp = find_if(parents | map_values, [&p](const Directory::Ptr& aDir) { return Util::stricmp(aDir->getProfileDir()->getCacheXmlPath(), p) == 0; });
+		// The binary cache is preferred, XML caches are imported when there is nothing else
+		auto ext = Util::getFileExt(p);
+		if (ext == ".bin" || (ext == ".xml" && find(fileList, p.substr(0, p.size() - 4) + ".bin") == fileList.end())) {
+			auto rp = find_if(parents | map_values, [&p, &ext](const Directory::Ptr& aDir) { 
+				return Util::stricmp(ext == ".bin" ? aDir->getProfileDir()->getCacheBinaryPath() : aDir->getProfileDir()->getCacheXmlPath(), p) == 0; 
+			});
+
 			if (rp.base() != parents.end()) { //make sure that subdirs are never listed here...
 				try {
-					auto loader = new ShareLoader(rp.base()->first, *rp, bloom.get());
+					auto loader = new ShareLoader(rp.base()->first, *rp, bloom.get(), p);
 					ll.emplace_back(loader);
 					continue;
 				} catch (...) {}
@@ -1443,17 +1614,22 @@ bool ShareManager::loadCache(function<void(float)> progressF) noexcept{
 
 	//ll.sort(SimpleXMLReader::ThreadedCallBack::SizeSort());
 
-	//load the XML files
+	//load the cache files
 	atomic<long> loaded(0);
 	bool hasFailed = false;
+	auto start = GET_TICK();
 
 	try {
 		parallel_for_each(ll.begin(), ll.end(), [&](ShareLoaderPtr& i) {
 			//LogManager::getInstance()->message("Thread: " + Util::toString(::GetCurrentThreadId()) + "Size " + Util::toString(loader.size), LogMessage::SEV_INFO);
 			auto& loader = *i;
 			try {
-				SimpleXMLReader(&loader).parse(*loader.file);
-			} catch (SimpleXMLException& e) {
+				if (loader.isBinary()) {
+					loader.loadBinary();
+				} else {
+					SimpleXMLReader(&loader).parse(*loader.file);
+				}
+			} catch (Exception& e) {
 				LogManager::getInstance()->message("Error loading " + loader.xmlPath + ": " + e.getError(), LogMessage::SEV_ERROR);
 				hasFailed = true;
 				File::deleteFile(loader.xmlPath);
@@ -1474,12 +1650,17 @@ bool ShareManager::loadCache(function<void(float)> progressF) noexcept{
 	if (hasFailed)
 		return false;
 
+	LogManager::getInstance()->message(STRING_F(SHARE_CACHE_LOADED, dirCount % (GET_TICK() - start)), LogMessage::SEV_INFO);
+
 	//apply the changes
 	int64_t hashSize = 0;
 
 	DirMap newRoots;
+	if (SETTING(SHARE_SEARCH_INDEX)) {
+		searchIndex.reset(new SearchIndex);
+	}
 
-	mergeRefreshChanges(ll, dirNameMap, newRoots, tthIndex, hashSize, sharedSize, nullptr);
+	mergeRefreshChanges(ll, dirNameMap, searchIndex.get(), newRoots, tthIndex, hashSize, sharedSize, nullptr);
 
 	//make sure that the subprofiles are added too
 	for (auto& p : newRoots)
@@ -1573,9 +1754,9 @@ optional<ShareManager::ShareStats> ShareManager::getShareStats() const noexcept
 
 	{
 		RLock l(cs);
-		for (auto tth : tthIndex | map_keys) {
-			uniqueTTHs.insert(tth);
-		}
+		tthIndex.forEach([&](const TTHValue& aTTH, const Directory::File*) {
+			uniqueTTHs.insert(const_cast<TTHValue*>(&aTTH));
+		});
 	}
 
 	ShareStats stats;
@@ -1638,6 +1819,7 @@ Filtered text searches: %d%% (%d%% of the matched ones returned results)\r\n\
 Average search tokens (non-filtered only): %d (%d bytes per token)\r\n\
 Auto searches (text, ADC only): %d%%\r\n\
 Average time for matching a recursive search: %d ms\r\n\
+Recursive searches filtered with the name index: %d%%\r\n\
 TTH searches: %d%% (hash bloom mode: %s)")
 
 		% totalSearches % (totalSearches / upseconds)
@@ -1648,6 +1830,7 @@ TTH searches: %d%% (hash bloom mode: %s)")
 		% (searchTokenCount == 0 ? 0 : static_cast<double>(searchTokenLength) / static_cast<double>(searchTokenCount)) // search token length
 		% (recursiveSearches == 0 ? 0 : (static_cast<double>(autoSearches) / static_cast<double>(recursiveSearches))*100.00) // auto searches
 		% (recursiveSearches - filteredSearches == 0 ? 0 : recursiveSearchTime / (recursiveSearches - filteredSearches)) // search matching time
+		% (recursiveSearches - filteredSearches == 0 ? 0 : (static_cast<double>(indexedSearches) / static_cast<double>(recursiveSearches - filteredSearches))*100.00) // indexed searches
 		% (totalSearches == 0 ? 0 : (static_cast<double>(tthSearches) / static_cast<double>(totalSearches))*100.00) // TTH searches
 		% (SETTING(BLOOM_MODE) != SettingsManager::BLOOM_DISABLED ? "Enabled" : "Disabled") // bloom mode
 	);
@@ -1850,20 +2033,13 @@ ShareManager::Directory::Ptr ShareManager::Directory::findDirByPath(const string
 }
 
 bool ShareManager::isFileShared(const TTHValue& aTTH) const noexcept{
-	RLock l (cs);
-	return tthIndex.find(const_cast<TTHValue*>(&aTTH)) != tthIndex.end();
+	return tthIndex.contains(aTTH);
 }
 
 bool ShareManager::isFileShared(const TTHValue& aTTH, ProfileToken aProfile) const noexcept{
-	RLock l (cs);
-	const auto files = tthIndex.equal_range(const_cast<TTHValue*>(&aTTH));
-	for(auto i = files.first; i != files.second; ++i) {
-		if(i->second->getParent()->hasProfile(aProfile)) {
-			return true;
-		}
-	}
-
-	return false;
+	return findFiles(aTTH, [&](const Directory::File* f) {
+		return f->getParent()->hasProfile(aProfile);
+	});
 }
 
 void ShareManager::buildTree(string& aPath, string& aPathLower, const Directory::Ptr& aDir, const ProfileDirMap& aSubRoots, DirMultiMap& aDirs, DirMap& newShares, 
@@ -1949,6 +2125,8 @@ void ShareManager::buildTree(string& aPath, string& aPathLower, const Directory:
 			}
 		}
 	}
+
+	aDir->shrinkToFit();
 }
 
 void ShareManager::Directory::addBloom(ShareBloom& aBloom) const noexcept {
@@ -1959,32 +2137,31 @@ void ShareManager::Directory::addBloom(ShareBloom& aBloom) const noexcept {
 	aBloom.add(realName.getLower());
 }
 
-void ShareManager::updateIndices(Directory::Ptr& dir, ShareBloom& aBloom, int64_t& sharedSize, HashFileMap& tthIndex, DirMultiMap& aDirNames) noexcept {
+void ShareManager::updateIndices(Directory::Ptr& dir, ShareBloom& aBloom, int64_t& sharedSize, HashFileMap& tthIndex, DirMultiMap& aDirNames, SearchIndex* aSearchIndex) noexcept {
 	// add to bloom
 	dir->addBloom(aBloom);
 	aDirNames.emplace(const_cast<string*>(&dir->realName.getLower()), dir);
 
 	// update all sub items
 	for(auto d: dir->directories) {
-		updateIndices(d, aBloom, sharedSize, tthIndex, aDirNames);
+		updateIndices(d, aBloom, sharedSize, tthIndex, aDirNames, aSearchIndex);
 	}
 
 	for(auto i = dir->files.begin(); i != dir->files.end(); i++) {
 		updateIndices(*dir, *i, aBloom, sharedSize, tthIndex);
 	}
+
+	if (aSearchIndex) {
+		aSearchIndex->addDirectory(dir);
+	}
 }
 
 void ShareManager::updateIndices(Directory& dir, const Directory::File* f, ShareBloom& aBloom, int64_t& sharedSize, HashFileMap& tthIndex) noexcept {
 	dir.size += f->getSize();
 	sharedSize += f->getSize();
 
-#ifdef _DEBUG
-	auto flst = tthIndex.equal_range(const_cast<TTHValue*>(&f->getTTH()));
-	auto p = find(flst | map_values, f);
-	dcassert(p.base() == flst.second);
-#endif
-
-	tthIndex.emplace(const_cast<TTHValue*>(&f->getTTH()), f);
+	dcassert(!tthIndex.find(f->getTTH(), [f](const Directory::File* aFile) { return aFile == f; }));
+	tthIndex.insert(f->getTTH(), f);
 	aBloom.add(f->name.getLower());
 }
 
@@ -2214,6 +2391,8 @@ bool ShareManager::removeProfile(ProfileToken aToken) noexcept {
 
 	{
 		WLock l(cs);
+		InPlaceUpdate u(*this);
+
 		// Remove all directories
 		for (auto& root : rootPaths) {
 			auto profiles = root.second->getProfileDir()->getRootProfiles();
@@ -2257,6 +2436,8 @@ bool ShareManager::addDirectory(const ShareDirectoryInfoPtr& aDirectoryInfo) noe
 				auto dir = findDirectory(path);
 				if (dir) {
 					auto root = ProfileDirectory::Ptr(new ProfileDirectory(path, aDirectoryInfo->virtualName, aDirectoryInfo->profiles, aDirectoryInfo->incoming));
+
+					InPlaceUpdate u(*this);
 					dir->setProfileDir(root);
 
 					addRoot(path, dir);
@@ -2309,12 +2490,14 @@ bool ShareManager::removeDirectory(const string& aPath) noexcept {
 
 		if (sd->getParent()) {
 			// Subroot and the content still stays shared.. just null the profile
+			InPlaceUpdate u(*this);
 			sd->setProfileDir(nullptr);
 			removed = true;
 		} else {
 			// Remove the root
 			cleanIndices(*sd);
-			File::deleteFile(sd->getProfileDir()->getCacheXmlPath());
+			retire(sd);
+			sd->getProfileDir()->deleteCache();
 
 			// No parent directories, get all child roots for this
 			Directory::List subDirs;
@@ -2331,11 +2514,12 @@ bool ShareManager::removeDirectory(const string& aPath) noexcept {
 			}
 
 			// Convert the matching children to new parents
+			InPlaceUpdate u(*this);
 			for (auto& d : subDirs) {
 				if (Util::getParentDir(d->getProfileDir()->getPath()).length() == minLen) {
 					d->setParent(nullptr);
 					d->getProfileDir()->setCacheDirty(true);
-					updateIndices(d, *bloom.get(), sharedSize, tthIndex, dirNameMap);
+					updateIndices(d, *bloom.get(), sharedSize, tthIndex, dirNameMap, searchIndex.get());
 				}
 			}
 		}
@@ -2381,6 +2565,7 @@ bool ShareManager::changeDirectory(const ShareDirectoryInfoPtr& aDirectoryInfo)
 			// Make sure that all removed profiles are set dirty as well
 			dirtyProfiles.insert(profileDir->getRootProfiles().begin(), profileDir->getRootProfiles().end());
 
+			InPlaceUpdate u(*this);
 			profileDir->setName(vName);
 			profileDir->setIncoming(aDirectoryInfo->incoming);
 			profileDir->setRootProfiles(aDirectoryInfo->profiles);
@@ -2488,6 +2673,36 @@ ShareManager::RefreshInfo::RefreshInfo(const string& aPath, const Directory::Ptr
 	dirNameMapNew.emplace(const_cast<string*>(&root->realName.getLower()), root);
 }
 
+void ShareManager::refreshVolumes(RefreshInfoList& aDirs, const function<void (RefreshInfoPtr&)>& aRefreshF) {
+	struct Volume {
+		RefreshInfoList dirs;
+		atomic<size_t> pos { 0 };
+	};
+
+	// group the directories by the volume where they reside
+	unordered_map<string, Volume> volumes;
+	for (auto& ri : aDirs) {
+		volumes[Text::toLower(File::getMountPath(ri->path))].dirs.push_back(ri);
+	}
+
+	// spawn the allowed number of workers for each volume, the workers will pick the next directory from their own volume
+	vector<Volume*> workers;
+	for (auto& v : volumes | map_values) {
+		auto count = SETTING(REFRESH_THREADS_PER_VOLUME) > 0 ? min(static_cast<size_t>(SETTING(REFRESH_THREADS_PER_VOLUME)), v.dirs.size()) : v.dirs.size();
+		workers.insert(workers.end(), count, &v);
+	}
+
+	parallel_for_each(workers.begin(), workers.end(), [&](Volume* v) {
+		for (;;) {
+			auto pos = v->pos++;
+			if (pos >= v->dirs.size())
+				break;
+
+			aRefreshF(v->dirs[pos]);
+		}
+	});
+}
+
 void ShareManager::runTasks(function<void (float)> progressF /*nullptr*/) noexcept {
 	unique_ptr<HashManager::HashPauser> pauser = nullptr;
 
@@ -2565,21 +2780,20 @@ void ShareManager::runTasks(function<void (float)> progressF /*nullptr*/) noexce
 		atomic<long> progressCounter(0);
 		const size_t dirCount = refreshDirs.size();
 
-
-		//bloom
-		ShareBloom* refreshBloom = t.first == REFRESH_ALL ? new ShareBloom(1<<20) : bloom.get();
-
 		auto doRefresh = [&](RefreshInfoPtr& i) {
 			auto& ri = *i.get();
 			auto pathLower = Text::toLower(ri.path);
 			auto path = ri.path;
-			ri.root->addBloom(*refreshBloom);
+
+			// Only needed for refreshing (the share cache loader uses the main bloom)
+			ri.bloomNew.reset(new ShareBloom(1<<20));
+			ri.root->addBloom(*ri.bloomNew);
 
 			setRefreshState(ri.path, RefreshState::STATE_RUNNING, false);
 
 			bool succeed = false;
 			try {
-				buildTree(path, pathLower, ri.root, ri.subProfiles, ri.dirNameMapNew, ri.rootPathsNew, ri.hashSize, ri.addedSize, ri.tthIndexNew, *refreshBloom);
+				buildTree(path, pathLower, ri.root, ri.subProfiles, ri.dirNameMapNew, ri.rootPathsNew, ri.hashSize, ri.addedSize, ri.tthIndexNew, *ri.bloomNew);
 				succeed = true;
 			} catch (const std::bad_alloc&) {
 				LogManager::getInstance()->message(STRING_F(DIR_REFRESH_FAILED, path % STRING(OUT_OF_MEMORY)), LogMessage::SEV_ERROR);
@@ -2599,7 +2813,7 @@ void ShareManager::runTasks(function<void (float)> progressF /*nullptr*/) noexce
 		try {
 			if (SETTING(REFRESH_THREADING) == SettingsManager::MULTITHREAD_ALWAYS || (SETTING(REFRESH_THREADING) == SettingsManager::MULTITHREAD_MANUAL && (task->type == TYPE_MANUAL || task->type == TYPE_STARTUP_BLOCKING))) {
 				TaskScheduler s;
-				parallel_for_each(refreshDirs.begin(), refreshDirs.end(), doRefresh);
+				refreshVolumes(refreshDirs, doRefresh);
 			} else {
 				for_each(refreshDirs, doRefresh);
 			}
@@ -2614,6 +2828,28 @@ void ShareManager::runTasks(function<void (float)> progressF /*nullptr*/) noexce
 		int64_t totalHash=0;
 		ProfileTokenSet dirtyProfiles;
 
+		// A full refresh replaces everything so the new indices can be built before locking
+		// (the old content is retired after releasing the lock)
+		int64_t totalAdded=0;
+		unique_ptr<ShareBloom> newBloom;
+		DirMultiMap newDirNames;
+		unique_ptr<SearchIndex> newSearchIndex;
+		DirMap newRoots;
+		HashFileMap newTTHs;
+
+		if (t.first == REFRESH_ALL) {
+			if (SETTING(SHARE_SEARCH_INDEX)) {
+				newSearchIndex.reset(new SearchIndex);
+			}
+
+			mergeRefreshChanges(refreshDirs, newDirNames, newSearchIndex.get(), newRoots, newTTHs, totalHash, totalAdded, nullptr);
+
+			newBloom.reset(new ShareBloom(1<<20));
+			for (const auto& ri : refreshDirs) {
+				newBloom->merge(*ri->bloomNew);
+			}
+		}
+
 		//append the changes
 		{		
 			WLock l(cs);
@@ -2622,25 +2858,31 @@ void ShareManager::runTasks(function<void (float)> progressF /*nullptr*/) noexce
 					return !handleRefreshedDirectory(ri, static_cast<TaskType>(t.first)); 
 				}), refreshDirs.end());
 
-				bloom->merge(*refreshBloom);
-				mergeRefreshChanges(refreshDirs, dirNameMap, rootPaths, tthIndex, totalHash, sharedSize, &dirtyProfiles);
-			} else {
-				int64_t totalAdded=0;
-				DirMultiMap newDirNames;
-				DirMap newRoots;
-				HashFileMap newTTHs;
+				for (const auto& ri : refreshDirs) {
+					bloom->merge(*ri->bloomNew);
+				}
 
-				mergeRefreshChanges(refreshDirs, newDirNames, newRoots, newTTHs, totalHash, totalAdded, &dirtyProfiles);
+				mergeRefreshChanges(refreshDirs, dirNameMap, searchIndex.get(), rootPaths, tthIndex, totalHash, sharedSize, &dirtyProfiles);
+			} else {
+				for (const auto& ri : refreshDirs) {
+					ri->root->copyRootProfiles(dirtyProfiles, true);
+				}
 
 				rootPaths.swap(newRoots);
 				dirNameMap.swap(newDirNames);
+				searchIndex.swap(newSearchIndex);
 				tthIndex.swap(newTTHs);
 
 				sharedSize = totalAdded;
-				bloom.reset(refreshBloom);
+				bloom.swap(newBloom);
 			}
 		}
 
+		for (const auto& d : newRoots | map_values) {
+			// The previous content when refreshing everything
+			retire(d);
+		}
+
 		setProfilesDirty(dirtyProfiles, task->type == TYPE_MANUAL || t.first == REFRESH_ALL || t.first == ADD_BUNDLE);
 		reportTaskStatus(t.first, dirs, true, totalHash, task->displayName, task->type);
 
@@ -2682,16 +2924,19 @@ void ShareManager::setRefreshState(const string& aPath, RefreshState aState, boo
 
 bool ShareManager::handleRefreshedDirectory(RefreshInfoPtr& ri, TaskType aTaskType) {
 	//recursively remove the content of this dir from TTHIndex and dir name list
-	if (ri->oldRoot)
+	if (ri->oldRoot) {
 		cleanIndices(*ri->oldRoot);
+		retire(ri->oldRoot);
+	}
 
 	//clear this path and its children from root paths
 	for (auto i = rootPaths.begin(); i != rootPaths.end();) {
 		if (AirUtil::isParentOrExact(ri->path, i->first)) {
 			if (aTaskType == ADD_DIR && AirUtil::isSub(i->first, ri->root->getProfileDir()->getPath()) && !i->second->getParent()) {
 				//in case we are adding a new parent
-				File::deleteFile(i->second->getProfileDir()->getCacheXmlPath());
+				i->second->getProfileDir()->deleteCache();
 				cleanIndices(*i->second);
+				retire(i->second);
 			}
 
 			i = rootPaths.erase(i);
@@ -2705,7 +2950,12 @@ bool ShareManager::handleRefreshedDirectory(RefreshInfoPtr& ri, TaskType aTaskTy
 		if (SETTING(SKIP_EMPTY_DIRS_SHARE) && ri->root->directories.empty() && ri->root->files.empty()) {
 			if (ri->oldRoot) {
 				cleanIndices(*ri->oldRoot);
-				ri->oldRoot->directories.erase_key(ri->root->realName.getLower());
+
+				auto d = ri->oldRoot->directories.find(ri->root->realName.getLower());
+				if (d != ri->oldRoot->directories.end()) {
+					retire(*d);
+					ri->oldRoot->directories.erase(d);
+				}
 			}
 
 			return false;
@@ -2736,6 +2986,8 @@ void ShareManager::on(TimerManagerListener::Second, uint64_t /*tick*/) noexcept
 	while (monitor.dispatch()) {
 		//...
 	}
+
+	releaseRetired();
 }
 
 void ShareManager::on(TimerManagerListener::Minute, uint64_t tick) noexcept {
@@ -2800,8 +3052,9 @@ ShareDirectoryInfoList ShareManager::getRootInfos() const noexcept {
 		
 void ShareManager::getBloom(HashBloom& bloom_) const noexcept {
 	RLock l(cs);
-	for(const auto tth: tthIndex | map_keys)
-		bloom_.add(*tth);
+	tthIndex.forEach([&](const TTHValue& aTTH, const Directory::File*) {
+		bloom_.add(aTTH);
+	});
 
 	for(const auto& tth: tempShares | map_keys)
 		bloom_.add(tth);
@@ -2831,10 +3084,14 @@ FileList* ShareManager::generateXmlList(ProfileToken aProfile, bool forced /*fal
 	{
 		Lock lFl(fl->cs);
 		if (fl->allowGenerateNew(forced)) {
-			auto tmpName = fl->getFileName().substr(0, fl->getFileName().length() - 4);
 			try {
 				{
-					File f(tmpName, File::RW, File::TRUNCATE | File::CREATE, File::BUFFER_SEQUENTIAL, false);
+					// The list is compressed and hashed by worker threads while it's being generated
+					File bz(fl->getFileName(), File::WRITE, File::TRUNCATE | File::CREATE, File::BUFFER_SEQUENTIAL, false);
+					// We don't care about the leaves...
+					CalcOutputStream<TTFilter<1024 * 1024 * 1024>, false> bzTree(&bz);
+					TigerTree xmlTree(1024 * 1024 * 1024);
+					ParallelBZOutputStream f(&bzTree, &xmlTree);
 
 					f.write(SimpleXML::utf8Header);
 					f.write("<FileListing Version=\"1\" CID=\"" + ClientManager::getInstance()->getMe()->getCID().toBase32() + "\" Base=\"/\" Generator=\"DC++ " DCVERSIONSTRING "\">\r\n");
@@ -2842,37 +3099,62 @@ FileList* ShareManager::generateXmlList(ProfileToken aProfile, bool forced /*fal
 					string tmp;
 					string indent = "\t";
 
-					{
-						auto root = FileListDir(Util::emptyString, 0, 0);
+					// Only the root directories that have been modified since the previous list are serialized and compressed again
+					// (they are streamed to the compressor directly, the share stays locked only while serializing)
+					FileList::SegmentMap segments;
+					size_t reused = 0;
 
+					{
 						RLock l(cs);
+
+						// Roots with the same virtual name are listed as a single directory
+						unordered_map<string, Directory::List, noCaseStringHash, noCaseStringEq> virtualRoots;
 						for (const auto& d : rootPaths | map_values | filtered(Directory::HasRootProfile(aProfile))) {
-							d->toFileList(&root, aProfile, true);
+							virtualRoots[d->getVirtualName(aProfile)].push_back(d);
 						}
 
-						for (const auto it2 : root.listDirs | map_values) {
-							it2->toXml(f, indent, tmp, true);
+						for (const auto& vr : virtualRoots) {
+							// The key changes when any of the roots is modified or renamed
+							TigerHash keyHash;
+							for (const auto& d : vr.second) {
+								auto name = d->getVirtualName(aProfile);
+								auto revision = d->getProfileDir()->getRevision();
+								keyHash.update(name.c_str(), name.size() + 1);
+								keyHash.update(&revision, sizeof(revision));
+							}
+
+							TTHValue key(keyHash.finalize());
+
+							auto s = fl->segments.find(key);
+							if (s != fl->segments.end()) {
+								f.writeSegment(s->second, ' ');
+								segments.emplace(key, s->second);
+								reused++;
+							} else {
+								auto root = FileListDir(Util::emptyString, 0, 0);
+								for (const auto& d : vr.second) {
+									d->toFileList(&root, aProfile, true);
+								}
+
+								f.beginSegment();
+								for (const auto ld : root.listDirs | map_values) {
+									ld->toXml(f, indent, tmp, true);
+								}
+								segments.emplace(key, f.endSegment());
+							}
 						}
 					}
 
 					f.write("</FileListing>");
 					f.flush();
 
-					fl->setXmlListLen(f.getSize());
-
-					File bz(fl->getFileName(), File::WRITE, File::TRUNCATE | File::CREATE, File::BUFFER_SEQUENTIAL, false);
-					// We don't care about the leaves...
-					CalcOutputStream<TTFilter<1024 * 1024 * 1024>, false> bzTree(&bz);
-					FilteredOutputStream<BZFilter, false> bzipper(&bzTree);
-					CalcOutputStream<TTFilter<1024 * 1024 * 1024>, false> newXmlFile(&bzipper);
-
-					newXmlFile.write(f.read());
-					newXmlFile.flush();
+					dcdebug("File list for profile %d generated, %d/%d root directories reused\n", aProfile, static_cast<int>(reused), static_cast<int>(segments.size()));
+					fl->segments.swap(segments);
 
-					newXmlFile.getFilter().getTree().finalize();
 					bzTree.getFilter().getTree().finalize();
 
-					fl->setXmlRoot(newXmlFile.getFilter().getTree().getRoot());
+					fl->setXmlListLen(xmlTree.getFileSize());
+					fl->setXmlRoot(xmlTree.getRoot());
 					fl->setBzXmlRoot(bzTree.getFilter().getTree().getRoot());
 				}
 
@@ -2888,8 +3170,6 @@ FileList* ShareManager::generateXmlList(ProfileToken aProfile, bool forced /*fal
 					throw ShareException(UserConnection::FILE_NOT_AVAILABLE);
 				}
 			}
-
-			File::deleteFile(tmpName);
 		}
 	}
 	return fl;
@@ -3098,6 +3378,15 @@ string ShareManager::ProfileDirectory::getCacheXmlPath() const noexcept {
 	return Util::getPath(Util::PATH_SHARECACHE) + "ShareCache_" + Util::validateFileName(path) + ".xml";
 }
 
+string ShareManager::ProfileDirectory::getCacheBinaryPath() const noexcept {
+	return Util::getPath(Util::PATH_SHARECACHE) + "ShareCache_" + Util::validateFileName(path) + ".bin";
+}
+
+void ShareManager::ProfileDirectory::deleteCache() const noexcept {
+	File::deleteFile(getCacheXmlPath());
+	File::deleteFile(getCacheBinaryPath());
+}
+
 void ShareManager::ProfileDirectory::setName(const string& aName) noexcept {
 	virtualName.reset(new DualString(aName));
 }
@@ -3127,6 +3416,26 @@ void ShareManager::saveXmlList(function<void(float)> progressF /*nullptr*/) noex
 
 		try {
 			parallel_for_each(dirtyDirs.begin(), dirtyDirs.end(), [&](const Directory::Ptr& d) {
+				if (!SETTING(SHARE_CACHE_XML)) {
+					string path = d->getProfileDir()->getCacheBinaryPath();
+					try {
+						BinaryShareCache::Writer writer;
+						d->toBinaryCache(writer, BinaryShareCache::NO_PARENT);
+						writer.save(path);
+
+						File::deleteFile(d->getProfileDir()->getCacheXmlPath());
+					} catch (Exception& e) {
+						LogManager::getInstance()->message(STRING_F(SAVE_FAILED_X, path % e.getError()), LogMessage::SEV_WARNING);
+					}
+
+					d->getProfileDir()->setCacheDirty(false);
+					if (progressF) {
+						cur++;
+						progressF(static_cast<float>(cur) / static_cast<float>(dirtyDirs.size()));
+					}
+					return;
+				}
+
 				string path = d->getProfileDir()->getCacheXmlPath();
 				try {
 					string indent, tmp;
@@ -3156,6 +3465,8 @@ void ShareManager::saveXmlList(function<void(float)> progressF /*nullptr*/) noex
 
 					File::deleteFile(path);
 					File::renameFile(path + ".tmp", path);
+
+					File::deleteFile(d->getProfileDir()->getCacheBinaryPath());
 				} catch (Exception& e) {
 					LogManager::getInstance()->message(STRING_F(SAVE_FAILED_X, path % e.getError()), LogMessage::SEV_WARNING);
 				}
@@ -3196,6 +3507,19 @@ void ShareManager::Directory::toXmlList(OutputStream& xmlFile, string&& path, st
 	xmlFile.write(LITERAL("</Directory>\r\n"));
 }
 
+void ShareManager::Directory::toBinaryCache(BinaryShareCache::Writer& aWriter, uint32_t aParent) const noexcept {
+	// The root is identified by the file name of the cache
+	auto index = aWriter.addDirectory(aParent == BinaryShareCache::NO_PARENT ? Util::emptyString : (realName.lowerCaseOnly() ? realName.getLower() : realName.getNormal()), aParent, lastWrite);
+
+	for (const auto& f : files) {
+		aWriter.addFile(f->name.lowerCaseOnly() ? f->name.getLower() : f->name.getNormal());
+	}
+
+	for (const auto& d : directories) {
+		d->toBinaryCache(aWriter, index);
+	}
+}
+
 MemoryInputStream* ShareManager::generateTTHList(const string& dir, bool recurse, ProfileToken aProfile) const noexcept {
 	
 	if(aProfile == SP_HIDDEN)
@@ -3298,12 +3622,16 @@ void ShareManager::nmdcSearch(SearchResultList& l, const string& nmdcString, int
 * but not the parents...
 */
 
-void ShareManager::Directory::search(SearchResultInfo::Set& results_, SearchQuery& aStrings, ProfileToken aProfile, int level) const noexcept{
+void ShareManager::Directory::search(SearchResultInfo::Set& results_, SearchQuery& aStrings, ProfileToken aProfile, int level, const SearchCandidates* aCandidates, uint64_t aPatterns) const noexcept{
 	const auto& dirName = getVirtualNameLower(aProfile);
 	if (aStrings.isExcludedLower(dirName)) {
 		return;
 	}
 
+	if (aCandidates && !aCandidates->matches(*this, dirName, aPatterns)) {
+		return;
+	}
+
 	auto old = aStrings.recursion;
 
 	unique_ptr<SearchQuery::Recursion> rec = nullptr;
@@ -3361,7 +3689,7 @@ void ShareManager::Directory::search(SearchResultInfo::Set& results_, SearchQuer
 
 	// Match directories
 	for(const auto& d: directories) {
-		d->search(results_, aStrings, aProfile, level);
+		d->search(results_, aStrings, aProfile, level, aCandidates, aPatterns);
 	}
 
 	// Moving to a lower level
@@ -3378,17 +3706,21 @@ void ShareManager::search(SearchResultList& results, SearchQuery& srch, ProfileT
 		return;
 	}
 
-	RLock l(cs);
 	if(srch.root) {
 		tthSearches++;
-		const auto i = tthIndex.equal_range(const_cast<TTHValue*>(&(*srch.root)));
-		for(auto& f: i | map_values) {
+		auto found = findFiles(*srch.root, [&](const Directory::File* f) {
 			if (f->hasProfile(aProfile) && AirUtil::isParentOrExact(aDir, f->getADCPath(aProfile))) {
 				f->addSR(results, aProfile, srch.addParents);
-				return;
+				return true;
 			}
+			return false;
+		});
+
+		if (found) {
+			return;
 		}
 
+		RLock l(tempShareCs);
 		const auto files = tempShares.equal_range(*srch.root);
 		for(const auto& f: files | map_values) {
 			if(f.key.empty() || (f.key == cid.toBase32())) { // if no key is set, it means its a hub share.
@@ -3404,6 +3736,7 @@ void ShareManager::search(SearchResultList& results, SearchQuery& srch, ProfileT
 	if (isAutoSearch)
 		autoSearches++;
 
+	RLock l(cs);
 	for (const auto& p : srch.include.getPatterns()) {
 		if (!bloom->match(p.str())) {
 			filteredSearches++;
@@ -3433,10 +3766,18 @@ void ShareManager::search(SearchResultList& results, SearchQuery& srch, ProfileT
 
 	auto start = GET_TICK();
 
+	unique_ptr<SearchCandidates> candidates;
+	if (searchIndex && SETTING(SHARE_SEARCH_INDEX)) {
+		candidates = searchIndex->getCandidates(srch);
+	}
+
+	if (candidates)
+		indexedSearches++;
+
 	// go them through recursively
 	Directory::SearchResultInfo::Set resultInfos;
 	for (const auto& d: roots) {
-		d->search(resultInfos, srch, aProfile, 0);
+		d->search(resultInfos, srch, aProfile, 0, candidates.get(), candidates ? candidates->getPatterns() : 0);
 	}
 
 	// update statistics
@@ -3465,12 +3806,9 @@ void ShareManager::cleanIndices(Directory& dir, const Directory::File* f) noexce
 	dir.size -= f->getSize();
 	sharedSize -= f->getSize();
 
-	auto flst = tthIndex.equal_range(const_cast<TTHValue*>(&f->getTTH()));
-	auto p = find(flst | map_values, f);
-	if (p.base() != flst.second)
-		tthIndex.erase(p.base());
-	else
+	if (!tthIndex.erase(f->getTTH(), f)) {
 		dcassert(0);
+	}
 }
 
 void ShareManager::addDirName(Directory::Ptr& dir) noexcept {
@@ -3480,15 +3818,198 @@ void ShareManager::addDirName(Directory::Ptr& dir) noexcept {
 	dcassert(p.base() == directories.second);
 #endif
 	dirNameMap.emplace(const_cast<string*>(&dir->realName.getLower()), dir);
+	if (searchIndex) {
+		searchIndex->addDirectory(dir);
+	}
 }
 
 void ShareManager::removeDirName(Directory& dir) noexcept {
+	if (searchIndex) {
+		searchIndex->removeDirectory(dir);
+	}
+
 	auto directories = dirNameMap.equal_range(const_cast<string*>(&dir.realName.getLower()));
 	auto p = find_if(directories | map_values, [&dir](const Directory::Ptr& d) { return d.get() == &dir; });
-	if (p.base() != dirNameMap.end())
+	if (p.base() != dirNameMap.end()) {
 		dirNameMap.erase(p.base());
-	else
+	} else {
 		dcassert(0);
+	}
+}
+
+void ShareManager::SearchIndex::getTokens(const string& aNameLower, IdList& tokens_) noexcept {
+	for (size_t i = 2; i < aNameLower.size(); ++i) {
+		tokens_.push_back((static_cast<uint8_t>(aNameLower[i - 2]) << 16) | (static_cast<uint8_t>(aNameLower[i - 1]) << 8) | static_cast<uint8_t>(aNameLower[i]));
+	}
+}
+
+bool ShareManager::SearchIndex::isIndexed(const Directory& aDir) const noexcept {
+	return aDir.searchIndexId < directories.size() && directories[aDir.searchIndexId].get() == &aDir;
+}
+
+void ShareManager::SearchIndex::addDirectory(const Directory::Ptr& aDir) noexcept {
+	// Roots may be listed multiple times in the name maps
+	if (isIndexed(*aDir)) {
+		return;
+	}
+
+	auto id = static_cast<uint32_t>(directories.size());
+	aDir->searchIndexId = id;
+	directories.push_back(aDir);
+
+	IdList dirTokens;
+	getTokens(aDir->realName.getLower(), dirTokens);
+	for (const auto& f : aDir->files) {
+		getTokens(f->name.getLower(), dirTokens);
+	}
+
+	sort(dirTokens.begin(), dirTokens.end());
+	dirTokens.erase(unique(dirTokens.begin(), dirTokens.end()), dirTokens.end());
+
+	// The new ID is always the largest one
+	for (auto t : dirTokens) {
+		tokens[t].push_back(id);
+	}
+}
+
+void ShareManager::SearchIndex::addFile(const Directory& aDir, const Directory::File& aFile) noexcept {
+	if (!isIndexed(aDir)) {
+		return;
+	}
+
+	IdList fileTokens;
+	getTokens(aFile.name.getLower(), fileTokens);
+	for (auto t : fileTokens) {
+		auto& ids = tokens[t];
+		auto pos = lower_bound(ids.begin(), ids.end(), aDir.searchIndexId);
+		if (pos == ids.end() || *pos != aDir.searchIndexId) {
+			ids.insert(pos, aDir.searchIndexId);
+		}
+	}
+}
+
+void ShareManager::SearchIndex::removeDirectory(Directory& aDir) noexcept {
+	if (!isIndexed(aDir)) {
+		return;
+	}
+
+	// The ID stays in the token lists until the index is compacted
+	directories[aDir.searchIndexId] = nullptr;
+	aDir.searchIndexId = INVALID_ID;
+	removedCount++;
+
+	if (removedCount > 1024 && removedCount > directories.size() / 2) {
+		compact();
+	}
+}
+
+void ShareManager::SearchIndex::compact() noexcept {
+	Directory::List dirs;
+	for (auto& d : directories) {
+		if (d) {
+			dirs.push_back(d);
+		}
+	}
+
+	tokens.clear();
+	directories.clear();
+	removedCount = 0;
+
+	for (const auto& d : dirs) {
+		addDirectory(d);
+	}
+}
+
+unique_ptr<ShareManager::SearchCandidates> ShareManager::SearchIndex::getCandidates(const SearchQuery& aSearch) const noexcept {
+	unique_ptr<SearchCandidates> ret(new SearchCandidates(*this));
+
+	// Filtering with common patterns would cost more than it saves
+	auto maxCandidates = (directories.size() - removedCount) / 4;
+
+	// The candidates of all patterns are stored in a single buffer
+	ret->directories.reserve(min<size_t>(aSearch.include.getPatterns().size(), 64) * directories.size());
+
+	IdList patternTokens, ids;
+	vector<const IdList*> lists;
+	for (const auto& p : aSearch.include.getPatterns()) {
+		if (ret->filters.size() == 64) {
+			break;
+		}
+
+		patternTokens.clear();
+		getTokens(p.str(), patternTokens);
+		if (patternTokens.empty()) {
+			continue;
+		}
+
+		// A directory must contain all trigrams of the pattern, start from the shortest list
+		lists.clear();
+		ids.clear();
+		for (auto t : patternTokens) {
+			auto i = tokens.find(t);
+			if (i == tokens.end()) {
+				lists.clear();
+				break;
+			}
+
+			lists.push_back(&i->second);
+		}
+
+		if (!lists.empty()) {
+			sort(lists.begin(), lists.end(), [](const IdList* a, const IdList* b) { return a->size() < b->size(); });
+			if (lists.front()->size() > maxCandidates) {
+				continue;
+			}
+
+			ids = *lists.front();
+			for (auto l = lists.begin() + 1; l != lists.end() && !ids.empty(); ++l) {
+				ids.erase(remove_if(ids.begin(), ids.end(), [l](uint32_t aId) { return !binary_search((*l)->begin(), (*l)->end(), aId); }), ids.end());
+			}
+		}
+
+		// Mark the candidates and their parents
+		SearchCandidates::Filter filter = { &p, ret->directories.size() };
+		ret->directories.resize(filter.offset + directories.size());
+		for (auto id : ids) {
+			for (auto d = directories[id].get(); d; d = d->getParent()) {
+				if (isIndexed(*d)) {
+					auto idx = filter.offset + d->searchIndexId;
+					if (ret->directories[idx])
+						break;
+
+					ret->directories[idx] = true;
+				}
+			}
+		}
+
+		ret->filters.push_back(filter);
+	}
+
+	if (ret->filters.empty()) {
+		return nullptr;
+	}
+
+	return ret;
+}
+
+bool ShareManager::SearchCandidates::matches(const Directory& aDir, const string& aNameLower, uint64_t& patterns_) const noexcept {
+	auto indexed = index.isIndexed(aDir);
+	for (size_t i = 0; i < filters.size(); ++i) {
+		auto bit = 1ULL << i;
+		if ((patterns_ & bit) == 0) {
+			continue;
+		}
+
+		const auto& f = filters[i];
+		if (f.pattern->matchLower(aNameLower) != string::npos) {
+			// Matches in the subdirectories may use this directory
+			patterns_ &= ~bit;
+		} else if (indexed && !directories[f.offset + aDir.searchIndexId]) {
+			return false;
+		}
+	}
+
+	return true;
 }
 
 void ShareManager::cleanIndices(Directory& dir) noexcept {
@@ -3655,11 +4176,15 @@ void ShareManager::addFile(const string& aName, Directory::Ptr& aDir, const Hash
 	if(i != aDir->files.end()) {
 		// Get rid of false constness...
 		cleanIndices(*aDir, *i);
+		retire(*i);
 		aDir->files.erase(i);
 	}
 
 	auto it = aDir->files.insert_sorted(new Directory::File(move(dualName), aDir, fi)).first;
 	updateIndices(*aDir, *it, *bloom.get(), sharedSize, tthIndex);
+	if (searchIndex) {
+		searchIndex->addFile(*aDir, **it);
+	}
 
 	aDir->copyRootProfiles(dirtyProfiles_, true);
 }
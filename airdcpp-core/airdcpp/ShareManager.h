@@ -26,6 +26,7 @@
 #include "ShareManagerListener.h"
 
 #include "SearchQuery.h"
+#include "BinaryShareCache.h"
 #include "BloomFilter.h"
 #include "CriticalSection.h"
 #include "Exception.h"
@@ -43,6 +44,7 @@
 #include "StringSearch.h"
 #include "TaskQueue.h"
 #include "Thread.h"
+#include "TTHIndex.h"
 #include "UserConnection.h"
 
 #include "DirectoryMonitor.h"
@@ -210,7 +212,11 @@ public:
 	};
 
 	typedef unordered_multimap<TTHValue, TempShareInfo> TempShareMap;
+
+	// Modified while holding both the share lock and tempShareCs, the TTH lookups only use tempShareCs
 	TempShareMap tempShares;
+	mutable SharedMutex tempShareCs;
+
 	void addTempShare(const string& aKey, const TTHValue& tth, const string& filePath, int64_t aSize, ProfileToken aProfile);
 
 	// GUI only
@@ -318,6 +324,7 @@ private:
 	uint64_t searchTokenCount = 0;
 	uint64_t searchTokenLength = 0;
 	uint64_t autoSearches = 0;
+	uint64_t indexedSearches = 0;
 	typedef BloomFilter<5> ShareBloom;
 
 	class ProfileDirectory : public intrusive_ptr_base<ProfileDirectory>, boost::noncopyable {
@@ -329,7 +336,6 @@ private:
 			GETSET(string, path, Path);
 
 			GETSET(ProfileTokenSet, rootProfiles, RootProfiles);
-			IGETSET(bool, cacheDirty, CacheDirty, false);
 			IGETSET(bool, incoming, Incoming, false);
 			IGETSET(RefreshState, refreshState, RefreshState, RefreshState::STATE_NORMAL);
 			IGETSET(time_t, lastRefreshTime, LastRefreshTime, 0);
@@ -351,14 +357,32 @@ private:
 
 			void setName(const string& aName) noexcept;
 			string getCacheXmlPath() const noexcept;
+			string getCacheBinaryPath() const noexcept;
+
+			// Delete the cache files of both formats
+			void deleteCache() const noexcept;
+
+			bool getCacheDirty() const noexcept { return cacheDirty; }
+
+			// Setting the cache dirty marks the content as changed
+			void setCacheDirty(bool aDirty) noexcept;
+
+			// Changes whenever the content is modified (unique during the session)
+			uint64_t getRevision() const noexcept { return revision; }
 		private:
 			unique_ptr<DualString> virtualName;
+
+			bool cacheDirty = false;
+			atomic<uint64_t> revision;
+
+			static atomic<uint64_t> nextRevision;
 	};
 
 	typedef vector<ProfileDirectory::Ptr> ProfileDirectoryList;
 	unique_ptr<ShareBloom> bloom;
 
 	struct FileListDir;
+	class SearchCandidates;
 	class Directory : public intrusive_ptr_base<Directory> {
 	public:
 		typedef boost::intrusive_ptr<Directory> Ptr;
@@ -468,13 +492,15 @@ private:
 		int64_t getTotalSize() const noexcept;
 		void getProfileInfo(ProfileToken aProfile, int64_t& totalSize, size_t& filesCount) const noexcept;
 
-		void search(SearchResultInfo::Set& aResults, SearchQuery& aStrings, ProfileToken aProfile, int level) const noexcept;
+		// The candidates are used for skipping trees that can't contain matches for the patterns in the mask
+		void search(SearchResultInfo::Set& aResults, SearchQuery& aStrings, ProfileToken aProfile, int level, const SearchCandidates* aCandidates, uint64_t aPatterns) const noexcept;
 
 		void toFileList(FileListDir* aListDir, ProfileToken aProfile, bool isFullList);
 		void toTTHList(OutputStream& tthList, string& tmp2, bool recursive) const;
 
 		//for file list caching
 		void toXmlList(OutputStream& xmlFile, string&& path, string& indent, string& tmp);
+		void toBinaryCache(BinaryShareCache::Writer& aWriter, uint32_t aParent) const noexcept;
 		void filesToXmlList(OutputStream& xmlFile, string& indent, string& tmp2) const;
 
 		GETSET(uint64_t, lastWrite, LastWrite);
@@ -488,6 +514,9 @@ private:
 		bool isRootLevel(ProfileToken aProfile) const noexcept;
 		int64_t size;
 
+		// Position in the search index
+		uint32_t searchIndexId;
+
 		void addBloom(ShareBloom& aBloom) const noexcept;
 
 		void countStats(uint64_t& totalAge_, size_t& totalDirs_, int64_t& totalSize_, size_t& totalFiles, size_t& lowerCaseFiles, size_t& totalStrLen_) const noexcept;
@@ -495,6 +524,9 @@ private:
 
 		// check for an updated modify date from filesystem
 		void updateModifyDate();
+
+		// Release the unused capacity of the child lists after the directory has been fully loaded
+		void shrinkToFit() noexcept;
 		void getRenameInfoList(const string& aPath, RenameList& aRename) noexcept;
 		Directory::Ptr findDirByPath(const string& aPath, char separator) const noexcept;
 
@@ -522,6 +554,69 @@ private:
 		void filesToXml(OutputStream& xmlFile, string& indent, string& tmp2, bool addDate) const;
 	};
 
+	/*
+	Inverted index that maps trigrams of the directory and file names to the directories containing them.
+	Recursive searches use it for skipping trees without any possible matches for a pattern.
+	Removed files aren't purged from the index (the directory will only be visited needlessly).
+
+	The index is optional (SHARE_SEARCH_INDEX), it's built or released during the next full refresh after changing the setting.
+	*/
+	class SearchIndex : boost::noncopyable {
+	public:
+		static const uint32_t INVALID_ID = numeric_limits<uint32_t>::max();
+
+		void addDirectory(const Directory::Ptr& aDir) noexcept;
+		void addFile(const Directory& aDir, const Directory::File& aFile) noexcept;
+		void removeDirectory(Directory& aDir) noexcept;
+
+		bool isIndexed(const Directory& aDir) const noexcept;
+
+		// Returns nullptr if none of the patterns is selective enough to be worth filtering with
+		unique_ptr<SearchCandidates> getCandidates(const SearchQuery& aSearch) const noexcept;
+	private:
+		typedef vector<uint32_t> IdList;
+
+		// Appends the trigrams of the name
+		static void getTokens(const string& aNameLower, IdList& tokens_) noexcept;
+
+		// Reassign the IDs after enough directories have been removed
+		void compact() noexcept;
+
+		// Sorted directory IDs for each trigram
+		unordered_map<uint32_t, IdList> tokens;
+
+		// Indexed by ID, removed directories are reset
+		Directory::List directories;
+		size_t removedCount = 0;
+	};
+
+	// Directories that may contain matches for each of the selective search patterns (or their parents)
+	class SearchCandidates : boost::noncopyable {
+	public:
+		SearchCandidates(const SearchIndex& aIndex) : index(aIndex) { }
+
+		// Removes the patterns matched by the directory name from the mask
+		// Returns false if the directory tree can't contain any results
+		bool matches(const Directory& aDir, const string& aNameLower, uint64_t& patterns_) const noexcept;
+
+		uint64_t getPatterns() const noexcept { return filters.size() == 64 ? ~0ULL : (1ULL << filters.size()) - 1; }
+	private:
+		friend class SearchIndex;
+
+		struct Filter {
+			const StringSearch::Pattern* pattern;
+
+			// Position of the candidate flags of the pattern in the directory buffer
+			size_t offset;
+		};
+
+		vector<Filter> filters;
+
+		// Directories that may contain matches for each pattern (indexed by the filter offset and the directory ID)
+		vector<bool> directories;
+		const SearchIndex& index;
+	};
+
 	ShareDirectoryInfoPtr getRootInfo(const Directory::Ptr& aDir) const noexcept;
 
 	void addAsyncTask(AsyncF aF) noexcept;
@@ -537,8 +632,36 @@ private:
 
 	friend class Singleton<ShareManager>;
 
-	typedef unordered_multimap<TTHValue*, const Directory::File*> HashFileMap;
+	// Can be read without holding the share lock (see findFiles for accessing the files)
+	typedef TTHIndex<const Directory::File*> HashFileMap;
 	HashFileMap tthIndex;
+
+	// Calls aF for the shared files with the TTH until it returns true (see HashFileMap::find)
+	// The share lock isn't used unless the directories are being modified in place
+	template<class F>
+	bool findFiles(const TTHValue& aTTH, F aF) const noexcept;
+
+	// Must exist (while holding the write lock) when changing the names, parents or profiles of shared directories
+	// The lookups that don't use the share lock will wait for the write lock until the update has finished
+	class InPlaceUpdate : boost::noncopyable {
+	public:
+		InPlaceUpdate(ShareManager& aSm) noexcept;
+		~InPlaceUpdate() noexcept;
+	private:
+		ShareManager& sm;
+	};
+
+	atomic<int> inPlaceUpdates { 0 };
+
+	// The removed directories and files may still be used by the lookups
+	// They are released from the timer thread once the lookups that were running have finished
+	void retire(const Directory::Ptr& aDir) noexcept;
+	void retire(Directory::File* aFile) noexcept;
+	void releaseRetired() noexcept;
+
+	FastCriticalSection retiredCs;
+	Directory::List retiredDirectories;
+	vector<Directory::File*> retiredFiles;
 	
 	ShareManager();
 	~ShareManager();
@@ -589,6 +712,8 @@ private:
 	/** Map real name to virtual name - multiple real names may be mapped to a single virtual one */
 	DirMap rootPaths;
 	DirMultiMap dirNameMap;
+	// Null if the search index is disabled
+	unique_ptr<SearchIndex> searchIndex;
 
 	class RefreshInfo : boost::noncopyable {
 	public:
@@ -603,6 +728,7 @@ private:
 		DirMultiMap dirNameMapNew;
 		HashFileMap tthIndexNew;
 		DirMap rootPathsNew;
+		unique_ptr<ShareBloom> bloomNew;
 
 		string path;
 	};
@@ -612,13 +738,22 @@ private:
 
 	bool handleRefreshedDirectory(RefreshInfoPtr& ri, TaskType aTaskType);
 
+	/* Refreshes the directories concurrently while limiting the number of simultaneous scans on each volume */
+	static void refreshVolumes(RefreshInfoList& aDirs, const function<void (RefreshInfoPtr&)>& aRefreshF);
+
 	template<typename T>
-	void mergeRefreshChanges(T& aList, DirMultiMap& aDirNameMap, DirMap& aRootPaths, HashFileMap& aTTHIndex, int64_t& totalHash, int64_t& totalAdded, ProfileTokenSet* dirtyProfiles) noexcept {
+	void mergeRefreshChanges(T& aList, DirMultiMap& aDirNameMap, SearchIndex* aSearchIndex, DirMap& aRootPaths, HashFileMap& aTTHIndex, int64_t& totalHash, int64_t& totalAdded, ProfileTokenSet* dirtyProfiles) noexcept {
 		for (const auto& i: aList) {
 			auto& ri = *i;
 			aDirNameMap.insert(ri.dirNameMapNew.begin(), ri.dirNameMapNew.end());
+			if (aSearchIndex) {
+				for (const auto& d : ri.dirNameMapNew) {
+					aSearchIndex->addDirectory(d.second);
+				}
+			}
+
 			aRootPaths.insert(ri.rootPathsNew.begin(), ri.rootPathsNew.end());
-			aTTHIndex.insert(ri.tthIndexNew.begin(), ri.tthIndexNew.end());
+			aTTHIndex.insert(ri.tthIndexNew);
 
 			totalHash += ri.hashSize;
 			totalAdded += ri.addedSize;
@@ -646,7 +781,7 @@ private:
 
 	void addFile(const string& aName, Directory::Ptr& aDir, const HashedFile& fi, ProfileTokenSet& dirtyProfiles_) noexcept;
 
-	static void updateIndices(Directory::Ptr& aDirectory, ShareBloom& aBloom, int64_t& sharedSize, HashFileMap& tthIndex, DirMultiMap& aDirNames) noexcept;
+	static void updateIndices(Directory::Ptr& aDirectory, ShareBloom& aBloom, int64_t& sharedSize, HashFileMap& tthIndex, DirMultiMap& aDirNames, SearchIndex* aSearchIndex) noexcept;
 	static void updateIndices(Directory& dir, const Directory::File* f, ShareBloom& aBloom, int64_t& sharedSize, HashFileMap& tthIndex) noexcept;
 	void cleanIndices(Directory& dir) noexcept;
 	void addDirName(Directory::Ptr& dir) noexcept;
@@ -25,6 +25,7 @@
 #include "File.h"
 #include "GetSet.h"
 #include "HashValue.h"
+#include "ParallelBZOutputStream.h"
 #include "TigerHash.h"
 #include "Util.h"
 
@@ -53,6 +54,10 @@ class FileList {
 		unique_ptr<File> bzXmlRef;
 		string getFileName() const noexcept;
 
+		/** Compressed root directories of the previous list by the revisions of their roots, unchanged ones don't need to be serialized again */
+		typedef unordered_map<TTHValue, ParallelBZOutputStream::SegmentPtr> SegmentMap;
+		SegmentMap segments;
+
 		bool allowGenerateNew(bool force=false) noexcept;
 		void generationFinished(bool failed) noexcept;
 		void saveList();
@@ -21,77 +21,283 @@
 #include "DCPlusPlus.h"
 
 #include "SharedFileStream.h"
+#include "SettingsManager.h"
+#include "TimerManager.h"
 
 #ifdef _WIN32
 # include "Winioctl.h"
+#elif defined(__linux__)
+# include <fcntl.h>
 #endif
 
 namespace dcpp {
 
-CriticalSection SharedFileStream::cs;
-SharedFileStream::SharedFileHandleMap SharedFileStream::readpool;
-SharedFileStream::SharedFileHandleMap SharedFileStream::writepool;
+SharedFileStream::PoolShard SharedFileStream::shards[SharedFileStream::POOL_SHARDS];
+atomic<uint64_t> SharedFileStream::poolHits { 0 };
+atomic<uint64_t> SharedFileStream::poolMisses { 0 };
+atomic<uint64_t> SharedFileStream::poolContended { 0 };
+
+FastCriticalSection SharedFileStream::syncCs;
+unordered_map<string, uint64_t, noCaseStringHash, noCaseStringEq> SharedFileStream::pendingSyncs;
+CriticalSection SharedFileStream::syncRunCs;
+
+// Writes are aligned to the page size at least
+static const int64_t WRITE_ALIGNMENT = 4096;
+
+// Locks a pool shard and counts the times when it was held by another thread
+class SharedFileStream::ShardLock {
+public:
+	ShardLock(PoolShard& aShard) noexcept : shard(aShard) {
+		if (!shard.cs.try_lock()) {
+			poolContended++;
+			shard.cs.lock();
+		}
+	}
+
+	~ShardLock() noexcept {
+		shard.cs.unlock();
+	}
+private:
+	ShardLock& operator=(const ShardLock&);
+	PoolShard& shard;
+};
 
 SharedFileHandle::SharedFileHandle(const string& aPath, int aAccess, int aMode) : 
-	File(aPath, aAccess, aMode), ref_cnt(1), path(aPath), mode(aMode)
+	File(aPath, aAccess, aMode), ref_cnt(1), path(aPath), access(aAccess), mode(aMode)
 { }
 
-SharedFileStream::SharedFileStream(const string& aFileName, int aAccess, int aMode) {
-	Lock l(cs);
-	auto& pool = aAccess == File::READ ? readpool : writepool;
+SharedFileStream::PoolShard& SharedFileStream::getShard(const string& aPath) noexcept {
+	// Don't use the lowest bits that the pool maps use for their buckets
+	return shards[(noCaseStringHash()(aPath) >> 16) % POOL_SHARDS];
+}
+
+SharedFileStream::SharedFileStream(const string& aFileName, int aAccess, int aMode) : pos(0) {
+	if (aAccess != File::READ && SETTING(BUFFER_SIZE) > 0) {
+		blockSize = static_cast<size_t>(Util::roundUp(static_cast<int64_t>(SETTING(BUFFER_SIZE)) * 1024, WRITE_ALIGNMENT));
+	}
+
+	auto& shard = getShard(aFileName);
+	ShardLock l(shard);
+
+	auto& pool = shard.getPool(aAccess);
 	auto p = pool.find(aFileName);
 	if (p != pool.end()) {
 		sfh = p->second.get();
 		sfh->ref_cnt++;
+		poolHits++;
 	} else {
 	    sfh = new SharedFileHandle(aFileName, aAccess, aMode);
 		pool[aFileName] = unique_ptr<SharedFileHandle>(sfh);
+		poolMisses++;
 	}
 }
 
 SharedFileStream::~SharedFileStream() {
-	Lock l(cs);
+	bool written = false;
+
+	// Don't lose the data if the stream wasn't flushed
+	try {
+		written = writeBuffer();
+	} catch (const Exception&) { }
+
+	if (written) {
+		addPendingSync(sfh->path);
+	}
 
-	sfh->ref_cnt--;
-	if(sfh->ref_cnt == 0) {
-		auto& pool = sfh->mode == File::READ ? readpool : writepool;
-		pool.erase(sfh->path);
-    }
+	releaseHandle(sfh);
 }
 
-size_t SharedFileStream::write(const void* buf, size_t len) throw(Exception) {
-	Lock l(sfh->cs);
+void SharedFileStream::releaseHandle(SharedFileHandle* aHandle) noexcept {
+	auto& shard = getShard(aHandle->path);
+	ShardLock l(shard);
+
+	aHandle->ref_cnt--;
+	if(aHandle->ref_cnt == 0) {
+		shard.getPool(aHandle->access).erase(aHandle->path);
+	}
+}
+
+void SharedFileStream::writeBuffered(const uint8_t* aBuf, size_t aLen) {
+	if (blockSize == 0) {
+		sfh->writeAt(aBuf, aLen, pos);
+		return;
+	}
+
+	// The buffer must continue from the current position
+	if (!buffer.empty() && bufferStart + static_cast<int64_t>(buffer.size()) != pos) {
+		writeBuffer();
+	}
+
+	if (buffer.empty()) {
+		bufferStart = pos;
+	}
+
+	auto block = static_cast<int64_t>(blockSize);
+	while (aLen > 0) {
+		auto bufferEnd = bufferStart + static_cast<int64_t>(buffer.size());
+		auto blockEnd = (bufferStart / block + 1) * block;
+		auto bytes = static_cast<size_t>(min(static_cast<int64_t>(aLen), blockEnd - bufferEnd));
+
+		if (buffer.empty() && bytes == blockSize) {
+			// A full block, no need to copy it
+			sfh->writeAt(aBuf, bytes, bufferStart);
+		} else {
+			buffer.reserve(blockSize);
+			buffer.append(reinterpret_cast<const char*>(aBuf), bytes);
+			if (bufferEnd + static_cast<int64_t>(bytes) == blockEnd) {
+				sfh->writeAt(buffer.data(), buffer.size(), bufferStart);
+				buffer.clear();
+			}
+		}
 
-	sfh->setPos(pos);
-	sfh->write(buf, len);
+		if (buffer.empty()) {
+			bufferStart = blockEnd;
+		}
+
+		aBuf += bytes;
+		aLen -= bytes;
+	}
+}
+
+bool SharedFileStream::writeBuffer() {
+	if (buffer.empty()) {
+		return false;
+	}
+
+	sfh->writeAt(buffer.data(), buffer.size(), bufferStart);
+	buffer.clear();
+	return true;
+}
+
+size_t SharedFileStream::write(const void* buf, size_t len) throw(Exception) {
+	writeBuffered(static_cast<const uint8_t*>(buf), len);
 
     pos += len;
 	return len;
 }
 
 size_t SharedFileStream::read(void* buf, size_t& len) throw(Exception) {
-	Lock l(sfh->cs);
+	// Include the buffered data
+	writeBuffer();
 
-	sfh->setPos(pos);
-	len = sfh->read(buf, len);
+	len = sfh->readAt(buf, len, pos);
 
     pos += len;
 	return len;
 }
 
 int64_t SharedFileStream::getSize() const noexcept {
-	Lock l(sfh->cs);
 	return sfh->getSize();
 }
 
 void SharedFileStream::setSize(int64_t newSize) throw(FileException) {
 	Lock l(sfh->cs);
 	sfh->setSize(newSize);
+
+#ifdef __linux__
+	// Allocate the blocks in advance so that the segments being written in parallel won't fragment the file
+	// (the file is left sparse if the file system doesn't support it)
+	if (newSize > 0) {
+		::fallocate(sfh->getNativeHandle(), 0, 0, newSize);
+	}
+#endif
 }
 
 size_t SharedFileStream::flush() throw(Exception) {
-	Lock l(sfh->cs);
-	return sfh->flush();
+	writeBuffer();
+
+	if (SETTING(DOWNLOAD_SYNC_INTERVAL) <= 0) {
+		return sfh->flush();
+	}
+
+	addPendingSync(sfh->path);
+	return 0;
+}
+
+SharedFileStream::PoolStats SharedFileStream::getPoolStats() noexcept {
+	PoolStats stats;
+	stats.hits = poolHits;
+	stats.misses = poolMisses;
+	stats.contended = poolContended;
+
+	for (auto& shard: shards) {
+		Lock l(shard.cs);
+		stats.openHandles += shard.readpool.size() + shard.writepool.size();
+	}
+
+	return stats;
+}
+
+void SharedFileStream::addPendingSync(const string& aPath) noexcept {
+	FastLock l(syncCs);
+	pendingSyncs.emplace(aPath, GET_TICK());
+}
+
+void SharedFileStream::syncFiles(uint64_t aTick, bool aForce) noexcept {
+	Lock sl(syncRunCs);
+	StringList paths;
+
+	{
+		auto interval = static_cast<uint64_t>(max(SETTING(DOWNLOAD_SYNC_INTERVAL), 0)) * 1000;
+
+		FastLock l(syncCs);
+		for (auto i = pendingSyncs.begin(); i != pendingSyncs.end();) {
+			if (aForce || i->second + interval <= aTick) {
+				paths.push_back(i->first);
+				i = pendingSyncs.erase(i);
+			} else {
+				i++;
+			}
+		}
+	}
+
+	for (const auto& p: paths) {
+		syncFileImpl(p);
+	}
+}
+
+void SharedFileStream::syncFile(const string& aPath) noexcept {
+	Lock sl(syncRunCs);
+	{
+		FastLock l(syncCs);
+		if (pendingSyncs.erase(aPath) == 0) {
+			return;
+		}
+	}
+
+	syncFileImpl(aPath);
+}
+
+void SharedFileStream::syncFileImpl(const string& aPath) noexcept {
+	SharedFileHandle* h = nullptr;
+
+	{
+		auto& shard = getShard(aPath);
+		ShardLock l(shard);
+
+		auto p = shard.writepool.find(aPath);
+		if (p != shard.writepool.end()) {
+			h = p->second.get();
+			h->ref_cnt++;
+		}
+	}
+
+	try {
+		if (h) {
+			// The streams may keep writing meanwhile, only the data written before this call needs to be synced
+			h->File::flush();
+		} else {
+			File f(aPath, File::WRITE, File::OPEN | File::SHARED_WRITE);
+			f.flush();
+		}
+	} catch (const FileException& e) {
+		// The file may have been moved or removed meanwhile
+		dcdebug("SharedFileStream: failed to sync %s (%s)\n", aPath.c_str(), e.getError().c_str());
+	}
+
+	if (h) {
+		releaseHandle(h);
+	}
 }
 
 void SharedFileStream::setPos(int64_t aPos) noexcept {
@@ -30,9 +30,13 @@ struct SharedFileHandle : File {
 	SharedFileHandle(const string& aPath, int access, int mode);
 	~SharedFileHandle() noexcept { }
 
+	// Reads and writes are positional and don't need locking, this only serializes resizing
 	CriticalSection cs;
+
+	// Guarded by the lock of the pool shard
 	int	ref_cnt;
 	string path;
+	int access;
 	int mode;
 };
 
@@ -42,6 +46,19 @@ class SharedFileStream : public IOStream
 public:
 	typedef unordered_map<string, unique_ptr<SharedFileHandle>, noCaseStringHash, noCaseStringEq> SharedFileHandleMap;
 
+	struct PoolStats {
+		// Streams that got an existing handle/opened a new one
+		uint64_t hits = 0, misses = 0;
+
+		// Pool lookups that had to wait for another thread
+		uint64_t contended = 0;
+
+		size_t openHandles = 0;
+	};
+
+	// The handles are divided in independently locked pools by their path
+	static const size_t POOL_SHARDS = 16;
+
     SharedFileStream(const string& aFileName, int access, int mode);
     ~SharedFileStream();
 
@@ -51,14 +68,61 @@ public:
 	int64_t getSize() const noexcept;
 	void setSize(int64_t newSize) throw(FileException);
 
+	// Writes the buffered data of this stream in the file
+	// The file is synced to the disk later by syncFiles (unless the sync interval is disabled)
 	size_t flush() throw(Exception);
 
-    static CriticalSection cs;
-	static SharedFileHandleMap readpool;
-	static SharedFileHandleMap writepool;
+	/** Syncs the files that have had unsynced data for longer than the sync interval (or all of them if forced) */
+	static void syncFiles(uint64_t aTick, bool aForce) noexcept;
+
+	/**
+	 * Syncs the file immediately if it has unsynced data
+	 * All data written in the file before the call is on the disk when it returns
+	 */
+	static void syncFile(const string& aPath) noexcept;
+
+	static PoolStats getPoolStats() noexcept;
 
 	void setPos(int64_t aPos) noexcept;
 private:
+	struct PoolShard {
+		CriticalSection cs;
+		SharedFileHandleMap readpool;
+		SharedFileHandleMap writepool;
+
+		SharedFileHandleMap& getPool(int aAccess) noexcept { return aAccess == File::READ ? readpool : writepool; }
+	};
+
+	class ShardLock;
+
+	static PoolShard& getShard(const string& aPath) noexcept;
+	static void releaseHandle(SharedFileHandle* aHandle) noexcept;
+	static void addPendingSync(const string& aPath) noexcept;
+	static void syncFileImpl(const string& aPath) noexcept;
+
+	static PoolShard shards[POOL_SHARDS];
+	static atomic<uint64_t> poolHits;
+	static atomic<uint64_t> poolMisses;
+	static atomic<uint64_t> poolContended;
+
+	// Paths of the written files that haven't been synced yet, mapped to the time of the first unsynced write
+	static FastCriticalSection syncCs;
+	static unordered_map<string, uint64_t, noCaseStringHash, noCaseStringEq> pendingSyncs;
+
+	// Held while syncing, a file that isn't pending can't be in the middle of a sync in another thread
+	static CriticalSection syncRunCs;
+
+	// Coalesces the written data into aligned blocks that are written in the file once they are full
+	void writeBuffered(const uint8_t* aBuf, size_t aLen);
+	bool writeBuffer();
+
+	// Pending data inside a single aligned block
+	string buffer;
+	int64_t bufferStart = 0;
+
+	// Size of the aligned write blocks (0 if writes aren't buffered)
+	size_t blockSize = 0;
+
 	SharedFileHandle* sfh;
 	int64_t pos;
 };
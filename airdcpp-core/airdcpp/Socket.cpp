@@ -20,11 +20,16 @@
 #include "Socket.h"
 
 #include "ConnectivityManager.h"
+#include "File.h"
 #include "format.h"
 #include "SettingsManager.h"
 #include "TimerManager.h"
 #include "ResourceManager.h"
 
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
+
 /// @todo remove when MinGW has this
 #ifdef __MINGW32__
 #ifndef EADDRNOTAVAIL
@@ -573,6 +578,59 @@ int Socket::read(void* aBuffer, int aBufLen, string &aIP) {
 	return len;
 }
 
+int Socket::readBatch(Datagram* aDatagrams, int aCount) {
+	dcassert(type == TYPE_UDP);
+
+#ifdef HAVE_RECVMMSG
+	const int MAX_BATCH = 64;
+	aCount = std::min(aCount, MAX_BATCH);
+
+	mmsghdr msgs[MAX_BATCH];
+	iovec iovecs[MAX_BATCH];
+	addr addrs[MAX_BATCH];
+
+	memset(msgs, 0, sizeof(mmsghdr) * aCount);
+	for(int i = 0; i < aCount; ++i) {
+		iovecs[i].iov_base = aDatagrams[i].buf;
+		iovecs[i].iov_len = aDatagrams[i].bufLen;
+
+		msgs[i].msg_hdr.msg_name = &addrs[i].sa;
+		msgs[i].msg_hdr.msg_namelen = sizeof(addr);
+		msgs[i].msg_hdr.msg_iov = &iovecs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	auto count = check([&] {
+		return ::recvmmsg(readable(sock4, sock6), msgs, aCount, MSG_DONTWAIT, NULL);
+	}, true);
+
+	if(count <= 0) {
+		return 0;
+	}
+
+	for(int i = 0; i < count; ++i) {
+		auto& d = aDatagrams[i];
+		d.len = static_cast<int>(msgs[i].msg_len);
+		if(d.len > 0) {
+			d.ip = resolveName(&addrs[i].sa, msgs[i].msg_hdr.msg_namelen);
+			stats.totalDown += d.len;
+		} else {
+			d.ip.clear();
+		}
+	}
+
+	return count;
+#else
+	if(aCount == 0) {
+		return 0;
+	}
+
+	auto& d = aDatagrams[0];
+	d.len = read(d.buf, d.bufLen, d.ip);
+	return d.len == -1 ? 0 : 1;
+#endif
+}
+
 int Socket::readAll(void* aBuffer, int aBufLen, uint64_t timeout) {
 	uint8_t* buf = (uint8_t*)aBuffer;
 	int i = 0;
@@ -617,6 +675,27 @@ int Socket::write(const void* aBuffer, int aLen) {
 	return sent;
 }
 
+bool Socket::canSendFile() const noexcept {
+#ifdef HAVE_SYS_SENDFILE_H
+	return true;
+#else
+	return false;
+#endif
+}
+
+int Socket::sendFile(File& aFile, int aLen) {
+#ifdef HAVE_SYS_SENDFILE_H
+	auto sent = check([&] { return static_cast<int>(::sendfile(getSock(), aFile.getNativeHandle(), nullptr, aLen)); }, true);
+	if(sent > 0) {
+		stats.totalUp += sent;
+	}
+	return sent;
+#else
+	dcassert(0);
+	throw SocketException(ENOSYS);
+#endif
+}
+
 /**
  * Sends data, will block until all data has been sent or an exception occurs
  * @param aBuffer Buffer with data
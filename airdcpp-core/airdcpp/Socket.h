@@ -168,6 +168,16 @@ public:
 	void writeAll(const void* aBuffer, int aLen, uint64_t timeout = 0);
 	virtual int write(const void* aBuffer, int aLen);
 	int write(const string& aData) { return write(aData.data(), (int)aData.length()); }
+
+	/** Returns whether data can be sent directly from files (without copying it to user space) */
+	virtual bool canSendFile() const noexcept;
+
+	/**
+	 * Sends data directly from the current position of the file, which is advanced by the number of bytes sent.
+	 * @return Number of bytes sent, 0 if the end of file was reached and -1 if the call would block.
+	 * @throw SocketException On any failure.
+	 */
+	int sendFile(File& aFile, int aLen);
 	virtual void writeTo(const string& aIp, const string& aPort, const void* aBuffer, int aLen, bool proxy = true);
 	void writeTo(const string& aIp, const string& aPort, const string& aData) { writeTo(aIp, aPort, aData.data(), (int)aData.length()); }
 	virtual void shutdown() noexcept;
@@ -194,6 +204,24 @@ public:
 	 * @throw SocketException On any failure.
 	 */
 	virtual int read(void* aBuffer, int aBufLen, string &aIP);
+
+	struct Datagram {
+		uint8_t* buf;
+		int bufLen;
+
+		// Filled by readBatch
+		int len;
+		string ip;
+	};
+
+	/**
+	 * Reads multiple datagrams with a single call when it's supported by the system (UDP)
+	 * @param aDatagrams Datagrams with the buffers to store the data in.
+	 * @param aCount Number of datagrams.
+	 * @return Number of datagrams read (the rest are left untouched), 0 if the call would block.
+	 * @throw SocketException On any failure.
+	 */
+	int readBatch(Datagram* aDatagrams, int aCount);
 	/**
 	 * Reads data until aBufLen bytes have been read or an error occurs.
 	 * If the socket is closed, or the timeout is reached, the number of bytes read
@@ -247,6 +275,8 @@ public:
 	}
 
 	bool isV6Valid() const noexcept;
+
+	socket_t getSock() const;
 protected:
 	typedef union {
 		sockaddr sa;
@@ -255,8 +285,6 @@ protected:
 		sockaddr_storage sas;
 	} addr;
 
-	socket_t getSock() const;
-
 	mutable SocketHandle sock4;
 	mutable SocketHandle sock6;
 
@@ -0,0 +1,317 @@
+/*
+ * Copyright (C) 2011-2015 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "stdinc.h"
+#include "SocketReactor.h"
+
+#include "BufferedSocket.h"
+#include "SettingsManager.h"
+#include "TimerManager.h"
+
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
+namespace dcpp {
+
+// Maximum time to wait for events (in case something has been missed)
+#define POLL_TIMEOUT 250
+
+// Delay before retrying sockets that have run out of bandwidth
+#define THROTTLE_RETRY 100
+
+#define MAX_EVENTS 128
+
+SocketReactor::SocketReactor() {
+
+}
+
+SocketReactor::~SocketReactor() {
+	for (auto& w: workers) {
+		w->stop();
+	}
+}
+
+bool SocketReactor::startWorkers() noexcept {
+	auto count = max(SETTING(SOCKET_REACTOR_THREADS), 1);
+	for (int i = 0; i < count; ++i) {
+		unique_ptr<Worker> w(new Worker);
+		if (!w->isValid()) {
+			break;
+		}
+
+		w->start();
+		workers.push_back(move(w));
+	}
+
+	return !workers.empty();
+}
+
+bool SocketReactor::add(BufferedSocket* aSocket) noexcept {
+#ifdef HAVE_SYS_EPOLL_H
+	if (!SETTING(SOCKET_REACTOR)) {
+		return false;
+	}
+
+	{
+		Lock l(cs);
+		if (workers.empty() && !startWorkers()) {
+			return false;
+		}
+	}
+
+	// The workers won't change after they have been started
+	auto id = nextWorker++ % workers.size();
+	socketCount++;
+
+	{
+		// Tasks added from other threads must not reach the worker before the socket has been queued there
+		// (the lock order is the same as when scheduling the tasks)
+		Lock l(aSocket->cs);
+		workers[id]->add(aSocket);
+		aSocket->reactorId = static_cast<int>(id);
+	}
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+void SocketReactor::schedule(BufferedSocket* aSocket) noexcept {
+	workers[aSocket->reactorId]->schedule(aSocket);
+}
+
+void SocketReactor::unregister(BufferedSocket* aSocket) noexcept {
+	workers[aSocket->reactorId]->unregister(aSocket);
+}
+
+void SocketReactor::remove(BufferedSocket* aSocket) noexcept {
+	workers[aSocket->reactorId]->remove(aSocket);
+	socketCount--;
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+
+SocketReactor::Worker::Worker() : epollFd(epoll_create1(EPOLL_CLOEXEC)), eventFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {
+	if (epollFd != -1 && eventFd != -1) {
+		// The wakeup descriptor is identified by a null pointer
+		epoll_event ev = { };
+		ev.events = EPOLLIN;
+		ev.data.ptr = nullptr;
+		if (epoll_ctl(epollFd, EPOLL_CTL_ADD, eventFd, &ev) != 0) {
+			::close(eventFd);
+			eventFd = -1;
+		}
+	}
+}
+
+SocketReactor::Worker::~Worker() {
+	if (eventFd != -1)
+		::close(eventFd);
+	if (epollFd != -1)
+		::close(epollFd);
+}
+
+bool SocketReactor::Worker::isValid() const noexcept {
+	return epollFd != -1 && eventFd != -1;
+}
+
+void SocketReactor::Worker::stop() noexcept {
+	stopping = true;
+	wakeup();
+	join();
+}
+
+void SocketReactor::Worker::wakeup() noexcept {
+	uint64_t value = 1;
+	auto ret = ::write(eventFd, &value, sizeof(value));
+	(void)ret;
+}
+
+void SocketReactor::Worker::add(BufferedSocket* aSocket) noexcept {
+	{
+		Lock l(cs);
+		added.push_back(aSocket);
+	}
+
+	wakeup();
+}
+
+void SocketReactor::Worker::schedule(BufferedSocket* aSocket) noexcept {
+	bool wake = false;
+	{
+		Lock l(cs);
+		wake = scheduled.empty();
+		scheduled.insert(aSocket);
+	}
+
+	if (wake) {
+		wakeup();
+	}
+}
+
+void SocketReactor::Worker::unregister(BufferedSocket* aSocket) noexcept {
+	auto r = registered.find(aSocket);
+	if (r == registered.end()) {
+		return;
+	}
+
+	if (r->second != 0) {
+		epoll_event ev = { };
+		epoll_ctl(epollFd, EPOLL_CTL_DEL, aSocket->sock->getSock(), &ev);
+	}
+
+	registered.erase(r);
+}
+
+void SocketReactor::Worker::remove(BufferedSocket* aSocket) noexcept {
+	unregister(aSocket);
+	pending.erase(aSocket);
+	throttled.erase(aSocket);
+
+	Lock l(cs);
+	scheduled.erase(aSocket);
+	added.erase(std::remove(added.begin(), added.end(), aSocket), added.end());
+}
+
+void SocketReactor::Worker::update(BufferedSocket* aSocket, int aFlags) noexcept {
+	uint32_t events = 0;
+	if (aFlags & BufferedSocket::REACTOR_READ)
+		events |= EPOLLIN;
+	if (aFlags & BufferedSocket::REACTOR_WRITE)
+		events |= EPOLLOUT;
+
+	auto r = registered.find(aSocket);
+	if (r != registered.end() && r->second != events) {
+		// Sockets without any wanted events are removed from the set as errors and hangups would be reported for them anyway
+		epoll_event ev = { };
+		ev.events = events;
+		ev.data.ptr = aSocket;
+
+		auto op = r->second == 0 ? EPOLL_CTL_ADD : events == 0 ? EPOLL_CTL_DEL : EPOLL_CTL_MOD;
+		if (epoll_ctl(epollFd, op, aSocket->sock->getSock(), &ev) == 0) {
+			r->second = events;
+		} else {
+			dcdebug("SocketReactor: failed to update the events of a socket (%d)\n", errno);
+		}
+	}
+
+	if (aFlags & BufferedSocket::REACTOR_PENDING) {
+		pending.insert(aSocket);
+	}
+
+	if (aFlags & BufferedSocket::REACTOR_THROTTLED) {
+		throttled[aSocket] = GET_TICK() + THROTTLE_RETRY;
+	}
+}
+
+int SocketReactor::Worker::run() {
+	epoll_event events[MAX_EVENTS];
+
+	// Sockets to run during this round and their events
+	unordered_map<BufferedSocket*, uint32_t> active;
+	vector<BufferedSocket*> newSockets;
+
+	while (!stopping) {
+		auto timeout = !pending.empty() ? 0 : !throttled.empty() ? THROTTLE_RETRY : POLL_TIMEOUT;
+		auto n = epoll_wait(epollFd, events, MAX_EVENTS, timeout);
+		for (int i = 0; i < n; ++i) {
+			if (!events[i].data.ptr) {
+				uint64_t value;
+				auto ret = ::read(eventFd, &value, sizeof(value));
+				(void)ret;
+				continue;
+			}
+
+			active[static_cast<BufferedSocket*>(events[i].data.ptr)] |= events[i].events;
+		}
+
+		{
+			Lock l(cs);
+			newSockets.swap(added);
+			for (auto s: scheduled) {
+				active[s];
+			}
+			scheduled.clear();
+		}
+
+		for (auto s: newSockets) {
+			epoll_event ev = { };
+			ev.events = EPOLLIN;
+			ev.data.ptr = s;
+			if (epoll_ctl(epollFd, EPOLL_CTL_ADD, s->sock->getSock(), &ev) == 0) {
+				registered.emplace(s, EPOLLIN);
+			} else {
+				dcdebug("SocketReactor: failed to add a socket (%d)\n", errno);
+				s->disconnect(true);
+			}
+
+			// Run the tasks that were added before the socket was moved here
+			active[s];
+		}
+		newSockets.clear();
+
+		for (auto s: pending) {
+			active[s];
+		}
+		pending.clear();
+
+		if (!throttled.empty()) {
+			auto tick = GET_TICK();
+			for (auto i = throttled.begin(); i != throttled.end();) {
+				if (i->second <= tick) {
+					active[i->first];
+					i = throttled.erase(i);
+				} else {
+					++i;
+				}
+			}
+		}
+
+		for (const auto& a: active) {
+			auto s = a.first;
+			auto flags = s->reactorRun((a.second & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0, (a.second & (EPOLLOUT | EPOLLHUP | EPOLLERR)) != 0);
+			if (!(flags & BufferedSocket::REACTOR_DELETED)) {
+				update(s, flags);
+			}
+		}
+		active.clear();
+	}
+
+	return 0;
+}
+
+#else
+
+SocketReactor::Worker::Worker() { }
+SocketReactor::Worker::~Worker() { }
+bool SocketReactor::Worker::isValid() const noexcept { return false; }
+void SocketReactor::Worker::stop() noexcept { }
+void SocketReactor::Worker::wakeup() noexcept { }
+void SocketReactor::Worker::add(BufferedSocket*) noexcept { }
+void SocketReactor::Worker::schedule(BufferedSocket*) noexcept { }
+void SocketReactor::Worker::unregister(BufferedSocket*) noexcept { }
+void SocketReactor::Worker::remove(BufferedSocket*) noexcept { }
+void SocketReactor::Worker::update(BufferedSocket*, int) noexcept { }
+int SocketReactor::Worker::run() { return 0; }
+
+#endif
+
+} // namespace dcpp
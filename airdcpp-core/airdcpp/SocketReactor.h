@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2011-2015 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef DCPLUSPLUS_DCPP_SOCKET_REACTOR_H
+#define DCPLUSPLUS_DCPP_SOCKET_REACTOR_H
+
+#include "typedefs.h"
+
+#include "CriticalSection.h"
+#include "Singleton.h"
+#include "Thread.h"
+
+namespace dcpp {
+
+class BufferedSocket;
+
+/**
+ * Multiplexes the I/O of connected BufferedSockets with a fixed number of threads (epoll),
+ * instead of having a thread for each socket.
+ *
+ * Each socket is handled by a single reactor thread, which fires all of its listener events
+ * and runs the tasks of the socket, so the events have the same ordering as in the threaded mode.
+ * Connecting (including the TLS handshake) is still performed by the thread of the socket.
+ */
+class SocketReactor : public Singleton<SocketReactor> {
+public:
+	/** Moves a connected socket to the reactor. Returns false if the socket should keep using its own thread. */
+	bool add(BufferedSocket* aSocket) noexcept;
+
+	/** Wakes up the reactor thread of the socket (new tasks have been added) */
+	void schedule(BufferedSocket* aSocket) noexcept;
+
+	/** Stops monitoring the descriptor of the socket. Must be called from the reactor thread of the socket before closing it. */
+	void unregister(BufferedSocket* aSocket) noexcept;
+
+	/** Forgets the socket completely. Must be called from the reactor thread of the socket before deleting it. */
+	void remove(BufferedSocket* aSocket) noexcept;
+
+	size_t getSocketCount() const noexcept { return socketCount; }
+private:
+	friend class Singleton<SocketReactor>;
+
+	class Worker : public Thread {
+	public:
+		Worker();
+		~Worker();
+
+		bool isValid() const noexcept;
+
+		void add(BufferedSocket* aSocket) noexcept;
+		void schedule(BufferedSocket* aSocket) noexcept;
+		void unregister(BufferedSocket* aSocket) noexcept;
+		void remove(BufferedSocket* aSocket) noexcept;
+
+		void stop() noexcept;
+	private:
+		int run();
+
+		void wakeup() noexcept;
+		void update(BufferedSocket* aSocket, int aFlags) noexcept;
+
+		int epollFd = -1;
+		int eventFd = -1;
+		atomic<bool> stopping { false };
+
+		// Shared with other threads
+		CriticalSection cs;
+		vector<BufferedSocket*> added;
+		unordered_set<BufferedSocket*> scheduled;
+
+		// Used only by the worker thread
+
+		/** Descriptors being monitored and their current event mask */
+		unordered_map<BufferedSocket*, uint32_t> registered;
+
+		/** Sockets that have work left to do without waiting for events */
+		unordered_set<BufferedSocket*> pending;
+
+		/** Sockets waiting for bandwidth and the time when they should be retried */
+		unordered_map<BufferedSocket*, uint64_t> throttled;
+	};
+
+	SocketReactor();
+	~SocketReactor();
+
+	bool startWorkers() noexcept;
+
+	CriticalSection cs;
+	vector<unique_ptr<Worker>> workers;
+	atomic<size_t> nextWorker { 0 };
+	atomic<size_t> socketCount { 0 };
+};
+
+} // namespace dcpp
+
+#endif // !defined(DCPLUSPLUS_DCPP_SOCKET_REACTOR_H)
@@ -82,6 +82,15 @@ public:
 	/* This only works for file streams */
 	virtual void setPos(int64_t /*pos*/) noexcept { }
 	virtual InputStream* releaseRootStream() { return this; }
+
+	/**
+	 * Zero-copy support: returns the file that the rest of the data is read from without modifications
+	 * (starting from the current file position) or nullptr if the data must be read via the stream.
+	 * @param maxBytes_ Maximum number of bytes that may be sent from the file, -1 if there's no limit
+	 */
+	virtual File* getDirectFile(int64_t& /*maxBytes_*/) noexcept { return nullptr; }
+	/** Called after the data has been sent directly from the file returned by getDirectFile */
+	virtual void skipDirect(int64_t /*aBytes*/) noexcept { }
 };
 
 class MemoryInputStream : public InputStream {
@@ -169,6 +178,17 @@ public:
 		auto as = s.release();
 		return as->releaseRootStream();
 	}
+
+	File* getDirectFile(int64_t& maxBytes_) noexcept {
+		auto f = s->getDirectFile(maxBytes_);
+		maxBytes_ = maxBytes_ == -1 ? maxBytes : min(maxBytes, maxBytes_);
+		return f;
+	}
+
+	void skipDirect(int64_t aBytes) noexcept {
+		maxBytes -= aBytes;
+		s->skipDirect(aBytes);
+	}
 private:
 	unique_ptr<InputStream> s;
 	int64_t maxBytes;
@@ -1564,6 +1564,7 @@ enum Strings { // @DontAdd
 	SHARED_FILE_ADDED, // "The file %1% has been added in share"
 	SHARED_FILE_DELETED, // "The file %1% has been removed from share"
 	SHARED_FILE_RENAMED, // "The shared file %1% has been renamed to %2%"
+	SHARE_CACHE_LOADED, // "The share cache of %1% root directories has been loaded in %2% ms"
 	SHARE_HIDDEN, // "Share hidden"
 	SHARE_PROFILE, // "Share profile"
 	SHARE_PROFILES, // "Share profiles"
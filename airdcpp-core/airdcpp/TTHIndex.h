@@ -0,0 +1,255 @@
+/*
+ * Copyright (C) 2011-2015 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef DCPLUSPLUS_DCPP_TTH_INDEX_H
+#define DCPLUSPLUS_DCPP_TTH_INDEX_H
+
+#include "typedefs.h"
+
+#include "MerkleTree.h"
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#include <boost/noncopyable.hpp>
+
+namespace dcpp {
+
+/**
+ * Maps TTHs to values (multiple values per TTH are allowed) using open addressing with
+ * linear probing. The TTH bits are uniform so they are used as the hash value directly.
+ *
+ * Lookups don't need any locking and may run concurrently with a writer. Slots are filled
+ * before they are published and removed slots are only marked as such, so their content never
+ * changes while the table is in use. When the table is full, the values are moved to a new
+ * table and the old one is freed after all readers that may still be using it have finished.
+ *
+ * Writers must be serialized by the caller. The index doesn't keep the values alive, so the caller
+ * must ensure that they stay valid while they are being used by the readers. Values that have been
+ * erased can be freed after calling synchronize(), if the readers are using them only while holding a ReadGuard.
+ */
+template<class T>
+class TTHIndex : boost::noncopyable {
+public:
+	TTHIndex() : table(new Table(MIN_SIZE)) { }
+	~TTHIndex() { delete table.load(); }
+
+	/** Calls aF for the values of the TTH until it returns true (the callback must not block). Returns the result of the last call. */
+	template<class F>
+	bool find(const TTHValue& aTTH, F aF) const noexcept {
+		ReadGuard g(*this);
+		auto t = table.load();
+		for (auto i = getHash(aTTH) & t->mask;; i = (i + 1) & t->mask) {
+			const auto& s = t->slots[i];
+			auto state = s.state.load(std::memory_order_acquire);
+			if (state == EMPTY) {
+				return false;
+			}
+
+			if (state == USED && s.tth == aTTH && aF(s.value)) {
+				return true;
+			}
+		}
+	}
+
+	bool contains(const TTHValue& aTTH) const noexcept {
+		return find(aTTH, [](const T&) { return true; });
+	}
+
+	/** Calls aF with the TTH and value of each item (the callback must not block) */
+	template<class F>
+	void forEach(F aF) const {
+		ReadGuard g(*this);
+		auto t = table.load();
+		for (size_t i = 0; i <= t->mask; ++i) {
+			const auto& s = t->slots[i];
+			if (s.state.load(std::memory_order_acquire) == USED) {
+				aF(s.tth, s.value);
+			}
+		}
+	}
+
+	size_t size() const noexcept { return count; }
+
+	/** Values found while holding the guard won't be freed before it's released (see synchronize) */
+	class ReadGuard {
+	public:
+		ReadGuard(const TTHIndex& aIndex) noexcept : index(aIndex) {
+			// The epoch may be advanced by a writer after reading it, make sure that it's waiting for the right counter
+			for (;;) {
+				epoch = index.epoch.load();
+				index.readers[epoch & 1]++;
+				if (index.epoch.load() == epoch) {
+					break;
+				}
+
+				index.readers[epoch & 1]--;
+			}
+		}
+
+		~ReadGuard() {
+			index.readers[epoch & 1]--;
+		}
+	private:
+		const TTHIndex& index;
+		uint64_t epoch;
+	};
+
+	/** Waits until the readers that may have seen the erased values or the previous table have finished */
+	void synchronize() noexcept {
+		// Parallel calls would wait for the wrong readers
+		std::lock_guard<std::mutex> l(syncMutex);
+
+		auto e = epoch++;
+		while (readers[e & 1] > 0) {
+			std::this_thread::yield();
+		}
+	}
+
+	// Writers
+
+	void insert(const TTHValue& aTTH, const T& aValue) noexcept {
+		auto t = table.load();
+		if ((t->used + 1) * 4 > (t->mask + 1) * 3) {
+			t = rebuild(count + 1);
+		}
+
+		add(*t, aTTH, aValue);
+		count++;
+	}
+
+	/** Adds the items from an index that isn't being accessed concurrently */
+	void insert(const TTHIndex& aOther) noexcept {
+		auto t = table.load();
+		if ((t->used + aOther.count) * 4 > (t->mask + 1) * 3) {
+			t = rebuild(count + aOther.count);
+		}
+
+		aOther.forEach([&](const TTHValue& aTTH, const T& aValue) {
+			add(*t, aTTH, aValue);
+		});
+		count += aOther.count;
+	}
+
+	/** Returns false if the value wasn't found */
+	bool erase(const TTHValue& aTTH, const T& aValue) noexcept {
+		auto t = table.load();
+		for (auto i = getHash(aTTH) & t->mask;; i = (i + 1) & t->mask) {
+			auto& s = t->slots[i];
+			auto state = s.state.load(std::memory_order_relaxed);
+			if (state == EMPTY) {
+				return false;
+			}
+
+			if (state == USED && s.value == aValue && s.tth == aTTH) {
+				s.state.store(REMOVED, std::memory_order_release);
+				count--;
+				return true;
+			}
+		}
+	}
+
+	/** Publishes the items of an index that isn't being accessed concurrently, the other index will receive the old items */
+	void swap(TTHIndex& aOther) noexcept {
+		auto old = table.exchange(aOther.table.load());
+		synchronize();
+		aOther.table.store(old);
+
+		size_t tmp = count;
+		count = aOther.count.load();
+		aOther.count = tmp;
+	}
+private:
+	static const size_t MIN_SIZE = 1024;
+
+	enum SlotState : uint8_t {
+		EMPTY,
+		USED,
+		REMOVED
+	};
+
+	struct Slot {
+		std::atomic<uint8_t> state { EMPTY };
+		TTHValue tth;
+		T value;
+	};
+
+	struct Table {
+		Table(size_t aSize) : mask(aSize - 1), slots(new Slot[aSize]) { }
+
+		const size_t mask;
+		unique_ptr<Slot[]> slots;
+
+		// Used and removed slots
+		size_t used = 0;
+	};
+
+	static size_t getHash(const TTHValue& aTTH) noexcept {
+		size_t ret;
+		memcpy(&ret, aTTH.data, sizeof(size_t));
+		return ret;
+	}
+
+	static void add(Table& aTable, const TTHValue& aTTH, const T& aValue) noexcept {
+		// Removed slots aren't reused as readers may still be comparing their content
+		for (auto i = getHash(aTTH) & aTable.mask;; i = (i + 1) & aTable.mask) {
+			auto& s = aTable.slots[i];
+			if (s.state.load(std::memory_order_relaxed) == EMPTY) {
+				s.tth = aTTH;
+				s.value = aValue;
+				s.state.store(USED, std::memory_order_release);
+				aTable.used++;
+				return;
+			}
+		}
+	}
+
+	/** Moves the items to a new table with room for at least aCount items, returns the new table */
+	Table* rebuild(size_t aCount) noexcept {
+		auto size = MIN_SIZE;
+		while (size < aCount * 2) {
+			size *= 2;
+		}
+
+		auto old = table.load();
+		auto t = new Table(size);
+		for (size_t i = 0; i <= old->mask; ++i) {
+			const auto& s = old->slots[i];
+			if (s.state.load(std::memory_order_relaxed) == USED) {
+				add(*t, s.tth, s.value);
+			}
+		}
+
+		table.store(t);
+		synchronize();
+		delete old;
+		return t;
+	}
+
+	std::atomic<Table*> table;
+	std::atomic<size_t> count { 0 };
+
+	mutable std::atomic<uint64_t> epoch { 0 };
+	mutable std::atomic<int> readers[2] = { { 0 }, { 0 } };
+	std::mutex syncMutex;
+};
+
+} // namespace dcpp
+
+#endif // !defined(DCPLUSPLUS_DCPP_TTH_INDEX_H)
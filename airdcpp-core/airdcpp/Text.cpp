@@ -25,6 +25,7 @@
 #include <errno.h>
 #include <iconv.h>
 #include <langinfo.h>
+#include <strings.h>
 
 #ifndef ICONV_CONST
  #define ICONV_CONST
@@ -34,6 +35,11 @@
 
 #include "Util.h"
 
+#if defined(__SSE2__) || defined(_M_X64)
+#define TEXT_SSE2
+#include <emmintrin.h>
+#endif
+
 namespace dcpp {
 
 namespace Text {
@@ -41,6 +47,68 @@ namespace Text {
 const string utf8 = "utf-8"; // optimization
 string systemCharset;
 
+#ifndef _WIN32
+namespace {
+
+// Opening a converter is expensive, keep the recently used ones for each thread
+class ConverterCache {
+public:
+	~ConverterCache() {
+		for(const auto& c: converters) {
+			if(c.cd != (iconv_t)-1)
+				iconv_close(c.cd);
+		}
+	}
+
+	// Returns a converter in the initial state ((iconv_t)-1 if the conversion isn't supported)
+	iconv_t get(const string& aFrom, const string& aTo) noexcept {
+		for(const auto& c: converters) {
+			if(c.from == aFrom && c.to == aTo) {
+				if(c.cd != (iconv_t)-1)
+					iconv(c.cd, nullptr, nullptr, nullptr, nullptr);
+				return c.cd;
+			}
+		}
+
+		if(converters.size() == MAX_CONVERTERS) {
+			if(converters.front().cd != (iconv_t)-1)
+				iconv_close(converters.front().cd);
+			converters.erase(converters.begin());
+		}
+
+		Converter c = { aFrom, aTo, iconv_open(aTo.c_str(), aFrom.c_str()) };
+		converters.push_back(c);
+		return c.cd;
+	}
+private:
+	struct Converter {
+		string from;
+		string to;
+		iconv_t cd;
+	};
+
+	static const size_t MAX_CONVERTERS = 8;
+	vector<Converter> converters;
+};
+
+thread_local ConverterCache converterCache;
+
+}
+#endif
+
+// Whether the charset encodes ASCII characters as such (nothing needs to be converted for pure ASCII text)
+static bool isAsciiCompatible(const string& charset) noexcept {
+#ifdef _WIN32
+	// ANSI code pages
+	return true;
+#else
+	static const char* compatible[] = { "utf-8", "utf8", "ascii", "us-ascii", "ansi_x3.4", "iso-8859", "iso8859", "iso_8859", "latin", "cp125", "windows-125", "koi8", "gb", "big5", "euc-" };
+
+	const auto& cs = charset.empty() ? systemCharset : charset;
+	return any_of(begin(compatible), end(compatible), [&](const char* c) { return strncasecmp(cs.c_str(), c, strlen(c)) == 0; });
+#endif
+}
+
 void initialize() {
 	setlocale(LC_ALL, "");
 
@@ -70,11 +138,40 @@ int getCodePage(const string& charset) {
 #endif
 
 bool isAscii(const char* str) noexcept {
-	for(const uint8_t* p = (const uint8_t*)str; *p; ++p) {
-		if(*p & 0x80)
-			return false;
+	auto len = strlen(str);
+	return asciiLength(str, len) == len;
+}
+
+size_t asciiLength(const char* str, size_t len) noexcept {
+	size_t i = 0;
+#ifdef TEXT_SSE2
+	for(; i + 16 <= len; i += 16) {
+		if(_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(str + i))) != 0)
+			break;
+	}
+#endif
+	for(; i < len; ++i) {
+		if(str[i] & 0x80)
+			break;
+	}
+	return i;
+}
+
+void asciiToLower(const char* str, size_t len, char* out) noexcept {
+	size_t i = 0;
+#ifdef TEXT_SSE2
+	const auto beforeA = _mm_set1_epi8('A' - 1);
+	const auto afterZ = _mm_set1_epi8('Z' + 1);
+	const auto caseBit = _mm_set1_epi8(0x20);
+	for(; i + 16 <= len; i += 16) {
+		auto c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(str + i));
+		auto upper = _mm_and_si128(_mm_cmpgt_epi8(c, beforeA), _mm_cmplt_epi8(c, afterZ));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_or_si128(c, _mm_and_si128(upper, caseBit)));
+	}
+#endif
+	for(; i < len; ++i) {
+		out[i] = (str[i] >= 'A' && str[i] <= 'Z') ? (str[i] | 0x20) : str[i];
 	}
-	return true;
 }
 
 int utf8ToWc(const char* str, wchar_t& c) {
@@ -264,6 +361,10 @@ string wideToAcp(const wstring& str, const string& toCharset) noexcept {
 bool validateUtf8(const string& str) noexcept {
 	string::size_type i = 0;
 	while(i < str.length()) {
+		i += asciiLength(str.data() + i, str.length() - i);
+		if(i == str.length())
+			break;
+
 		wchar_t dummy = 0;
 		int j = utf8ToWc(&str[i], dummy);
 		if(j < 0)
@@ -338,6 +439,15 @@ string toLower(const string& str) noexcept {
 	tmp.reserve(str.length());
 	const char* end = &str[0] + str.length();
 	for(const char* p = &str[0]; p < end;) {
+		auto ascii = asciiLength(p, end - p);
+		if(ascii > 0) {
+			auto pos = tmp.size();
+			tmp.resize(pos + ascii);
+			asciiToLower(p, ascii, &tmp[pos]);
+			p += ascii;
+			continue;
+		}
+
 		wchar_t c = 0;
 		int n = utf8ToWc(p, c);
 		if(n < 0) {
@@ -357,7 +467,7 @@ string toUtf8(const string& str, const string& fromCharset) noexcept {
 	}
 
 #ifdef _WIN32
-	if (fromCharset == utf8) {
+	if (fromCharset == utf8 || isAscii(str)) {
 		return str;
 	}
 
@@ -373,7 +483,7 @@ string fromUtf8(const string& str, const string& toCharset) noexcept {
 	}
 
 #ifdef _WIN32
-	if (toCharset == utf8) {
+	if (toCharset == utf8 || isAscii(str)) {
 		return str;
 	}
 
@@ -387,6 +497,9 @@ string convert(const string& str, const string& fromCharset, const string& toCha
 	if(str.empty())
 		return str;
 
+	if(isAscii(str) && isAsciiCompatible(fromCharset) && isAsciiCompatible(toCharset))
+		return str;
+
 #ifdef _WIN32
 	if (Util::stricmp(fromCharset, toCharset) == 0)
 		return str;
@@ -400,8 +513,8 @@ string convert(const string& str, const string& fromCharset, const string& toCha
 	return str;
 #else
 
-	// Initialize the converter
-	iconv_t cd = iconv_open(toCharset.c_str(), fromCharset.c_str());
+	// Get the converter
+	iconv_t cd = converterCache.get(fromCharset, toCharset);
 	if(cd == (iconv_t)-1)
 		return str;
 
@@ -434,7 +547,6 @@ string convert(const string& str, const string& fromCharset, const string& toCha
 			}
 		}
 	}
-	iconv_close(cd);
 	if(outleft > 0) {
 		tmp.resize(len - outleft);
 	}
@@ -77,13 +77,19 @@ namespace Text {
 		return tmp;
 	}
 
-	inline bool isAscii(const string& str) noexcept { return isAscii(str.c_str()); }
+	/** Returns the length of the pure ASCII prefix */
+	size_t asciiLength(const char* str, size_t len) noexcept;
+
+	inline bool isAscii(const string& str) noexcept { return asciiLength(str.data(), str.length()) == str.length(); }
 	bool isAscii(const char* str) noexcept;
 
 	bool validateUtf8(const string& str) noexcept;
 
 	inline char asciiToLower(char c) { dcassert((((uint8_t)c) & 0x80) == 0); return (char)tolower(c); }
 
+	/** Lowercases pure ASCII text (the buffers may be the same) */
+	void asciiToLower(const char* str, size_t len, char* out) noexcept;
+
 	wchar_t toLower(wchar_t c) noexcept;
 
 	wstring toLower(const wstring& str) noexcept;
@@ -19,12 +19,19 @@
 #include "stdinc.h"
 #include "ThrottleManager.h"
 
+#include "Bundle.h"
+#include "Download.h"
 #include "DownloadManager.h"
+#include "LogManager.h"
+#include "SimpleXML.h"
 #include "Singleton.h"
 #include "Socket.h"
 #include "Thread.h"
 #include "TimerManager.h"
+#include "Upload.h"
 #include "UploadManager.h"
+#include "UserConnection.h"
+#include "User.h"
 #include "ClientManager.h"
 
 namespace dcpp {
@@ -33,79 +40,317 @@ namespace dcpp {
  * Inspired by Token Bucket algorithm: http://en.wikipedia.org/wiki/Token_bucket
  */
 
+// Time to sleep when there are no tokens available (blocking mode)
+#define TOKEN_WAIT 10
+
+#define CONFIG_DIR Util::PATH_USER_CONFIG
+#define CONFIG_NAME "TransferLimits.xml"
+
 /*
  * Throttles traffic and reads a packet from the network
  */
-int ThrottleManager::read(Socket* sock, void* buffer, size_t len)
+int ThrottleManager::read(Socket* sock, void* buffer, size_t len, bool* throttled_, const TransferLimitList* aLimits)
 {
-	int64_t readSize = -1;
+	if (throttled_)
+		*throttled_ = false;
+
+	int64_t readSize = static_cast<int64_t>(len);
 	size_t downs = DownloadManager::getInstance()->getDownloadCount();
 	auto downLimit = getDownLimit(); // avoid even intra-function races
-	if(!getCurThrottling() || downLimit == 0 || downs == 0)
-		return sock->read(buffer, len);
 
-	{
-		Lock l(downCS);
+	bool useGlobal = active && downLimit != 0 && downs != 0;
+	if (useGlobal) {
+		downBucket.setRate(static_cast<int64_t>(downLimit) * 1024);
 
-		if(downTokens > 0)
-		{
-			int64_t slice = (downLimit * 1024) / downs;
-			readSize = min(slice, min(static_cast<int64_t>(len), downTokens));
+		int64_t slice = (downLimit * 1024) / downs;
+		readSize = min(slice, readSize);
+	}
 
-			// read from socket
-			readSize = sock->read(buffer, static_cast<size_t>(readSize));
+	BucketArray buckets;
+	auto count = getBuckets(buckets, useGlobal ? &downBucket : nullptr, &TransferLimit::down, aLimits);
+	if (count == 0)
+		return sock->read(buffer, len);
 
-			if(readSize > 0)
-				downTokens -= readSize;
-		}
+	readSize = takeTokens(buckets, count, readSize);
+	if (readSize == 0) {
+		if (throttled_)
+			*throttled_ = true;
+		else
+			waitToken();
+		return -1;	// from BufferedSocket: -1 = retry, 0 = connection close
 	}
 
-	if(readSize != -1)
-	{
-		Thread::yield(); // give a chance to other transfers to get a token
-		return static_cast<int>(readSize);
+	// read from socket
+	int received = -1;
+	try {
+		received = sock->read(buffer, static_cast<size_t>(readSize));
+	} catch (...) {
+		giveTokens(buckets, count, readSize);
+		throw;
 	}
 
-	waitToken();
-	return -1;	// from BufferedSocket: -1 = retry, 0 = connection close
+	giveTokens(buckets, count, readSize - max(received, 0));
+	return received;
 }
 
 /*
  * Throttles traffic and writes a packet to the network
  * Handle this a little bit differently than downloads due to OpenSSL stupidity 
  */
-int ThrottleManager::write(Socket* sock, void* buffer, size_t& len)
+int ThrottleManager::write(Socket* sock, void* buffer, size_t& len, bool* throttled_, const TransferLimitList* aLimits)
 {
-	bool gotToken = false;
+	if (throttled_)
+		*throttled_ = false;
+
+	int64_t writeSize = static_cast<int64_t>(len);
 	size_t ups = UploadManager::getInstance()->getUploadCount();
 	auto upLimit = getUpLimit(); // avoid even intra-function races
-	if(!getCurThrottling() || upLimit == 0 || ups == 0)
+
+	bool useGlobal = active && upLimit != 0 && ups != 0;
+	if (useGlobal) {
+		upBucket.setRate(static_cast<int64_t>(upLimit) * 1024);
+
+		int64_t slice = (upLimit * 1024) / ups;
+		writeSize = min(slice, writeSize);
+	}
+
+	BucketArray buckets;
+	auto count = getBuckets(buckets, useGlobal ? &upBucket : nullptr, &TransferLimit::up, aLimits);
+	if (count == 0)
 		return sock->write(buffer, len);
 
+	writeSize = takeTokens(buckets, count, writeSize);
+	if (writeSize == 0) {
+		if (throttled_)
+			*throttled_ = true;
+		else
+			waitToken();
+		return 0;	// from BufferedSocket: -1 = failed, 0 = retry
+	}
+
+	// The caller will retry failed writes with the same size without the limiter, keep the tokens used in that case
+	len = static_cast<size_t>(writeSize);
+	int sent = sock->write(buffer, len);
+	if (sent >= 0) {
+		giveTokens(buckets, count, writeSize - sent);
+	}
+
+	return sent;
+}
+
+size_t ThrottleManager::getBuckets(BucketArray& buckets_, TokenBucket* aGlobal, TokenBucket TransferLimit::*aDirection, const TransferLimitList* aLimits) noexcept {
+	size_t count = 0;
+	if (aGlobal) {
+		buckets_[count++] = aGlobal;
+	}
+
+	if (aLimits) {
+		for (const auto& l: *aLimits) {
+			auto& bucket = (*l).*aDirection;
+			if (bucket.getRate() > 0 && count < MAX_BUCKETS) {
+				buckets_[count++] = &bucket;
+			}
+		}
+	}
+
+	return count;
+}
+
+int64_t ThrottleManager::takeTokens(BucketArray& aBuckets, size_t aCount, int64_t aBytes) noexcept {
+	for (size_t i = 0; i < aCount; ++i) {
+		auto taken = aBuckets[i]->take(aBytes);
+		if (taken < aBytes) {
+			// Return the extra tokens to the previous buckets
+			giveTokens(aBuckets, i, aBytes - taken);
+			aBytes = taken;
+		}
+
+		if (aBytes == 0) {
+			break;
+		}
+	}
+
+	return aBytes;
+}
+
+void ThrottleManager::giveTokens(BucketArray& aBuckets, size_t aCount, int64_t aBytes) noexcept {
+	if (aBytes <= 0)
+		return;
+
+	for (size_t i = 0; i < aCount; ++i) {
+		aBuckets[i]->give(aBytes);
+	}
+}
+
+void ThrottleManager::updateLimit(const TransferLimitPtr& aLimit, int aUpLimit, int aDownLimit) noexcept {
+	aLimit->up.setRate(static_cast<int64_t>(aUpLimit) * 1024);
+	aLimit->down.setRate(static_cast<int64_t>(aDownLimit) * 1024);
+}
+
+void ThrottleManager::setUserLimit(const CID& aUser, int aUpLimit, int aDownLimit) noexcept {
+	bool added = false, removed = false;
 	{
-		Lock l(upCS);
+		WLock l(cs);
+		auto& limit = userLimits[aUser];
+		if (!limit) {
+			limit = make_shared<TransferLimit>();
+			added = true;
+		}
 
-		if(upTokens > 0)
-		{
-			size_t slice = (upLimit * 1024) / ups;
-			len = min(slice, min(len, static_cast<size_t>(upTokens)));
-			upTokens -= len;
+		// Running transfers hold a reference to the old limit object, update it as well
+		updateLimit(limit, aUpLimit, aDownLimit);
+		if (aUpLimit == 0 && aDownLimit == 0) {
+			userLimits.erase(aUser);
+			removed = true;
+		}
+	}
 
-			gotToken = true; // token successfuly assigned
+	if (added != removed) {
+		// Running transfers of the user don't have the limit object
+		updateRunningLimits(aUser);
+	}
+
+	saveUserLimits();
+}
+
+void ThrottleManager::updateRunningLimits(const CID& aUser) noexcept {
+	// The limits of a connection may only be changed from its socket thread
+	auto update = [](UserConnection* aSource, TransferLimitList&& aLimits) {
+		aSource->callAsync([aSource, aLimits]() mutable { aSource->setLimits(move(aLimits)); });
+	};
+
+	{
+		auto dm = DownloadManager::getInstance();
+		RLock l(dm->getCS());
+		for (const auto& d: dm->getDownloads()) {
+			if (d->getUser()->getCID() == aUser) {
+				update(&d->getUserConnection(), getLimits(d->getUser(), d->getBundle() ? d->getBundle()->getToken() : 0));
+			}
 		}
 	}
 
-	if(gotToken)
 	{
-		// write to socket			
-		int sent = sock->write(buffer, len);
+		auto um = UploadManager::getInstance();
+		RLock l(um->getCS());
+		for (const auto& u: um->getUploads()) {
+			if (u->getUser()->getCID() == aUser) {
+				update(&u->getUserConnection(), getLimits(u->getUser(), 0));
+			}
+		}
+	}
+}
 
-		Thread::yield(); // give a chance to other transfers get a token
-		return sent;
+void ThrottleManager::saveUserLimits() noexcept {
+	Lock sl(saveCs);
+
+	SimpleXML xml;
+	xml.addTag("TransferLimits");
+	xml.stepIn();
+
+	xml.addTag("Users");
+	xml.stepIn();
+
+	{
+		RLock l(cs);
+		for (const auto& u : userLimits) {
+			xml.addTag("User");
+			xml.addChildAttrib("CID", u.first.toBase32());
+			xml.addChildAttrib("UploadLimit", static_cast<int>(u.second->up.getRate() / 1024));
+			xml.addChildAttrib("DownloadLimit", static_cast<int>(u.second->down.getRate() / 1024));
+		}
 	}
 
-	waitToken();
-	return 0;	// from BufferedSocket: -1 = failed, 0 = retry
+	xml.stepOut();
+	xml.stepOut();
+
+	SettingsManager::saveSettingFile(xml, CONFIG_DIR, CONFIG_NAME);
+}
+
+void ThrottleManager::loadUserLimits() noexcept {
+	try {
+		SimpleXML xml;
+		SettingsManager::loadSettingFile(xml, CONFIG_DIR, CONFIG_NAME);
+		if (xml.findChild("TransferLimits")) {
+			xml.stepIn();
+			if (xml.findChild("Users")) {
+				xml.stepIn();
+				while (xml.findChild("User")) {
+					const auto& cid = xml.getChildAttrib("CID");
+					if (cid.size() != 39) {
+						continue;
+					}
+
+					auto upLimit = xml.getIntChildAttrib("UploadLimit");
+					auto downLimit = xml.getIntChildAttrib("DownloadLimit");
+					if (upLimit < 0 || upLimit > MAX_LIMIT || downLimit < 0 || downLimit > MAX_LIMIT || (upLimit == 0 && downLimit == 0)) {
+						continue;
+					}
+
+					auto limit = make_shared<TransferLimit>();
+					updateLimit(limit, upLimit, downLimit);
+
+					WLock l(cs);
+					userLimits[CID(cid)] = limit;
+				}
+				xml.stepOut();
+			}
+			xml.stepOut();
+		}
+	} catch (const Exception& e) {
+		LogManager::getInstance()->message(STRING_F(LOAD_FAILED_X, CONFIG_NAME % e.getError()), LogMessage::SEV_ERROR);
+	}
+}
+
+void ThrottleManager::setBundleLimit(QueueToken aBundle, int aDownLimit) noexcept {
+	WLock l(cs);
+	auto& limit = bundleLimits[aBundle];
+	if (!limit) {
+		limit = make_shared<TransferLimit>();
+	}
+
+	updateLimit(limit, 0, aDownLimit);
+	if (aDownLimit == 0) {
+		bundleLimits.erase(aBundle);
+	}
+}
+
+int ThrottleManager::getBundleLimit(QueueToken aBundle) const noexcept {
+	RLock l(cs);
+	auto b = bundleLimits.find(aBundle);
+	return b != bundleLimits.end() ? static_cast<int>(b->second->down.getRate() / 1024) : 0;
+}
+
+TransferLimitList ThrottleManager::getLimits(const UserPtr& aUser, QueueToken aBundle) const noexcept {
+	TransferLimitList ret;
+
+	RLock l(cs);
+	if (aUser) {
+		auto u = userLimits.find(aUser->getCID());
+		if (u != userLimits.end()) {
+			ret.push_back(u->second);
+		}
+	}
+
+	if (aBundle != 0) {
+		auto b = bundleLimits.find(aBundle);
+		if (b != bundleLimits.end()) {
+			ret.push_back(b->second);
+		}
+	}
+
+	return ret;
+}
+
+bool ThrottleManager::isUploadLimited(const TransferLimitList* aLimits) const noexcept {
+	if (!active) {
+		return false;
+	}
+
+	if (getUpLimit() != 0) {
+		return true;
+	}
+
+	return aLimits && any_of(aLimits->begin(), aLimits->end(), [](const TransferLimitPtr& l) { return l->up.getRate() > 0; });
 }
 
 SettingsManager::IntSetting ThrottleManager::getCurSetting(SettingsManager::IntSetting setting) {
@@ -155,79 +400,19 @@ void ThrottleManager::setSetting(SettingsManager::IntSetting setting, int value)
 	ClientManager::getInstance()->infoUpdated();
 }
 
-bool ThrottleManager::getCurThrottling() {
-	Lock l(stateCS);
-	return activeWaiter != -1;
-}
-
 void ThrottleManager::waitToken() {
 	// no tokens, wait for them, so long as throttling still active
-	// avoid keeping stateCS lock on whole function
-	CriticalSection *curCS = 0;
-	{
-		Lock l(stateCS);
-		if (activeWaiter != -1)
-			curCS = &waitCS[activeWaiter];
-	}
-	// possible post-CS aW shifts: 0->1/1->0: lock lands in wrong place, will
-	// either fall through immediately or wait depending on whether in
-	// stateCS-protected transition elsewhere; 0/1-> -1: falls through. Both harmless.
-	if (curCS)
-		Lock l(*curCS);
+	if (active)
+		Thread::sleep(TOKEN_WAIT);
 }
 
 ThrottleManager::~ThrottleManager(void)
 {
 	shutdown();
-	TimerManager::getInstance()->removeListener(this);
 }
 
 void ThrottleManager::shutdown() {
-	Lock l(stateCS);
-	if (activeWaiter != -1) {
-		waitCS[activeWaiter].unlock();
-		activeWaiter = -1;
-	}
-}
-
-// TimerManagerListener
-void ThrottleManager::on(TimerManagerListener::Second, uint64_t /* aTick */) noexcept
-{
-	//int newSlots = SettingsManager::getInstance()->get(getCurSetting(SettingsManager::SLOTS));
-	//if(newSlots != SETTING(SLOTS)) {
-	//	setSetting(SettingsManager::SLOTS, newSlots);
-	//}
-
-	{
-		Lock l(stateCS);
-		if (activeWaiter == -1)
-			// This will create slight weirdness for the read/write calls between
-			// here and the first activeWaiter-toggle below.
-			waitCS[activeWaiter = 0].lock();
-	}
-
-	// readd tokens
-	{
-		Lock l(downCS);
-		downTokens = getDownLimit() * 1024;
-	}
-
-	{
-		Lock l(upCS);
-		upTokens = getUpLimit() * 1024;
-	}
-
-	// let existing events drain out (fairness).
-	// www.cse.wustl.edu/~schmidt/win32-cv-1.html documents various
-	// fairer strategies, but when only broadcasting, irrelevant
-	{
-		Lock l(stateCS);
-
-		dcassert(activeWaiter == 0 || activeWaiter == 1);
-		waitCS[1-activeWaiter].lock();
-		activeWaiter = 1-activeWaiter;
-		waitCS[1-activeWaiter].unlock();
-	}
+	active = false;
 }
 
 }	// namespace dcpp
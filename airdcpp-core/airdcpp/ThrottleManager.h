@@ -20,31 +20,41 @@
 #define _THROTTLEMANAGER_H
 
 #include "Singleton.h"
+#include "CID.h"
+#include "CriticalSection.h"
+#include "QueueItemBase.h"
 #include "Socket.h"
-#include "TimerManager.h"
 #include "SettingsManager.h"
+#include "TokenBucket.h"
 
 namespace dcpp
 {
 	/**
 	 * Manager for throttling traffic flow.
 	 * Inspired by Token Bucket algorithm: http://en.wikipedia.org/wiki/Token_bucket
+	 *
+	 * No locks are held while transferring data. The global limits can be combined with
+	 * limits for individual users and bundles.
 	 */
 	class ThrottleManager :
-		public Singleton<ThrottleManager>, private TimerManagerListener
+		public Singleton<ThrottleManager>
 	{
 	public:
 
 		/*
 		 * Throttles traffic and reads a packet from the network
+		 * If throttled_ is given, the call won't wait for new tokens but sets the flag instead
+		 * aLimits contains the additional limits that apply to the transfer
 		 */
-		int read(Socket* sock, void* buffer, size_t len);
+		int read(Socket* sock, void* buffer, size_t len, bool* throttled_ = nullptr, const TransferLimitList* aLimits = nullptr);
 
 		/*
 		 * Throttles traffic and writes a packet to the network
 		 * Handle this a little bit differently than downloads due to OpenSSL stupidity 
+		 * If throttled_ is given, the call won't wait for new tokens but sets the flag instead
+		 * aLimits contains the additional limits that apply to the transfer
 		 */
-		int write(Socket* sock, void* buffer, size_t& len);
+		int write(Socket* sock, void* buffer, size_t& len, bool* throttled_ = nullptr, const TransferLimitList* aLimits = nullptr);
 
 		void shutdown();
 
@@ -57,34 +67,61 @@ namespace dcpp
 
 		static const int MAX_LIMIT = 1024 * 1024; // 1 GiB/s
 
+		/** Sets the speed limits (KiB/s) for transfers of a user and saves them. Zero limits remove the limit. */
+		void setUserLimit(const CID& aUser, int aUpLimit, int aDownLimit) noexcept;
+
+		/** Sets the download speed limit (KiB/s) of a bundle. Zero removes the limit. The limit is saved with the bundle. */
+		void setBundleLimit(QueueToken aBundle, int aDownLimit) noexcept;
+
+		/** Returns the download speed limit (KiB/s) of a bundle, 0 if there is no limit */
+		int getBundleLimit(QueueToken aBundle) const noexcept;
+
+		/** Loads the saved user limits */
+		void loadUserLimits() noexcept;
+
+		/** Returns the user and bundle limits that apply to a new transfer (aBundle may be 0) */
+		TransferLimitList getLimits(const UserPtr& aUser, QueueToken aBundle) const noexcept;
+
+		/** Returns whether the global upload limit or any of aLimits would throttle an upload */
+		bool isUploadLimited(const TransferLimitList* aLimits) const noexcept;
 	private:
-		// stack up throttled read & write threads
-		CriticalSection stateCS;
-		CriticalSection waitCS[2];
-		long activeWaiter;
+		// Global limit + user limit + bundle limit
+		static const size_t MAX_BUCKETS = 3;
 
-		// download limiter
-		CriticalSection	downCS;
-		int64_t			downTokens;
+		typedef TokenBucket* BucketArray[MAX_BUCKETS];
 
-		// upload limiter
-		CriticalSection	upCS;
-		int64_t			upTokens;
+		// Fills the buckets that apply for the transfer and returns their count
+		static size_t getBuckets(BucketArray& buckets_, TokenBucket* aGlobal, TokenBucket TransferLimit::*aDirection, const TransferLimitList* aLimits) noexcept;
 
-		friend class Singleton<ThrottleManager>;
+		// Takes tokens from all buckets, returns the amount that was available in every one of them
+		static int64_t takeTokens(BucketArray& aBuckets, size_t aCount, int64_t aBytes) noexcept;
+		static void giveTokens(BucketArray& aBuckets, size_t aCount, int64_t aBytes) noexcept;
+
+		static void updateLimit(const TransferLimitPtr& aLimit, int aUpLimit, int aDownLimit) noexcept;
+
+		void saveUserLimits() noexcept;
 
-		ThrottleManager() : activeWaiter(-1), downTokens(0), upTokens(0)
-		{
-			TimerManager::getInstance()->addListener(this);
-		}
+		// Passes the current limits to the running transfers of the user
+		void updateRunningLimits(const CID& aUser) noexcept;
 
+		atomic<bool> active { true };
+
+		TokenBucket downBucket;
+		TokenBucket upBucket;
+
+		mutable SharedMutex cs;
+		unordered_map<CID, TransferLimitPtr> userLimits;
+		unordered_map<QueueToken, TransferLimitPtr> bundleLimits;
+
+		// Serializes writing the user limit file
+		CriticalSection saveCs;
+
+		friend class Singleton<ThrottleManager>;
+
+		ThrottleManager() { }
 		virtual ~ThrottleManager();
 
-		bool getCurThrottling();
 		void waitToken();
-
-		// TimerManagerListener
-		void on(TimerManagerListener::Second, uint64_t /* aTick */) noexcept;
 	};
 
 }	// namespace dcpp
@@ -42,6 +42,12 @@
 #define TIGER_ARCH64
 #endif
 
+// Multi-buffer compression of independent leaf blocks (selected at runtime based on the CPU features)
+#if (defined(__amd64__) || defined(__x86_64__)) && (defined(__GNUC__) || defined(__clang__)) && !defined(TIGER_BIG_ENDIAN)
+#define TIGER_MULTIBUFFER
+#include <immintrin.h>
+#endif
+
 namespace dcpp {
 
 #define PASSES 3
@@ -249,6 +255,234 @@ uint8_t* TigerHash::finalize() {
 	return getResult();
 }
 
+bool TigerHash::scalarLeaves = false;
+
+#ifdef TIGER_MULTIBUFFER
+
+/*
+ * Vectorized versions of the round macros above. Each 64 bit lane of the vectors holds
+ * the state of an independent message; the S box lookups are done with gather instructions
+ * and the multiplications with shifts. The vector operations are defined separately for
+ * each instruction set before the compress function is declared.
+ */
+#define vec_mul_5(b) V_ADD(V_SHL(b, 2), b)
+#define vec_mul_7(b) V_SUB(V_SHL(b, 3), b)
+#define vec_mul_9(b) V_ADD(V_SHL(b, 3), b)
+
+#define vec_sbox(t, c, byte) V_GATHER(t, V_AND(V_SHR(c, (byte)*8), mask))
+
+#define vec_round(a,b,c,x,mul) \
+	c = V_XOR(c, x); \
+	a = V_SUB(a, V_XOR(V_XOR(vec_sbox(t1, c, 0), vec_sbox(t2, c, 2)), \
+		V_XOR(vec_sbox(t3, c, 4), vec_sbox(t4, c, 6)))); \
+	b = V_ADD(b, V_XOR(V_XOR(vec_sbox(t4, c, 1), vec_sbox(t3, c, 3)), \
+		V_XOR(vec_sbox(t2, c, 5), vec_sbox(t1, c, 7)))); \
+	b = vec_mul_##mul(b);
+
+#define vec_pass(a,b,c,mul) \
+	vec_round(a,b,c,x0,mul) \
+	vec_round(b,c,a,x1,mul) \
+	vec_round(c,a,b,x2,mul) \
+	vec_round(a,b,c,x3,mul) \
+	vec_round(b,c,a,x4,mul) \
+	vec_round(c,a,b,x5,mul) \
+	vec_round(a,b,c,x6,mul) \
+	vec_round(b,c,a,x7,mul)
+
+#define vec_key_schedule \
+	x0 = V_SUB(x0, V_XOR(x7, V_SET1(_ULL(0xA5A5A5A5A5A5A5A5)))); \
+	x1 = V_XOR(x1, x0); \
+	x2 = V_ADD(x2, x1); \
+	x3 = V_SUB(x3, V_XOR(x2, V_SHL(V_NOT(x1), 19))); \
+	x4 = V_XOR(x4, x3); \
+	x5 = V_ADD(x5, x4); \
+	x6 = V_SUB(x6, V_XOR(x5, V_SHR(V_NOT(x4), 23))); \
+	x7 = V_XOR(x7, x6); \
+	x0 = V_ADD(x0, x7); \
+	x1 = V_SUB(x1, V_XOR(x0, V_SHL(V_NOT(x7), 19))); \
+	x2 = V_XOR(x2, x1); \
+	x3 = V_ADD(x3, x2); \
+	x4 = V_SUB(x4, V_XOR(x3, V_SHR(V_NOT(x2), 23))); \
+	x5 = V_XOR(x5, x4); \
+	x6 = V_ADD(x6, x5); \
+	x7 = V_SUB(x7, V_XOR(x6, V_SET1(_ULL(0x0123456789ABCDEF))));
+
+/*
+ * Compresses aBlocks consecutive blocks for each lane. The message words are interleaved
+ * (word i of lane j is at words[i * lanes + j]), the same applies to the state (a, b, c).
+ */
+#define vec_compress_blocks(vec, lanes) \
+{ \
+	const vec mask = V_SET1(0xFF); \
+	vec a = V_LOAD(state), b = V_LOAD(state + lanes), c = V_LOAD(state + 2 * lanes); \
+	for(size_t blk = 0; blk < aBlocks; ++blk) { \
+		const uint64_t* str = words + blk * 8 * lanes; \
+		vec x0 = V_LOAD(str), x1 = V_LOAD(str + lanes), x2 = V_LOAD(str + 2 * lanes), x3 = V_LOAD(str + 3 * lanes); \
+		vec x4 = V_LOAD(str + 4 * lanes), x5 = V_LOAD(str + 5 * lanes), x6 = V_LOAD(str + 6 * lanes), x7 = V_LOAD(str + 7 * lanes); \
+		vec aa = a, bb = b, cc = c; \
+		\
+		vec_pass(a,b,c,5) \
+		vec_key_schedule \
+		vec_pass(c,a,b,7) \
+		vec_key_schedule \
+		vec_pass(b,c,a,9) \
+		\
+		a = V_XOR(a, aa); \
+		b = V_SUB(b, bb); \
+		c = V_ADD(c, cc); \
+	} \
+	V_STORE(state, a); \
+	V_STORE(state + lanes, b); \
+	V_STORE(state + 2 * lanes, c); \
+}
+
+#define V_ADD(a, b) _mm256_add_epi64(a, b)
+#define V_SUB(a, b) _mm256_sub_epi64(a, b)
+#define V_XOR(a, b) _mm256_xor_si256(a, b)
+#define V_AND(a, b) _mm256_and_si256(a, b)
+#define V_NOT(a) _mm256_xor_si256(a, _mm256_set1_epi64x(-1))
+#define V_SHL(a, n) _mm256_slli_epi64(a, n)
+#define V_SHR(a, n) _mm256_srli_epi64(a, n)
+#define V_SET1(x) _mm256_set1_epi64x((long long)(x))
+#define V_LOAD(p) _mm256_loadu_si256((const __m256i*)(p))
+#define V_STORE(p, a) _mm256_storeu_si256((__m256i*)(p), a)
+#define V_GATHER(t, idx) _mm256_i64gather_epi64((const long long*)(t), idx, 8)
+
+__attribute__((target("avx2")))
+static void compressAVX2(const uint64_t* table, const uint64_t* words, size_t aBlocks, uint64_t* state) {
+	vec_compress_blocks(__m256i, 4)
+}
+
+#undef V_ADD
+#undef V_SUB
+#undef V_XOR
+#undef V_AND
+#undef V_NOT
+#undef V_SHL
+#undef V_SHR
+#undef V_SET1
+#undef V_LOAD
+#undef V_STORE
+#undef V_GATHER
+
+#define V_ADD(a, b) _mm512_add_epi64(a, b)
+#define V_SUB(a, b) _mm512_sub_epi64(a, b)
+#define V_XOR(a, b) _mm512_xor_si512(a, b)
+#define V_AND(a, b) _mm512_and_si512(a, b)
+#define V_NOT(a) _mm512_xor_si512(a, _mm512_set1_epi64(-1))
+#define V_SHL(a, n) _mm512_slli_epi64(a, n)
+#define V_SHR(a, n) _mm512_srli_epi64(a, n)
+#define V_SET1(x) _mm512_set1_epi64((long long)(x))
+#define V_LOAD(p) _mm512_loadu_si512((const void*)(p))
+#define V_STORE(p, a) _mm512_storeu_si512((void*)(p), a)
+#define V_GATHER(t, idx) _mm512_i64gather_epi64(idx, (const void*)(t), 8)
+
+__attribute__((target("avx512f")))
+static void compressAVX512(const uint64_t* table, const uint64_t* words, size_t aBlocks, uint64_t* state) {
+	vec_compress_blocks(__m512i, 8)
+}
+
+#undef V_ADD
+#undef V_SUB
+#undef V_XOR
+#undef V_AND
+#undef V_NOT
+#undef V_SHL
+#undef V_SHR
+#undef V_SET1
+#undef V_LOAD
+#undef V_STORE
+#undef V_GATHER
+
+struct LeafBackend {
+	const char* name;
+	size_t lanes;
+	void (*compressBlocks)(const uint64_t* table, const uint64_t* words, size_t aBlocks, uint64_t* state);
+};
+
+static const LeafBackend& getMultiBufferBackend() {
+	static const LeafBackend backend = [] {
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx512f")) {
+			return LeafBackend({ "AVX-512 (8 lanes)", 8, &compressAVX512 });
+		} else if (__builtin_cpu_supports("avx2")) {
+			return LeafBackend({ "AVX2 (4 lanes)", 4, &compressAVX2 });
+		}
+
+		return LeafBackend({ "Scalar", 1, nullptr });
+	}();
+
+	return backend;
+}
+
+#endif
+
+const char* TigerHash::getLeafBackend() {
+#ifdef TIGER_MULTIBUFFER
+	if (!scalarLeaves) {
+		return getMultiBufferBackend().name;
+	}
+#endif
+	return "Scalar";
+}
+
+void TigerHash::hashLeaves(const uint8_t* aData, size_t aBlockSize, size_t aCount, uint8_t* result_) {
+#ifdef TIGER_MULTIBUFFER
+	const auto& backend = getMultiBufferBackend();
+	const auto lanes = backend.lanes;
+	if (!scalarLeaves && lanes > 1 && aCount >= lanes) {
+		// Zero prefix, data, 0x01 terminator, zero padding and the message length in bits
+		const size_t messageLen = aBlockSize + 1;
+		const size_t blocks = (messageLen + 1 + sizeof(uint64_t) + BLOCK_SIZE - 1) / BLOCK_SIZE;
+		const size_t wordCount = blocks * BLOCK_SIZE / sizeof(uint64_t);
+
+		vector<uint64_t> message(wordCount, 0);
+		auto msgBytes = (uint8_t*)&message[0];
+		msgBytes[messageLen] = 0x01;
+		message[wordCount - 1] = ((uint64_t)messageLen) << 3;
+
+		vector<uint64_t> words(wordCount * lanes);
+		uint64_t state[3 * 8];
+
+		for (; aCount >= lanes; aCount -= lanes) {
+			for (size_t lane = 0; lane < lanes; ++lane) {
+				memcpy(msgBytes + 1, aData + lane * aBlockSize, aBlockSize);
+				for (size_t i = 0; i < wordCount; ++i) {
+					words[i * lanes + lane] = message[i];
+				}
+
+				state[lane] = _ULL(0x0123456789ABCDEF);
+				state[lanes + lane] = _ULL(0xFEDCBA9876543210);
+				state[2 * lanes + lane] = _ULL(0xF096A5B4C3B2E187);
+			}
+
+			backend.compressBlocks(table, &words[0], blocks, state);
+
+			for (size_t lane = 0; lane < lanes; ++lane) {
+				for (size_t i = 0; i < 3; ++i) {
+					memcpy(result_ + lane * BYTES + i * sizeof(uint64_t), &state[i * lanes + lane], sizeof(uint64_t));
+				}
+			}
+
+			aData += lanes * aBlockSize;
+			result_ += lanes * BYTES;
+		}
+	}
+#endif
+
+	// Scalar path for the remaining blocks
+	uint8_t zero = 0;
+	for (; aCount > 0; --aCount) {
+		TigerHash h;
+		h.update(&zero, 1);
+		h.update(aData, aBlockSize);
+		memcpy(result_, h.finalize(), BYTES);
+
+		aData += aBlockSize;
+		result_ += BYTES;
+	}
+}
+
 uint64_t TigerHash::table[4*256] = {
 	_ULL(0x02AAB17CF7E90C5E)   /*    0 */,    _ULL(0xAC424B03E243A8EC)   /*    1 */,
 		_ULL(0x72CD5BE30DD5FCD3)   /*    2 */,    _ULL(0x6D019B93F6F97F3A)   /*    3 */,
@@ -57,6 +57,20 @@ public:
 	uint8_t* finalize();
 
 	uint8_t* getResult() { return (uint8_t*) res; }
+
+	/**
+	 * Calculates the Merkle leaf hashes (Tiger of a zero byte followed by the block) for
+	 * aCount consecutive blocks of aBlockSize bytes. Independent blocks are compressed
+	 * in parallel if the CPU supports it, the results are identical to the scalar path.
+	 * @param result_ Buffer for aCount * BYTES bytes
+	 */
+	static void hashLeaves(const uint8_t* aData, size_t aBlockSize, size_t aCount, uint8_t* result_);
+
+	/** Name of the compression backend used by hashLeaves on this CPU */
+	static const char* getLeafBackend();
+
+	/** Use the scalar compression function in hashLeaves (benchmarking and verification) */
+	static void setScalarLeaves(bool aScalar) { scalarLeaves = aScalar; }
 private:
 	enum { BLOCK_SIZE = 512/8 };
 	/** 512 bit blocks for the compress function */
@@ -68,6 +82,8 @@ private:
 	/** S boxes */
 	static uint64_t table[];
 
+	static bool scalarLeaves;
+
 	void tigerCompress(const uint64_t* data, uint64_t state[3]);
 };
 
@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2011-2015 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "stdinc.h"
+#include "TokenBucket.h"
+
+#include "TimerManager.h"
+
+#include <thread>
+
+namespace dcpp {
+
+void TokenBucket::setRate(int64_t aRate) noexcept {
+	if (rate.load(std::memory_order_relaxed) != aRate) {
+		rate.store(aRate, std::memory_order_relaxed);
+	}
+}
+
+size_t TokenBucket::getShardIndex() noexcept {
+	return std::hash<std::thread::id>()(std::this_thread::get_id()) % SHARDS;
+}
+
+int64_t TokenBucket::getShardRate(int64_t aRate) noexcept {
+	return max(aRate / static_cast<int64_t>(SHARDS), static_cast<int64_t>(1));
+}
+
+int64_t TokenBucket::getMaxTokens(int64_t aShardRate) noexcept {
+	return max(aShardRate * BURST_MS / 1000, static_cast<int64_t>(1));
+}
+
+void TokenBucket::refill(Shard& aShard, uint64_t aTick, int64_t aRate) noexcept {
+	auto shardRate = getShardRate(aRate);
+	auto maxTokens = getMaxTokens(shardRate);
+
+	// Track the time in microseconds so that the partial tokens won't get lost with low rates
+	auto now = aTick * 1000;
+	auto last = aShard.lastRefill.load(std::memory_order_relaxed);
+	if (now <= last) {
+		return;
+	}
+
+	int64_t added = 0;
+	uint64_t newLast = now;
+	if (now - last >= BURST_MS * 1000) {
+		added = maxTokens;
+	} else {
+		added = static_cast<int64_t>(now - last) * shardRate / 1000000;
+		if (added == 0) {
+			// Wait until there's at least one token to add
+			return;
+		}
+
+		// Move the refill time only by the amount that was consumed by full tokens (rounded up so that it always advances)
+		newLast = last + static_cast<uint64_t>((added * 1000000 + shardRate - 1) / shardRate);
+	}
+
+	if (!aShard.lastRefill.compare_exchange_strong(last, newLast, std::memory_order_relaxed)) {
+		// Refilled by another thread
+		return;
+	}
+
+	auto cur = aShard.tokens.load(std::memory_order_relaxed);
+	while (!aShard.tokens.compare_exchange_weak(cur, min(cur + added, maxTokens), std::memory_order_relaxed)) {
+		// retry
+	}
+}
+
+int64_t TokenBucket::take(int64_t aBytes) noexcept {
+	auto curRate = getRate();
+	if (curRate <= 0) {
+		return aBytes;
+	}
+
+	auto tick = GET_TICK();
+	auto first = getShardIndex();
+
+	// Start from the own shard, take from others if it's empty
+	for (size_t i = 0; i < SHARDS; ++i) {
+		auto& shard = shards[(first + i) % SHARDS];
+		refill(shard, tick, curRate);
+
+		auto cur = shard.tokens.load(std::memory_order_relaxed);
+		while (cur > 0) {
+			auto n = min(cur, aBytes);
+			if (shard.tokens.compare_exchange_weak(cur, cur - n, std::memory_order_relaxed)) {
+				return n;
+			}
+		}
+	}
+
+	return 0;
+}
+
+void TokenBucket::give(int64_t aBytes) noexcept {
+	auto curRate = getRate();
+	if (aBytes <= 0 || curRate <= 0) {
+		return;
+	}
+
+	auto maxTokens = getMaxTokens(getShardRate(curRate));
+	auto& shard = shards[getShardIndex()];
+
+	auto cur = shard.tokens.load(std::memory_order_relaxed);
+	while (cur < maxTokens && !shard.tokens.compare_exchange_weak(cur, min(cur + aBytes, maxTokens), std::memory_order_relaxed)) {
+		// retry
+	}
+}
+
+} // namespace dcpp
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2011-2015 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef DCPLUSPLUS_DCPP_TOKEN_BUCKET_H
+#define DCPLUSPLUS_DCPP_TOKEN_BUCKET_H
+
+#include "typedefs.h"
+
+#include <boost/noncopyable.hpp>
+
+namespace dcpp {
+
+/**
+ * Lock-free token bucket used for bandwidth limiting.
+ *
+ * The tokens are split into shards so that threads transferring at the same time mostly
+ * modify different cache lines. Each shard is refilled lazily based on the elapsed time
+ * when tokens are requested from it, so there are no timer driven bursts.
+ */
+class TokenBucket : boost::noncopyable {
+public:
+	TokenBucket() { }
+
+	/** Sets the fill rate in bytes per second (0 = unlimited) */
+	void setRate(int64_t aRate) noexcept;
+	int64_t getRate() const noexcept { return rate.load(std::memory_order_relaxed); }
+
+	/** Takes at most aBytes tokens. Returns the number of tokens taken (0 if the bucket is empty). */
+	int64_t take(int64_t aBytes) noexcept;
+
+	/** Returns tokens that weren't used (the shard won't exceed the burst capacity) */
+	void give(int64_t aBytes) noexcept;
+private:
+	static const size_t SHARDS = 8;
+
+	// Maximum amount of tokens that can be accumulated (milliseconds of transfer)
+	static const int64_t BURST_MS = 250;
+
+	struct Shard {
+		atomic<int64_t> tokens { 0 };
+		atomic<uint64_t> lastRefill { 0 };
+
+		// keep the shards in different cache lines
+		char padding[64 - sizeof(atomic<int64_t>) - sizeof(atomic<uint64_t>)];
+	};
+
+	static size_t getShardIndex() noexcept;
+	static int64_t getShardRate(int64_t aRate) noexcept;
+	static int64_t getMaxTokens(int64_t aShardRate) noexcept;
+	void refill(Shard& aShard, uint64_t aTick, int64_t aRate) noexcept;
+
+	atomic<int64_t> rate { 0 };
+	Shard shards[SHARDS];
+};
+
+/** Separate upload and download limits of a single user or bundle */
+struct TransferLimit {
+	TokenBucket up;
+	TokenBucket down;
+};
+
+typedef std::shared_ptr<TransferLimit> TransferLimitPtr;
+typedef std::vector<TransferLimitPtr> TransferLimitList;
+
+} // namespace dcpp
+
+#endif // !defined(DCPLUSPLUS_DCPP_TOKEN_BUCKET_H)
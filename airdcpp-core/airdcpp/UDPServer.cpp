@@ -66,10 +66,55 @@ UDPServer::UDPServer() : stop(false), pp(true) { }
 UDPServer::~UDPServer() { }
 
 #define BUFSIZE 8192
+
+// Number of datagrams to read with a single call
+#define BATCH_SIZE 32
+
+// Number of preallocated receive buffers
+#define POOL_SIZE 256
+
+uint8_t* UDPServer::getBuffer() noexcept {
+	Lock l(cs);
+	if (!slab) {
+		slab.reset(new uint8_t[POOL_SIZE * BUFSIZE]);
+		for (int i = POOL_SIZE - 1; i >= 0; --i) {
+			freeBuffers.push_back(&slab[i * BUFSIZE]);
+		}
+	}
+
+	if (freeBuffers.empty()) {
+		// The packets aren't being handled fast enough
+		return new uint8_t[BUFSIZE];
+	}
+
+	auto buf = freeBuffers.back();
+	freeBuffers.pop_back();
+	return buf;
+}
+
+void UDPServer::releaseBuffer(uint8_t* aBuf) noexcept {
+	Lock l(cs);
+	if (aBuf >= &slab[0] && aBuf < &slab[0] + POOL_SIZE * BUFSIZE) {
+		freeBuffers.push_back(aBuf);
+	} else {
+		delete[] aBuf;
+	}
+}
+
+void UDPServer::handlePackets(DatagramList& aPackets) noexcept {
+	for (auto& p: aPackets) {
+		handlePacket(p.buf, p.len, p.ip);
+		releaseBuffer(p.buf);
+	}
+}
+
 int UDPServer::run() {
-	uint8_t* buf = nullptr;
-	int len;
-	string remoteAddr;
+	// Datagrams waiting to be filled
+	Socket::Datagram datagrams[BATCH_SIZE];
+	for (auto& d: datagrams) {
+		d.buf = nullptr;
+		d.bufLen = BUFSIZE;
+	}
 
 	while(!stop) {
 		try {
@@ -77,13 +122,29 @@ int UDPServer::run() {
 				continue;
 			}
 
-			buf = new uint8_t[BUFSIZE];
-			if((len = socket->read(buf, BUFSIZE, remoteAddr)) > 0) {
-				pp.addTask([=] { handlePacket(buf, len, remoteAddr); });
-				continue;
+			for (auto& d: datagrams) {
+				if (!d.buf) {
+					d.buf = getBuffer();
+				}
 			}
 
-			delete buf;
+			auto count = socket->readBatch(datagrams, BATCH_SIZE);
+			if (count > 0) {
+				auto packets = make_shared<DatagramList>();
+				packets->reserve(count);
+				for (int i = 0; i < count; ++i) {
+					auto& d = datagrams[i];
+					if (d.len > 0) {
+						packets->push_back(move(d));
+						d.buf = nullptr;
+					}
+				}
+
+				if (!packets->empty()) {
+					pp.addTask([=] { handlePackets(*packets); });
+				}
+				continue;
+			}
 		} catch(const SocketException& e) {
 			dcdebug("SearchManager::run Error: %s\n", e.getError().c_str());
 		}
@@ -114,27 +175,40 @@ int UDPServer::run() {
 		}
 	}
 
+	for (auto& d: datagrams) {
+		if (d.buf) {
+			releaseBuffer(d.buf);
+		}
+	}
+
 	return 0;
 }
 
 void UDPServer::handlePacket(uint8_t* aBuf, size_t aLen, const string& aRemoteIp) {
-	string x((char*) aBuf, aLen);
+	string x;
 
 	//check if this packet has been encrypted
 	if (SETTING(ENABLE_SUDP) && aLen >= 32 && ((aLen & 15) == 0)) {
-		SearchManager::getInstance()->decryptPacket(x, aLen, aBuf, BUFSIZE);
+		SearchManager::getInstance()->decryptPacket(x, aLen, aBuf);
 	}
-			
-	delete aBuf;
+
+	// The packet is copied only once to the string that is passed to the handlers
+	if (x.empty())
+		x.assign((char*) aBuf, aLen);
+
 	if (x.empty())
 		return;
 
 	COMMAND_DEBUG(x, DebugManager::TYPE_CLIENT_UDP, DebugManager::INCOMING, aRemoteIp);
 
+	// ADC commands are parsed without the trailing newline
+	auto isAdc = [&x](const char* aCmd) { return x.compare(1, 4, aCmd) == 0 && x[x.length() - 1] == 0x0a; };
+
 	if(x.compare(0, 4, "$SR ") == 0) {
 		SearchManager::getInstance()->onSR(x, aRemoteIp);
-	} else if(x.compare(1, 4, "RES ") == 0 && x[x.length() - 1] == 0x0a) {
-		AdcCommand c(x.substr(0, x.length()-1));
+	} else if(isAdc("RES ")) {
+		x.pop_back();
+		AdcCommand c(x);
 		if(c.getParameters().empty())
 			return;
 		string cid = c.getParam(0);
@@ -149,8 +223,9 @@ void UDPServer::handlePacket(uint8_t* aBuf, size_t aLen, const string& aRemoteIp
 		c.getParameters().erase(c.getParameters().begin());
 
 		SearchManager::getInstance()->onRES(c, user, aRemoteIp);
-	} else if (x.compare(1, 4, "PSR ") == 0 && x[x.length() - 1] == 0x0a) {
-		AdcCommand c(x.substr(0, x.length()-1));
+	} else if (isAdc("PSR ")) {
+		x.pop_back();
+		AdcCommand c(x);
 		if(c.getParameters().empty())
 			return;
 		string cid = c.getParam(0);
@@ -164,12 +239,13 @@ void UDPServer::handlePacket(uint8_t* aBuf, size_t aLen, const string& aRemoteIp
 			
 		SearchManager::getInstance()->onPSR(c, user, aRemoteIp);
 		
-	} else if (x.compare(1, 4, "PBD ") == 0 && x[x.length() - 1] == 0x0a) {
+	} else if (isAdc("PBD ")) {
 		if (!SETTING(USE_PARTIAL_SHARING)) {
 			return;
 		}
 		//LogManager::getInstance()->message("GOT PBD UDP: " + x);
-		AdcCommand c(x.substr(0, x.length()-1));
+		x.pop_back();
+		AdcCommand c(x);
 		if(c.getParameters().empty())
 			return;
 		string cid = c.getParam(0);
@@ -183,8 +259,9 @@ void UDPServer::handlePacket(uint8_t* aBuf, size_t aLen, const string& aRemoteIp
 		if (user)
 			SearchManager::getInstance()->onPBD(c, user);
 		
-	} else if ((x.compare(1, 4, "UBD ") == 0 || x.compare(1, 4, "UBN ") == 0) && x[x.length() - 1] == 0x0a) {
-		AdcCommand c(x.substr(0, x.length()-1));
+	} else if (isAdc("UBD ") || isAdc("UBN ")) {
+		x.pop_back();
+		AdcCommand c(x);
 		if(c.getParameters().empty())
 			return;
 			
@@ -19,6 +19,7 @@
 #ifndef DCPLUSPLUS_DCPP_UDP_SERVER_H
 #define DCPLUSPLUS_DCPP_UDP_SERVER_H
 
+#include "CriticalSection.h"
 #include "DispatcherQueue.h"
 #include "Socket.h"
 
@@ -39,8 +40,19 @@ private:
 	string port;
 	bool stop;
 
+	// The receive buffers are taken from a preallocated slab and recycled after the packets have been handled
+	uint8_t* getBuffer() noexcept;
+	void releaseBuffer(uint8_t* aBuf) noexcept;
+
+	unique_ptr<uint8_t[]> slab;
+	vector<uint8_t*> freeBuffers;
+	CriticalSection cs;
+
 	DispatcherQueue pp;
 	void handlePacket(uint8_t* aBuf, size_t aLen, const string& aRemoteIp);
+
+	typedef vector<Socket::Datagram> DatagramList;
+	void handlePackets(DatagramList& aPackets) noexcept;
 };
 
 }
@@ -31,6 +31,7 @@
 #include "QueueManager.h"
 #include "ResourceManager.h"
 #include "ShareManager.h"
+#include "ThrottleManager.h"
 #include "Upload.h"
 #include "UploadBundle.h"
 #include "UserConnection.h"
@@ -920,6 +921,7 @@ void UploadManager::on(UserConnectionListener::Send, UserConnection* aSource) no
 	u->setStart(GET_TICK());
 	u->tick();
 	aSource->setState(UserConnection::STATE_RUNNING);
+	aSource->setLimits(ThrottleManager::getInstance()->getLimits(aSource->getUser(), 0));
 	aSource->transmitFile(u->getStream());
 	fire(UploadManagerListener::Starting(), u);
 }
@@ -964,6 +966,7 @@ void UploadManager::on(AdcCommand::GET, UserConnection* aSource, const AdcComman
 
 		u->tick();
 		aSource->setState(UserConnection::STATE_RUNNING);
+		aSource->setLimits(ThrottleManager::getInstance()->getLimits(aSource->getUser(), 0));
 		aSource->transmitFile(u->getStream());
 		fire(UploadManagerListener::Starting(), u);
 	}
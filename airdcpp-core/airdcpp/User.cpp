@@ -28,6 +28,7 @@
 #include "ClientManager.h"
 #include "UserCommand.h"
 #include "ResourceManager.h"
+#include "Socket.h"
 #include "FavoriteManager.h"
 
 #include "LogManager.h"
@@ -36,6 +37,49 @@ namespace dcpp {
 
 SharedMutex Identity::cs;
 
+namespace {
+
+// Field codes of Identity::IntField
+const char* intFieldNames[] = { "SS", "SF", "SL", "HN", "HR", "HO", "CT", "ST", "US", "DS", "U4", "U6" };
+
+// Fields with values that are shared by many users
+const char* pooledFieldNames[] = { "AP", "VE", "SU", "CO" };
+
+// The pooled values are never removed, stop adding new ones if there is something unusual going on
+const size_t MAX_POOLED_VALUES = 10000;
+unordered_set<string> valuePool;
+
+short toCode(const char* aName) {
+	return *reinterpret_cast<const short*>(aName);
+}
+
+// Only values that are formatted back identically can be stored in binary form
+bool parseInt(const string& aValue, int64_t& ret_) {
+	if(aValue.empty() || aValue.size() > 18 || (aValue[0] == '0' && aValue.size() > 1))
+		return false;
+
+	int64_t ret = 0;
+	for(auto c: aValue) {
+		if(c < '0' || c > '9')
+			return false;
+		ret = ret * 10 + (c - '0');
+	}
+
+	ret_ = ret;
+	return true;
+}
+
+string formatIp(int aFamily, const uint8_t* aAddr) {
+	char buf[INET6_ADDRSTRLEN];
+	return inet_ntop(aFamily, (void*)aAddr, buf, sizeof(buf)) ? string(buf) : Util::emptyString;
+}
+
+bool parseIp(int aFamily, const string& aValue, uint8_t* ret_) {
+	return inet_pton(aFamily, aValue.c_str(), ret_) == 1 && formatIp(aFamily, ret_) == aValue;
+}
+
+}
+
 OnlineUser::OnlineUser(const UserPtr& ptr, const ClientPtr& client_, uint32_t sid_) : identity(ptr, sid_), client(client_), isInList(false) {
 }
 
@@ -49,7 +93,7 @@ bool Identity::isTcpActive(const ClientPtr& c) const {
 
 bool Identity::isTcp4Active(const ClientPtr& c) const {
 	if (!user->isSet(User::NMDC)) {
-		return !getIp4().empty() && supports(AdcHub::TCP4_FEATURE);
+		return isSet("I4") && supports(AdcHub::TCP4_FEATURE);
 	} else {
 		//we don't want to use the global passive flag for our own user...
 		return c && user == ClientManager::getInstance()->getMe() ? c->isActiveV4() : !user->isSet(User::PASSIVE);
@@ -57,7 +101,7 @@ bool Identity::isTcp4Active(const ClientPtr& c) const {
 }
 
 bool Identity::isTcp6Active() const {
-	return !getIp6().empty() && supports(AdcHub::TCP6_FEATURE);
+	return isSet("I6") && supports(AdcHub::TCP6_FEATURE);
 }
 
 bool Identity::isUdpActive() const {
@@ -65,19 +109,19 @@ bool Identity::isUdpActive() const {
 }
 
 bool Identity::isUdp4Active() const {
-	if(getIp4().empty() || getUdp4Port().empty())
+	if(!isSet("I4") || !isSet("U4"))
 		return false;
 	return user->isSet(User::NMDC) ? !user->isSet(User::PASSIVE) : supports(AdcHub::UDP4_FEATURE);
 }
 
 bool Identity::isUdp6Active() const {
-	if(getIp6().empty() || getUdp6Port().empty())
+	if(!isSet("I6") || !isSet("U6"))
 		return false;
 	return user->isSet(User::NMDC) ? false : supports(AdcHub::UDP6_FEATURE);
 }
 
 string Identity::getUdpPort() const {
-	if(getIp6().empty() || getUdp6Port().empty()) {
+	if(!isSet("I6") || !isSet("U6")) {
 		return getUdp4Port();
 	}
 
@@ -97,19 +141,19 @@ string Identity::getConnectionString() const {
 }
 
 int64_t Identity::getAdcConnectionSpeed(bool download) const {
-	return Util::toInt64(download ? get("DS") : get("US"));
+	return getInt(download ? INT_DS : INT_US);
 }
 
 uint8_t Identity::getSlots() const {
-	return static_cast<uint8_t>(Util::toInt(get("SL")));
+	return static_cast<uint8_t>(getInt(INT_SL));
 }
 
 void Identity::getParams(ParamMap& sm, const string& prefix, bool compatibility) const {
 	{
 		RLock l(cs);
-		for(auto& i: info) {
-			sm[prefix + string((char*)(&i.first), 2)] = i.second;
-		}
+		forEachValue([&](short aCode, const string& aValue) {
+			sm[prefix + string((char*)(&aCode), 2)] = aValue;
+		});
 	}
 	if(user) {
 		sm[prefix + "NI"] = getNick();
@@ -140,7 +184,7 @@ void Identity::getParams(ParamMap& sm, const string& prefix, bool compatibility)
 }
 
 bool Identity::isClientType(ClientType ct) const {
-	int type = Util::toInt(get("CT"));
+	int type = static_cast<int>(getInt(INT_CT));
 	return (type & ct) == ct;
 }
 
@@ -155,14 +199,14 @@ string Identity::getTag() const {
 }
 
 string Identity::getV4ModeString() const {
-	if (!getIp4().empty())
+	if (isSet("I4"))
 		return isTcp4Active() ? "A" : "P";
 	else
 		return "-";
 }
 
 string Identity::getV6ModeString() const {
-	if (!getIp6().empty())
+	if (isSet("I6"))
 		return isTcp6Active() ? "A" : "P";
 	else
 		return "-";
@@ -181,6 +225,12 @@ Identity& Identity::operator = (const Identity& rhs) {
 	*static_cast<Flags*>(this) = rhs;
 	user = rhs.user;
 	sid = rhs.sid;
+	copy(begin(rhs.ints), end(rhs.ints), ints);
+	intsSet = rhs.intsSet;
+	ipsSet = rhs.ipsSet;
+	copy(begin(rhs.ip4), end(rhs.ip4), ip4);
+	copy(begin(rhs.ip6), end(rhs.ip6), ip6);
+	pooledInfo = rhs.pooledInfo;
 	info = rhs.info;
 	connectMode = rhs.connectMode;
 	return *this;
@@ -202,29 +252,142 @@ string Identity::getApplication() const {
 	return application + ' ' + version;
 }
 const string& Identity::getCountry() const {
-	bool v6 = !getIp6().empty();
+	bool v6 = isSet("I6");
 	return GeoManager::getInstance()->getCountry(v6 ? getIp6() : getIp4(), v6 ? GeoManager::V6 : GeoManager::V4);
 }
 
+int Identity::getIntField(short aCode) noexcept {
+	for(int i = 0; i < INT_LAST; ++i) {
+		if(toCode(intFieldNames[i]) == aCode)
+			return i;
+	}
+	return -1;
+}
+
+bool Identity::isPooledField(short aCode) noexcept {
+	return any_of(begin(pooledFieldNames), end(pooledFieldNames), [=](const char* n) { return toCode(n) == aCode; });
+}
+
+string Identity::getValue(short aCode) const noexcept {
+	auto intField = getIntField(aCode);
+	if(intField != -1 && (intsSet & (1 << intField)))
+		return Util::toString(ints[intField]);
+
+	if(aCode == toCode("I4") && (ipsSet & IP4_SET))
+		return formatIp(AF_INET, ip4);
+	if(aCode == toCode("I6") && (ipsSet & IP6_SET))
+		return formatIp(AF_INET6, ip6);
+
+	if(isPooledField(aCode)) {
+		auto i = find_if(pooledInfo.begin(), pooledInfo.end(), [=](const pair<short, const string*>& v) { return v.first == aCode; });
+		if(i != pooledInfo.end())
+			return *i->second;
+	}
+
+	auto i = lower_bound(info.begin(), info.end(), aCode, [](const pair<short, string>& v, short c) { return v.first < c; });
+	return i != info.end() && i->first == aCode ? i->second : Util::emptyString;
+}
+
+bool Identity::hasValue(short aCode) const noexcept {
+	auto intField = getIntField(aCode);
+	if(intField != -1 && (intsSet & (1 << intField)))
+		return true;
+
+	if((aCode == toCode("I4") && (ipsSet & IP4_SET)) || (aCode == toCode("I6") && (ipsSet & IP6_SET)))
+		return true;
+
+	if(any_of(pooledInfo.begin(), pooledInfo.end(), [=](const pair<short, const string*>& v) { return v.first == aCode; }))
+		return true;
+
+	return binary_search(info.begin(), info.end(), make_pair(aCode, string()), [](const pair<short, string>& a, const pair<short, string>& b) { return a.first < b.first; });
+}
+
+void Identity::removeValue(short aCode) noexcept {
+	auto intField = getIntField(aCode);
+	if(intField != -1)
+		intsSet &= ~(1 << intField);
+
+	if(aCode == toCode("I4"))
+		ipsSet &= ~IP4_SET;
+	if(aCode == toCode("I6"))
+		ipsSet &= ~IP6_SET;
+
+	pooledInfo.erase(remove_if(pooledInfo.begin(), pooledInfo.end(), [=](const pair<short, const string*>& v) { return v.first == aCode; }), pooledInfo.end());
+
+	auto i = lower_bound(info.begin(), info.end(), aCode, [](const pair<short, string>& v, short c) { return v.first < c; });
+	if(i != info.end() && i->first == aCode)
+		info.erase(i);
+}
+
+template<typename F>
+void Identity::forEachValue(F aF) const {
+	for(int i = 0; i < INT_LAST; ++i) {
+		if(intsSet & (1 << i))
+			aF(toCode(intFieldNames[i]), Util::toString(ints[i]));
+	}
+
+	if(ipsSet & IP4_SET)
+		aF(toCode("I4"), formatIp(AF_INET, ip4));
+	if(ipsSet & IP6_SET)
+		aF(toCode("I6"), formatIp(AF_INET6, ip6));
+
+	for(const auto& v: pooledInfo)
+		aF(v.first, *v.second);
+	for(const auto& v: info)
+		aF(v.first, v.second);
+}
+
+int64_t Identity::getInt(IntField aField) const noexcept {
+	RLock l(cs);
+	if(intsSet & (1 << aField))
+		return ints[aField];
+
+	// Not a plain number
+	return Util::toInt64(getValue(toCode(intFieldNames[aField])));
+}
+
 string Identity::get(const char* name) const {
 	RLock l(cs);
-	auto i = info.find(*(short*)name);
-	return i == info.end() ? Util::emptyString : i->second;
+	return getValue(toCode(name));
 }
 
 bool Identity::isSet(const char* name) const {
 	RLock l(cs);
-	auto i = info.find(*(short*)name);
-	return i != info.end();
+	return hasValue(toCode(name));
 }
 
 
 void Identity::set(const char* name, const string& val) {
+	auto code = toCode(name);
+
 	WLock l(cs);
+	removeValue(code);
 	if(val.empty())
-		info.erase(*(short*)name);
-	else
-		info[*(short*)name] = val;
+		return;
+
+	auto intField = getIntField(code);
+	if(intField != -1 && parseInt(val, ints[intField])) {
+		intsSet |= 1 << intField;
+		return;
+	}
+
+	if(code == toCode("I4") && parseIp(AF_INET, val, ip4)) {
+		ipsSet |= IP4_SET;
+		return;
+	}
+
+	if(code == toCode("I6") && parseIp(AF_INET6, val, ip6)) {
+		ipsSet |= IP6_SET;
+		return;
+	}
+
+	// The pool is protected by the same lock
+	if(isPooledField(code) && valuePool.size() < MAX_POOLED_VALUES) {
+		pooledInfo.emplace_back(code, &*valuePool.insert(val).first);
+		return;
+	}
+
+	info.emplace(lower_bound(info.begin(), info.end(), code, [](const pair<short, string>& v, short c) { return v.first < c; }), code, val);
 }
 
 bool Identity::supports(const string& name) const {
@@ -241,22 +404,22 @@ std::map<string, string> Identity::getInfo() const {
 	std::map<string, string> ret;
 
 	RLock l(cs);
-	for(auto& i: info) {
-		ret[string((char*)(&i.first), 2)] = i.second;
-	}
+	forEachValue([&](short aCode, const string& aValue) {
+		ret[string((char*)(&aCode), 2)] = aValue;
+	});
 
 	return ret;
 }
 
 int Identity::getTotalHubCount() const {
-	return Util::toInt(get("HN")) + Util::toInt(get("HR")) + Util::toInt(get("HO"));
+	return static_cast<int>(getInt(INT_HN) + getInt(INT_HR) + getInt(INT_HO));
 }
 
 bool Identity::updateConnectMode(const Identity& me, const Client* aClient) {
 	Mode newMode = MODE_NOCONNECT_IP;
-	bool meSupports6 = !me.getIp6().empty();
+	bool meSupports6 = me.isSet("I6");
 
-	if (meSupports6 && !getIp6().empty()) {
+	if (meSupports6 && isSet("I6")) {
 		// IPv6? active / NAT-T
 		if (isTcp6Active()) {
 			newMode = MODE_ACTIVE_V6;
@@ -265,7 +428,7 @@ bool Identity::updateConnectMode(const Identity& me, const Client* aClient) {
 		}
 	}
 
-	if (!me.getIp4().empty() && !getIp4().empty()) {
+	if (me.isSet("I4") && isSet("I4")) {
 		if (isTcp4Active()) {
 			newMode = newMode == MODE_ACTIVE_V6 ? MODE_ACTIVE_DUAL : MODE_ACTIVE_V4;
 		} else if (newMode == MODE_NOCONNECT_IP && (me.isTcp4Active() || supports(AdcHub::NAT0_FEATURE))) { //passive v4 isn't any better than passive v6
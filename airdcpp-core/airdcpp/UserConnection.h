@@ -155,6 +155,7 @@ public:
 
 	void disconnect(bool graceless = false) { if(socket) socket->disconnect(graceless); }
 	void transmitFile(InputStream* f) { socket->transmitFile(f); }
+	void setLimits(TransferLimitList&& aLimits) { dcassert(socket); socket->setLimits(move(aLimits)); }
 
 	const string& getDirectionString() const {
 		dcassert(isSet(FLAG_UPLOAD) ^ isSet(FLAG_DOWNLOAD));
@@ -140,6 +140,11 @@ QueueItemPtr UserQueue::getNextBundleQI(const UserPtr& aUser, const QueueTokenSe
 
 void UserQueue::addDownload(QueueItemPtr& qi, Download* d) noexcept {
 	qi->addDownload(d);
+	runningItems.emplace(qi->getToken(), qi);
+}
+
+void UserQueue::removeRunning(const QueueItemPtr& qi) noexcept {
+	runningItems.erase(qi->getToken());
 }
 
 void UserQueue::removeDownload(QueueItemPtr& qi, const string& aToken) noexcept {
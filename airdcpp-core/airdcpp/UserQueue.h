@@ -44,6 +44,10 @@ public:
 	void addDownload(QueueItemPtr& qi, Download* d) noexcept;
 	void removeDownload(QueueItemPtr& qi, const string& aToken) noexcept;
 
+	/** Items that have had downloads started. Items that aren't running anymore are kept until they are removed with removeRunning. */
+	const QueueItem::TokenMap& getRunningItems() const noexcept { return runningItems; }
+	void removeRunning(const QueueItemPtr& qi) noexcept;
+
 	void removeQI(QueueItemPtr& qi, bool removeRunning = true) noexcept;
 	void removeQI(QueueItemPtr& qi, const UserPtr& aUser, bool removeRunning = true, Flags::MaskType reason = 0) noexcept;
 	void setQIPriority(QueueItemPtr& qi, QueueItemBase::Priority p) noexcept;
@@ -59,6 +63,8 @@ private:
 	unordered_map<UserPtr, BundleList, User::Hash> userBundleQueue;
 	/** High priority QueueItems by user (this is where the download order is determined) */
 	unordered_map<UserPtr, QueueItemList, User::Hash> userPrioQueue;
+	/** Items with running downloads (maintained so that the running items can be updated without going through the whole queue) */
+	QueueItem::TokenMap runningItems;
 };
 
 } // namespace dcpp
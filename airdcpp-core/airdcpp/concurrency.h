@@ -28,6 +28,9 @@
 #include <tbb/concurrent_queue.h>
 #include "tbb/task_scheduler_init.h"
 
+// The tasks are run by a thread pool
+#define HAVE_PARALLEL_TASKS
+
 namespace dcpp
 {
 
@@ -51,6 +54,8 @@ private:
 #include <ppl.h>
 #include <concurrent_queue.h>
 
+#define HAVE_PARALLEL_TASKS
+
 namespace dcpp
 {
 
@@ -86,6 +91,17 @@ public:
 
 #define parallel_for_each for_each
 
+	// Runs the tasks synchronously
+	class task_group {
+	public:
+		template <typename F>
+		void run(const F& f) {
+			f();
+		}
+
+		void wait() { }
+	};
+
 	template <typename T>
 	class concurrent_queue {
 	public:
@@ -27,6 +27,7 @@
 
 #include <airdcpp/QueueManager.h>
 #include <airdcpp/DownloadManager.h>
+#include <airdcpp/ThrottleManager.h>
 
 #include <boost/range/algorithm/copy.hpp>
 
@@ -272,6 +273,12 @@ namespace webserver {
 			QueueManager::getInstance()->setBundlePriority(b, Deserializer::deserializePriority(reqJson, false));
 		}
 
+		// Speed limit (KiB/s, zero removes the limit)
+		auto downloadLimit = JsonUtil::getEnumField<int>("download_limit", reqJson, false, 0, ThrottleManager::MAX_LIMIT);
+		if (downloadLimit) {
+			QueueManager::getInstance()->setBundleDownloadLimit(b, *downloadLimit);
+		}
+
 		// Target
 		//auto target = reqJson.find("target");
 		//if (target != reqJson.end()) {
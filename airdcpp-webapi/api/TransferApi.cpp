@@ -17,13 +17,18 @@
 */
 
 #include <web-server/stdinc.h>
+#include <web-server/JsonUtil.h>
 #include <web-server/WebServerManager.h>
 
 #include <api/TransferApi.h>
 
+#include <api/common/Deserializer.h>
 #include <api/common/Serializer.h>
 
+#include <airdcpp/CryptoManager.h>
 #include <airdcpp/DownloadManager.h>
+#include <airdcpp/SharedFileStream.h>
+#include <airdcpp/ThrottleManager.h>
 #include <airdcpp/UploadManager.h>
 
 namespace webserver {
@@ -32,6 +37,7 @@ namespace webserver {
 		UploadManager::getInstance()->addListener(this);
 
 		METHOD_HANDLER("stats", Access::ANY, ApiRequest::METHOD_GET, (), false, TransferApi::handleGetStats);
+		METHOD_HANDLER("user_limits", Access::SETTINGS_EDIT, ApiRequest::METHOD_POST, (), true, TransferApi::handleSetUserLimits);
 
 		createSubscription("transfer_statistics");
 		timer->start();
@@ -45,16 +51,43 @@ namespace webserver {
 	}
 
 	api_return TransferApi::handleGetStats(ApiRequest& aRequest) {
+		auto tls = CryptoManager::getInstance()->getHandshakeStats();
+		auto fullHandshakes = tls.handshakes - tls.resumed;
+		auto filePool = SharedFileStream::getPoolStats();
+
 		aRequest.setResponseBody({
 			{ "session_downloaded", Socket::getTotalDown() },
 			{ "session_uploaded", Socket::getTotalUp() },
 			{ "start_total_downloaded", SETTING(TOTAL_DOWNLOAD) - Socket::getTotalDown() },
 			{ "start_total_uploaded", SETTING(TOTAL_UPLOAD) - Socket::getTotalUp() },
+			{ "tls_handshakes", tls.handshakes },
+			{ "tls_resumed", tls.resumed },
+			{ "tls_failed", tls.failed },
+			{ "tls_full_handshake_ms", fullHandshakes > 0 ? (tls.totalTime - tls.resumedTime) / fullHandshakes : 0 },
+			{ "tls_resumed_handshake_ms", tls.resumed > 0 ? tls.resumedTime / tls.resumed : 0 },
+			{ "file_handles_open", filePool.openHandles },
+			{ "file_handle_pool_hits", filePool.hits },
+			{ "file_handle_pool_misses", filePool.misses },
+			{ "file_handle_pool_contended", filePool.contended },
 		});
 
 		return websocketpp::http::status_code::ok;
 	}
 
+	api_return TransferApi::handleSetUserLimits(ApiRequest& aRequest) {
+		const auto& reqJson = aRequest.getRequestBody();
+
+		// The user doesn't need to be online
+		auto cid = Deserializer::parseCID(JsonUtil::getField<string>("cid", JsonUtil::getRawValue("user", reqJson), false));
+
+		// KiB/s, zero removes the limit
+		auto uploadLimit = JsonUtil::getEnumField<int>("upload_limit", reqJson, true, 0, ThrottleManager::MAX_LIMIT);
+		auto downloadLimit = JsonUtil::getEnumField<int>("download_limit", reqJson, true, 0, ThrottleManager::MAX_LIMIT);
+
+		ThrottleManager::getInstance()->setUserLimit(cid, *uploadLimit, *downloadLimit);
+		return websocketpp::http::status_code::ok;
+	}
+
 	void TransferApi::onTimer() {
 		if (!subscriptionActive("transfer_statistics"))
 			return;
@@ -39,6 +39,7 @@ namespace webserver {
 		}
 	private:
 		api_return handleGetStats(ApiRequest& aRequest);
+		api_return handleSetUserLimits(ApiRequest& aRequest);
 		void onTimer();
 
 		void on(DownloadManagerListener::Tick, const DownloadList& aDownloads) noexcept;
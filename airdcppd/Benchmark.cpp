@@ -0,0 +1,306 @@
+/*
+ * Copyright (C) 2012-2015 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "Benchmark.h"
+
+#include <airdcpp/stdinc.h>
+#include <airdcpp/DualString.h>
+#include <airdcpp/MerkleTree.h>
+#include <airdcpp/QueueItem.h>
+#include <airdcpp/SUDPKeys.h>
+#include <airdcpp/Text.h>
+#include <airdcpp/Util.h>
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+
+namespace airdcppd {
+
+using namespace dcpp;
+
+const Benchmark::BenchmarkInfo Benchmark::benchmarks[] = {
+	{ "tiger", &Benchmark::runTigerTree },
+	{ "sudp", &Benchmark::runSUDP },
+	{ "text", &Benchmark::runText },
+	{ "segments", &Benchmark::runSegments },
+};
+
+string Benchmark::getNames() {
+	StringList ret;
+	for (const auto& b : benchmarks) {
+		ret.push_back(b.name);
+	}
+
+	return Util::toString(", ", ret);
+}
+
+Benchmark::BenchmarkF Benchmark::checkArgs() {
+	auto name = Util::getStartupParam("--benchmark");
+	if (!name) {
+		return nullptr;
+	}
+
+	for (const auto& b : benchmarks) {
+		if (*name == b.name) {
+			return b.f;
+		}
+	}
+
+	return [=] {
+		cout << "Unknown benchmark " << *name << " (available: " << getNames() << ")" << std::endl;
+	};
+}
+
+void Benchmark::printResult(const std::string& aTitle, double aSeconds, double aBytes) {
+	cout << std::left << std::setw(30) << std::setfill(' ') << aTitle;
+	cout << std::fixed << std::setprecision(1) << (aBytes / aSeconds) / (1024 * 1024) << " MiB/s" << std::endl;
+}
+
+void Benchmark::printRate(const std::string& aTitle, double aSeconds, double aCount, const std::string& aUnit) {
+	cout << std::left << std::setw(30) << std::setfill(' ') << aTitle;
+	cout << std::fixed << std::setprecision(0) << aCount / aSeconds << " " << aUnit << "/s" << std::endl;
+}
+
+void Benchmark::runTigerTree() {
+	const size_t dataSize = 256 * 1024 * 1024;
+	const size_t readSize = 256 * 1024;
+
+	// Deterministic pseudo-random content
+	ByteVector data(dataSize);
+	uint64_t x = 88172645463325252ULL;
+	for (auto& c : data) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		c = static_cast<uint8_t>(x);
+	}
+
+	auto hash = [&] {
+		auto start = std::chrono::steady_clock::now();
+
+		TigerTree tree(TigerTree::calcBlockSize(dataSize, 10));
+		for (size_t pos = 0; pos < dataSize; pos += readSize) {
+			tree.update(&data[pos], readSize);
+		}
+
+		tree.finalize();
+		printResult(TigerHash::getLeafBackend(), std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(), dataSize);
+		return tree.getRoot();
+	};
+
+	cout << "Hashing " << dataSize / (1024 * 1024) << " MiB with TigerTree" << std::endl << std::endl;
+
+	TigerHash::setScalarLeaves(true);
+	auto scalarRoot = hash();
+
+	TigerHash::setScalarLeaves(false);
+	auto root = hash();
+
+	cout << std::endl << "Roots " << (root == scalarRoot ? "match" : "DIFFER") << ": " << root.toBase32() << std::endl;
+}
+
+void Benchmark::runSUDP() {
+	const int packetCount = 1000;
+	const int rounds = 100;
+
+	cout << "Decrypting " << packetCount * rounds << " SUDP search results" << std::endl << std::endl;
+
+	for (auto keyCount: { 1, 10, 100, 1000 }) {
+		SUDPKeys keys;
+		StringList keyStrings;
+		for (int i = 0; i < keyCount; ++i) {
+			keyStrings.push_back(keys.addKey(i));
+		}
+
+		// Results for random searches, arriving in bursts of a few results per search
+		StringList packets;
+		string key;
+		for (int i = 0; i < packetCount; ++i) {
+			if (i % 5 == 0) {
+				key = keyStrings[Util::rand(keyCount)];
+			}
+
+			auto cmd = "URES SI" + Util::toString(i * 1000) + " SL3 FN/Share/Some directory/A file with a rather long name " + Util::toString(i) + ".mkv TO" + Util::toString(i) + " TRLWPNACQDBZRYXW3VHJVCJ64QBZNGHOHHHZWCLNQ\n";
+			SUDPKeys::encrypt(cmd, key);
+			packets.push_back(move(cmd));
+		}
+
+		auto start = std::chrono::steady_clock::now();
+
+		string x;
+		int decrypted = 0;
+		for (int r = 0; r < rounds; ++r) {
+			for (const auto& p: packets) {
+				if (keys.decrypt(reinterpret_cast<const uint8_t*>(p.data()), p.size(), x)) {
+					decrypted++;
+				}
+			}
+		}
+
+		printRate(Util::toString(keyCount) + " search keys", std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(), decrypted, "results");
+		if (decrypted != packetCount * rounds) {
+			cout << "Failed to decrypt " << packetCount * rounds - decrypted << " results" << std::endl;
+		}
+	}
+}
+
+void Benchmark::runText() {
+	const int lineCount = 10000;
+	const int rounds = 20;
+
+	// Hub traffic: mostly ASCII commands and chat with an occasional accented nick or message
+	StringList lines;
+	for (int i = 0; i < lineCount; ++i) {
+		auto nick = (i % 10 == 0 ? "J\xc3\xb6rg" : "User") + Util::toString(i);
+		if (i % 3 == 0) {
+			lines.push_back("<" + nick + "> Does anyone have the Season " + Util::toString(i % 12) + " episodes? " + (i % 20 == 0 ? "Danke sch\xc3\xb6n" : "Thanks"));
+		} else {
+			lines.push_back("$MyINFO $ALL " + nick + " <AirDC++ V:3.00,M:A,H:1/0/2,S:5>$ $100\x01$$" + Util::toString(i * 1000000000LL) + "$");
+		}
+	}
+
+	auto run = [&](const string& aTitle, const function<void (const string&)>& f) {
+		auto start = std::chrono::steady_clock::now();
+		for (int r = 0; r < rounds; ++r) {
+			for (const auto& l: lines) {
+				f(l);
+			}
+		}
+
+		printRate(aTitle, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(), lineCount * rounds, "lines");
+	};
+
+	cout << "Processing " << lineCount * rounds << " hub lines" << std::endl << std::endl;
+
+	size_t total = 0;
+	run("UTF-8 -> CP1252", [&](const string& l) { total += Text::fromUtf8(l, "CP1252").size(); });
+	run("UTF-8 -> ISO-8859-1", [&](const string& l) { total += Text::fromUtf8(l, "ISO-8859-1").size(); });
+	run("toLower", [&](const string& l) { total += Text::toLower(l).size(); });
+	run("validateUtf8", [&](const string& l) { total += Text::validateUtf8(l); });
+	run("DualString", [&](const string& l) { total += DualString(l).size(); });
+
+	cout << std::endl << "Total " << total << std::endl;
+}
+
+void Benchmark::runSegments() {
+	const int64_t fileSize = 4LL * 1024 * 1024 * 1024;
+	const int64_t blockSize = 1024 * 1024;
+	const int64_t targetSize = 8 * blockSize;
+	const int sourceCount = 64;
+
+	uint64_t x = 88172645463325252ULL;
+	auto rand = [&x](int64_t aMax) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		return static_cast<int64_t>(x % static_cast<uint64_t>(aMax));
+	};
+
+	// Late phase of a download from partial sources: the remaining blocks are scattered around the file
+	SegmentMap done;
+	while (done.getLength() < fileSize / 4 * 3) {
+		auto start = rand(fileSize / blockSize) * blockSize;
+		done.add(Segment(start, min(fileSize - start, (rand(4) + 1) * blockSize)));
+	}
+
+	set<Segment> doneSet;
+	for (const auto& s: done.getSegments()) {
+		doneSet.insert(s);
+	}
+
+	// The previous implementation, which checked every block candidate against all done and running segments
+	auto findLegacy = [&](const vector<Segment>& aRunning, const QueueItem::BlockHandler& aHandler) {
+		int64_t start = 0;
+		int64_t curSize = targetSize;
+		while (start < fileSize) {
+			int64_t end = min(fileSize, start + curSize);
+			Segment block(start, end - start);
+			bool overlaps = false;
+			for (auto i = doneSet.begin(); !overlaps && i != doneSet.end(); ++i) {
+				overlaps = curSize <= blockSize ? i->getStart() <= start && i->getEnd() >= end : block.overlaps(*i);
+			}
+
+			for (auto i = aRunning.begin(); !overlaps && i != aRunning.end(); ++i) {
+				overlaps = block.overlaps(*i);
+			}
+
+			if (!overlaps && !aHandler(block)) {
+				return;
+			}
+
+			if (overlaps && curSize > blockSize) {
+				curSize -= blockSize;
+			} else {
+				start = end;
+				curSize = targetSize;
+			}
+		}
+	};
+
+	// Each round a random source finishes its segment and selects a new one
+	auto run = [&](const string& aTitle, int aRounds, bool aPartialSource, bool aLegacy) {
+		x = 88172645463325252ULL;
+		vector<Segment> running(sourceCount, Segment(0, 0));
+		int64_t checksum = 0;
+
+		auto start = std::chrono::steady_clock::now();
+		for (int r = 0; r < aRounds; ++r) {
+			auto& source = running[rand(sourceCount)];
+			source = Segment(0, 0);
+
+			Segment selected(0, 0);
+			auto handler = [&](const Segment& aBlock) {
+				checksum += aBlock.getStart();
+				if (selected.getSize() == 0) {
+					selected = aBlock;
+				}
+
+				// All blocks are collected for partial sources
+				return aPartialSource;
+			};
+
+			if (aLegacy) {
+				findLegacy(running, handler);
+			} else {
+				SegmentMap runningMap;
+				for (const auto& s: running) {
+					runningMap.add(s);
+				}
+
+				QueueItem::findFreeBlocks(done, runningMap, fileSize, blockSize, targetSize, handler);
+			}
+
+			source = selected;
+		}
+
+		printRate(aTitle, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(), aRounds, "selections");
+		return checksum;
+	};
+
+	cout << "Selecting segments for " << sourceCount << " sources (" << fileSize / (1024 * 1024) << " MiB file, " << done.size() << " done ranges)" << std::endl << std::endl;
+
+	auto legacy = run("Full source (std::set)", 2000, false, true);
+	auto current = run("Full source (SegmentMap)", 2000, false, false);
+	auto legacyPartial = run("Partial source (std::set)", 20, true, true);
+	auto currentPartial = run("Partial source (SegmentMap)", 20, true, false);
+
+	cout << std::endl << "Selections " << (legacy == current && legacyPartial == currentPartial ? "match" : "DIFFER") << std::endl;
+}
+
+} // namespace airdcppd
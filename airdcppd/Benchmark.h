@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2012-2015 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef AIRDCPPD_BENCHMARK_H
+#define AIRDCPPD_BENCHMARK_H
+
+#include <functional>
+#include <string>
+
+namespace airdcppd {
+
+// Performance benchmarks for the core components (run with --benchmark=NAME)
+class Benchmark {
+
+public:
+	typedef std::function<void()> BenchmarkF;
+	static BenchmarkF checkArgs();
+
+	static std::string getNames();
+private:
+	struct BenchmarkInfo {
+		const char* name;
+		BenchmarkF f;
+	};
+
+	static const BenchmarkInfo benchmarks[];
+
+	static void runTigerTree();
+	static void runSUDP();
+	static void runText();
+	static void runSegments();
+
+	static void printResult(const std::string& aTitle, double aSeconds, double aBytes);
+	static void printRate(const std::string& aTitle, double aSeconds, double aCount, const std::string& aUnit);
+};
+
+} // namespace airdcppd
+
+#endif //
@@ -24,6 +24,7 @@
 
 #include <web-server/WebServerManager.h>
 
+#include "Benchmark.h"
 #include "Client.h"
 #include "ConfigPrompt.h"
 #include "stacktrace.h"
@@ -237,6 +238,7 @@ static void printUsage() {
 	
 	cout << std::endl;
 	printHelp("--no-auto-connect", 	"Don't connect to any favorite hub on startup");
+	printHelp("--benchmark=NAME", 	"Run a performance benchmark (" + airdcppd::Benchmark::getNames() + ")");
 	
 	cout << std::endl;
 	cout << std::endl;
@@ -297,6 +299,12 @@ int main(int argc, char* argv[]) {
 		return 0;
 	}
 	
+	auto benchmarkF = airdcppd::Benchmark::checkArgs();
+	if (benchmarkF) {
+		benchmarkF();
+		return 0;
+	}
+
 	if (Util::hasStartupParam("-d")) {
 		asdaemon = true;
 	}